@@ -0,0 +1,411 @@
+#include "canvas.hpp"
+#include "document.hpp"
+#include "flood_fill.hpp"
+#include "paint.hpp"
+#include "process_stats.hpp"
+#include "raster.hpp"
+#include "render.hpp"
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using BenchClock = std::chrono::steady_clock;
+
+static double MillisecondsSince(BenchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// Allocation counters and wall time of one phase.
+struct Phase
+{
+    BenchClock::time_point start = BenchClock::now();
+    uint64_t allocations = AllocationCount();
+    uint64_t bytes = AllocatedBytes();
+
+    double Milliseconds() const { return MillisecondsSince(start); }
+    uint64_t Allocations() const { return AllocationCount() - allocations; }
+    uint64_t Bytes() const { return AllocatedBytes() - bytes; }
+};
+
+struct Samples
+{
+    std::vector<double> values;
+
+    double Percentile(double p)
+    {
+        if(values.empty()) return 0;
+
+        std::sort(values.begin(), values.end());
+        size_t index = (size_t)std::min<double>(values.size() - 1, std::floor(p*(values.size() - 1) + 0.5));
+        return values[index];
+    }
+};
+
+struct BenchOptions
+{
+    size_t minShapes = 1000;
+    size_t maxShapes = 10000000;
+
+    // The CPU rasterizer touches every covered pixel of every shape, past this
+    // many shapes a single run takes minutes.
+    size_t maxRasterShapes = 100000;
+    int strokeLength = 8;
+    int frames = 10;
+    bool gpu = true;
+    const char* outPath = nullptr;
+};
+
+// Synthetic document of count shapes spread over the canvas: half of them
+// short freehand dabs, the rest rectangles, circles, ellipses and lines up to
+// 100 px thick.
+static void GenerateDocument(ShapeStore& shapes, size_t count, int strokeLength, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> x(0, (float)WindowWidth);
+    std::uniform_real_distribution<float> y((float)toolbarPadding, (float)WindowHeight);
+    std::uniform_real_distribution<float> size(2, 60);
+    std::uniform_int_distribution<int> thickness(1, 100);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::uniform_int_distribution<int> channel(0, 255);
+
+    std::vector<Vector2> points(strokeLength);
+    for(size_t i = 0; i < count; i++)
+    {
+        Color color = { (unsigned char)channel(random), (unsigned char)channel(random), (unsigned char)channel(random), 255 };
+        Vector2 origin = { x(random), y(random) };
+        bool filled = (i & 1) != 0;
+
+        switch(kind(random))
+        {
+            case 0: case 1: case 2: case 3: case 4:
+            {
+                float angle = size(random);
+                for(int p = 0; p < strokeLength; p++)
+                    points[p] = { origin.x + p*std::cos(angle), origin.y + p*std::sin(angle) };
+                shapes.AddStroke(points.data(), points.size(), color, 1 + thickness(random)/10);
+            } break;
+
+            case 5:
+                shapes.Add(Rect(origin.x, origin.y, size(random), size(random), color, 1 + thickness(random)/20, filled));
+                break;
+
+            case 6:
+                shapes.Add(Circle(origin, size(random), color, 1 + thickness(random)/20, filled));
+                break;
+
+            case 7:
+                shapes.Add(Ellipse(origin, size(random), size(random), color, 1, filled));
+                break;
+
+            default:
+                shapes.Add(Line(origin, { x(random), y(random) }, color, thickness(random)));
+                break;
+        }
+    }
+}
+
+static void WriteSamples(std::string& json, const char* name, Samples& samples)
+{
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer), "\"%s\": {\"median\": %.4f, \"p95\": %.4f, \"max\": %.4f}",
+        name, samples.Percentile(0.5), samples.Percentile(0.95), samples.Percentile(1.0));
+    json += buffer;
+}
+
+static void WriteNumber(std::string& json, const char* name, double value)
+{
+    char buffer[96];
+    std::snprintf(buffer, sizeof(buffer), "\"%s\": %.4f", name, value);
+    json += buffer;
+}
+
+static void WriteCount(std::string& json, const char* name, uint64_t value)
+{
+    char buffer[96];
+    std::snprintf(buffer, sizeof(buffer), "\"%s\": %llu", name, (unsigned long long)value);
+    json += buffer;
+}
+
+// Full redraws rasterize every tile from the store, idle frames only
+// composite the cached tiles.
+static void MeasureFrames(ShapeStore& shapes, TiledCanvas& canvas, int frames, Samples& full, Samples& idle, uint64_t& frameAllocations)
+{
+    Camera2D camera {};
+    camera.zoom = 1.0f;
+    canvas.SetView(camera, WindowWidth, WindowHeight);
+    Phase allocations;
+
+    for(int frame = 0; frame < frames; frame++)
+    {
+        Phase phase;
+        canvas.MarkAllDirty();
+        BeginDrawing();
+        ClearBackground(BackgroundColor);
+        canvas.Update(shapes);
+        canvas.Render(shapes);
+        EndDrawing();
+        full.values.push_back(phase.Milliseconds());
+    }
+
+    for(int frame = 0; frame < frames; frame++)
+    {
+        Phase phase;
+        BeginDrawing();
+        ClearBackground(BackgroundColor);
+        canvas.Update(shapes);
+        canvas.Render(shapes);
+        EndDrawing();
+        idle.values.push_back(phase.Milliseconds());
+    }
+
+    frameAllocations = allocations.Allocations()/(uint64_t)(2*frames);
+}
+
+static std::string RunShapeSweep(const BenchOptions& options, ThreadPool& pool)
+{
+    std::string json;
+    for(size_t count = options.minShapes; count <= options.maxShapes; count *= 10)
+    {
+        ShapeStore shapes;
+        Phase generate;
+        GenerateDocument(shapes, count, options.strokeLength, (uint32_t)count);
+        double generateMs = generate.Milliseconds();
+        uint64_t generateAllocations = generate.Allocations();
+
+        std::vector<uint32_t> visible;
+        Phase query;
+        shapes.Query({ 0, 0, (float)TileSize, (float)TileSize }, visible);
+        double queryMs = query.Milliseconds();
+
+        double rasterMs = -1;
+        if(count <= options.maxRasterShapes)
+        {
+            Phase raster;
+            Image image = RasterizeShapes(shapes, { 0, 0, (float)WindowWidth, (float)WindowHeight }, WindowWidth, WindowHeight, BackgroundColor, pool);
+            rasterMs = raster.Milliseconds();
+            UnloadImage(image);
+        }
+
+        std::string path = "mypaint_bench.mypaint";
+        Phase save;
+        SaveDocument(shapes, path.c_str());
+        double saveMs = save.Milliseconds();
+
+        ShapeStore loaded;
+        Phase load;
+        LoadDocument(loaded, path.c_str());
+        double loadMs = load.Milliseconds();
+        uint64_t loadAllocations = load.Allocations();
+        std::remove(path.c_str());
+
+        if(!json.empty()) json += ",\n";
+        json += "    {\"sweep\": \"shapes\", ";
+        WriteCount(json, "shapes", count); json += ", ";
+        WriteCount(json, "stroke_length", (uint64_t)options.strokeLength); json += ", ";
+        WriteNumber(json, "generate_ms", generateMs); json += ", ";
+        WriteCount(json, "generate_allocations", generateAllocations); json += ", ";
+        WriteNumber(json, "query_tile_ms", queryMs); json += ", ";
+        WriteCount(json, "query_tile_hits", visible.size()); json += ", ";
+        if(rasterMs >= 0)
+        {
+            WriteNumber(json, "cpu_raster_ms", rasterMs);
+            json += ", ";
+        }
+        WriteNumber(json, "save_ms", saveMs); json += ", ";
+        WriteNumber(json, "load_ms", loadMs); json += ", ";
+        WriteCount(json, "load_allocations", loadAllocations); json += ", ";
+
+        if(options.gpu)
+        {
+            TiledCanvas canvas;
+
+            Samples full, idle;
+            uint64_t frameAllocations = 0;
+            MeasureFrames(shapes, canvas, options.frames, full, idle, frameAllocations);
+            canvas.Unload();
+
+            WriteSamples(json, "frame_full_ms", full); json += ", ";
+            WriteSamples(json, "frame_idle_ms", idle); json += ", ";
+            WriteCount(json, "frame_allocations", frameAllocations); json += ", ";
+        }
+
+        WriteCount(json, "store_bytes", shapes.BytesUsed()); json += ", ";
+        WriteCount(json, "peak_rss_bytes", PeakResidentBytes());
+        json += "}";
+
+        std::fprintf(stderr, "shapes %zu done\n", count);
+    }
+
+    return json;
+}
+
+// One stroke getting longer: what drawing it live (the freehand preview) and
+// committing it cost as the point count grows.
+static std::string RunStrokeSweep(const BenchOptions& options)
+{
+    std::string json;
+    for(size_t length = 100; length <= 100000; length *= 10)
+    {
+        std::vector<Vector2> points;
+        Phase input;
+        for(size_t i = 0; i < length; i++)
+        {
+            float t = (float)i/(float)length;
+            points.push_back({ WindowWidth*t, toolbarPadding + (WindowHeight - toolbarPadding)*(0.5f + 0.4f*std::sin(t*60)) });
+        }
+        double inputMs = input.Milliseconds();
+
+        ShapeStore shapes;
+        Phase commit;
+        shapes.AddStroke(points.data(), points.size(), WHITE, 10);
+        double commitMs = commit.Milliseconds();
+
+        json += ",\n    {\"sweep\": \"stroke_length\", ";
+        WriteCount(json, "points", length); json += ", ";
+        WriteNumber(json, "input_ms", inputMs); json += ", ";
+        WriteNumber(json, "commit_ms", commitMs);
+
+        if(options.gpu)
+        {
+            Samples preview;
+            for(int frame = 0; frame < options.frames; frame++)
+            {
+                Phase phase;
+                BeginDrawing();
+                ClearBackground(BackgroundColor);
+                DrawStroke(points.data(), points.size(), WHITE, 10);
+                EndDrawing();
+                preview.values.push_back(phase.Milliseconds());
+            }
+
+            json += ", ";
+            WriteSamples(json, "preview_frame_ms", preview);
+        }
+        json += "}";
+    }
+
+    return json;
+}
+
+// Bucket fills on a 4K render of a busy document, each from a random pixel.
+static std::string RunFillSweep(const BenchOptions& options, ThreadPool& pool)
+{
+    const int width = 3840, height = 2160;
+
+    ShapeStore shapes;
+    GenerateDocument(shapes, 1000, options.strokeLength, 1);
+    Image image = RasterizeShapes(shapes, { 0, 0, (float)WindowWidth, (float)WindowHeight }, width, height, BackgroundColor, pool);
+    if(image.data == nullptr) return "";
+
+    std::mt19937 random(1);
+    std::vector<FillSpan> spans;
+    Samples fill;
+    uint64_t spanCount = 0;
+    for(int i = 0; i < options.frames; i++)
+    {
+        int x = (int)(random()%width), y = (int)(random()%height);
+        Phase phase;
+        FloodFill((const unsigned char*)image.data, width*4, width, height, x, y, DefaultFillTolerance, spans);
+        fill.values.push_back(phase.Milliseconds());
+        spanCount = std::max<uint64_t>(spanCount, spans.size());
+    }
+
+    // The worst case: nothing on the canvas stops the fill.
+    ImageClearBackground(&image, BackgroundColor);
+    Samples empty;
+    for(int i = 0; i < options.frames; i++)
+    {
+        Phase phase;
+        FloodFill((const unsigned char*)image.data, width*4, width, height, width/2, height/2, DefaultFillTolerance, spans);
+        empty.values.push_back(phase.Milliseconds());
+    }
+    UnloadImage(image);
+
+    std::string json = ",\n    {\"sweep\": \"fill\", ";
+    WriteCount(json, "width", width); json += ", ";
+    WriteCount(json, "height", height); json += ", ";
+    WriteSamples(json, "fill_ms", fill); json += ", ";
+    WriteCount(json, "max_spans", spanCount); json += ", ";
+    WriteSamples(json, "fill_empty_ms", empty);
+    json += "}";
+
+    return json;
+}
+
+static int Usage()
+{
+    std::fprintf(stderr,
+        "usage: mypaint_bench [--min N] [--max N] [--max-raster N] [--stroke-length N] [--frames N] [--cpu-only] [--out file.json]\n");
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for(int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if(std::strcmp(argv[i], "--min") == 0 && hasValue)
+            options.minShapes = std::strtoull(argv[++i], nullptr, 10);
+        else if(std::strcmp(argv[i], "--max") == 0 && hasValue)
+            options.maxShapes = std::strtoull(argv[++i], nullptr, 10);
+        else if(std::strcmp(argv[i], "--max-raster") == 0 && hasValue)
+            options.maxRasterShapes = std::strtoull(argv[++i], nullptr, 10);
+        else if(std::strcmp(argv[i], "--stroke-length") == 0 && hasValue)
+            options.strokeLength = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--frames") == 0 && hasValue)
+            options.frames = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--cpu-only") == 0)
+            options.gpu = false;
+        else if(std::strcmp(argv[i], "--out") == 0 && hasValue)
+            options.outPath = argv[++i];
+        else
+            return Usage();
+    }
+    options.minShapes = std::max<size_t>(options.minShapes, 1);
+
+    SetTraceLogLevel(LOG_WARNING);
+    if(options.gpu)
+    {
+        // No vsync and no frame cap, frames are timed as fast as they go.
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+        InitWindow(WindowWidth, WindowHeight, "mypaint_bench");
+        SetTargetFPS(0);
+        if(!IsWindowReady())
+        {
+            std::fprintf(stderr, "no window available, measuring the CPU paths only\n");
+            options.gpu = false;
+        }
+    }
+
+    ThreadPool pool;
+    std::string results = RunShapeSweep(options, pool);
+    results += RunStrokeSweep(options);
+    results += RunFillSweep(options, pool);
+
+    std::string json = "{\n  \"benchmark\": \"mypaint\",\n  ";
+    WriteCount(json, "version", 1); json += ",\n  ";
+    WriteCount(json, "threads", pool.Size()); json += ",\n  ";
+    json += options.gpu ? "\"gpu\": true,\n" : "\"gpu\": false,\n";
+    json += "  \"results\": [\n" + results + "\n  ]\n}\n";
+
+    if(options.gpu)
+        CloseWindow();
+
+    if(options.outPath == nullptr)
+    {
+        std::fputs(json.c_str(), stdout);
+        return 0;
+    }
+
+    return SaveFileText(options.outPath, json.data()) ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+#include "canvas.hpp"
+#include "render.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Tile coordinates of areas larger than this are clamped, MarkAllDirty style
+// rectangles would overflow an int otherwise.
+constexpr float MaxWorldCoordinate = 1e9f;
+
+void TiledCanvas::Unload()
+{
+    for(auto& [key, tile]: tiles)
+        UnloadRenderTexture(tile.texture);
+
+    tiles.clear();
+    std::fill(&levelTiles[0][0], &levelTiles[0][0] + MaxLayers*ZoomLevelCount, 0);
+    batch.Unload();
+    tessellation.Clear();
+}
+
+void TiledCanvas::Prefill(const ShapeStore& shapes, ThreadPool& pool)
+{
+    tessellation.Prefill(shapes, std::ldexp(1.0f, level), pool);
+}
+
+uint64_t TiledCanvas::TileKey(uint8_t layer, int level, int x, int y)
+{
+    return ((uint64_t)layer << 60) |
+        ((uint64_t)(level - MinZoomLevel) << 56) |
+        ((uint64_t)((uint32_t)x & 0x0FFFFFFF) << 28) |
+        (uint64_t)((uint32_t)y & 0x0FFFFFFF);
+}
+
+float TiledCanvas::TileWorldSize(int level)
+{
+    return std::ldexp((float)TileSize, -level);
+}
+
+bool TiledCanvas::TileRange(int level, Rectangle area, int& firstX, int& firstY, int& lastX, int& lastY)
+{
+    float size = TileWorldSize(level);
+    auto tile = [&](float coordinate)
+    {
+        return (int)std::floor(std::clamp(coordinate, -MaxWorldCoordinate, MaxWorldCoordinate)/size);
+    };
+
+    firstX = tile(area.x);
+    firstY = tile(area.y);
+    lastX = tile(area.x + area.width);
+    lastY = tile(area.y + area.height);
+
+    return firstX <= lastX && firstY <= lastY;
+}
+
+Rectangle TiledCanvas::VisibleArea(Camera2D camera, int screenWidth, int screenHeight)
+{
+    Vector2 topLeft = GetScreenToWorld2D({ 0, 0 }, camera);
+    Vector2 bottomRight = GetScreenToWorld2D({ (float)screenWidth, (float)screenHeight }, camera);
+    return { topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y };
+}
+
+void TiledCanvas::SetView(Camera2D camera, int screenWidth, int screenHeight)
+{
+    this->camera = camera;
+    level = std::clamp((int)std::ceil(std::log2(camera.zoom) - 1e-4f), MinZoomLevel, MaxZoomLevel);
+    TileRange(level, VisibleArea(camera, screenWidth, screenHeight), firstX, firstY, lastX, lastY);
+}
+
+template<typename Fn>
+void TiledCanvas::ForEachCachedTile(Rectangle area, uint8_t layer, Fn&& fn)
+{
+    struct Range { int firstX, firstY, lastX, lastY; bool any; };
+    Range ranges[ZoomLevelCount];
+    int64_t lookups = 0;
+
+    for(int i = 0; i < ZoomLevelCount; i++)
+    {
+        Range& range = ranges[i];
+        range.any = levelTiles[layer][i] > 0 &&
+            TileRange(MinZoomLevel + i, area, range.firstX, range.firstY, range.lastX, range.lastY);
+        if(range.any)
+            lookups += (int64_t)(range.lastX - range.firstX + 1)*(range.lastY - range.firstY + 1);
+    }
+
+    // Big areas touch fewer cached tiles than they cover, walk the cache then.
+    if(lookups > (int64_t)tiles.size())
+    {
+        for(auto& [key, tile]: tiles)
+        {
+            const Range& range = ranges[tile.level - MinZoomLevel];
+            if(tile.layer == layer && range.any && tile.x >= range.firstX && tile.x <= range.lastX && tile.y >= range.firstY && tile.y <= range.lastY)
+                fn(tile);
+        }
+        return;
+    }
+
+    for(int i = 0; i < ZoomLevelCount; i++)
+    {
+        const Range& range = ranges[i];
+        if(!range.any) continue;
+
+        for(int y = range.firstY; y <= range.lastY; y++)
+        {
+            for(int x = range.firstX; x <= range.lastX; x++)
+            {
+                auto tile = tiles.find(TileKey(layer, MinZoomLevel + i, x, y));
+                if(tile != tiles.end())
+                    fn(tile->second);
+            }
+        }
+    }
+}
+
+CanvasTile& TiledCanvas::AcquireTile(uint8_t layer, int level, int x, int y)
+{
+    uint64_t key = TileKey(layer, level, x, y);
+    auto found = tiles.find(key);
+    if(found != tiles.end()) return found->second;
+
+    // Tiles on screen this frame are never evicted, the cache grows instead.
+    if(tiles.size() >= MaxCachedTiles)
+    {
+        auto oldest = tiles.end();
+        for(auto it = tiles.begin(); it != tiles.end(); ++it)
+        {
+            if(it->second.lastUsed < frame && (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+                oldest = it;
+        }
+
+        if(oldest != tiles.end())
+        {
+            UnloadRenderTexture(oldest->second.texture);
+            levelTiles[oldest->second.layer][oldest->second.level - MinZoomLevel]--;
+            tiles.erase(oldest);
+        }
+    }
+
+    CanvasTile tile;
+    tile.texture = LoadRenderTexture(TileSize, TileSize);
+    SetTextureFilter(tile.texture.texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(tile.texture.texture, TEXTURE_WRAP_CLAMP);
+    tile.layer = layer;
+    tile.level = level;
+    tile.x = x;
+    tile.y = y;
+    tile.dirty = true;
+    tile.lastUsed = frame;
+
+    levelTiles[layer][level - MinZoomLevel]++;
+    return tiles.emplace(key, tile).first->second;
+}
+
+void TiledCanvas::BeginTile(const CanvasTile& tile) const
+{
+    float size = TileWorldSize(tile.level);
+
+    Camera2D camera {};
+    camera.target = { tile.x*size, tile.y*size };
+    camera.zoom = std::ldexp(1.0f, tile.level);
+
+    BeginTextureMode(tile.texture);
+    BeginMode2D(camera);
+}
+
+void TiledCanvas::EndTile() const
+{
+    EndMode2D();
+    EndTextureMode();
+}
+
+void TiledCanvas::DrawTile(const ShapeStore& shapes, CanvasTile& tile)
+{
+    float size = TileWorldSize(tile.level);
+    float scale = std::ldexp(1.0f, tile.level);
+    Rectangle area { tile.x*size, tile.y*size, size, size };
+
+    batch.Load();
+    BeginTile(tile);
+    ClearBackground(BLANK);
+    visibleShapes.clear();
+    shapes.Query(area, tile.layer, visibleShapes);
+    BeginLayerContents();
+    batch.Begin(scale, &tessellation);
+    for(uint32_t position: visibleShapes)
+    {
+        if(excluded.empty() || !std::binary_search(excluded.begin(), excluded.end(), position))
+            batch.Add(shapes, shapes[position]);
+    }
+    batch.Flush();
+    EndLayerContents();
+    EndTile();
+
+    tile.dirty = false;
+    stats.shapesDrawn += (uint32_t)visibleShapes.size();
+    stats.tilesRedrawn++;
+    stats.tilePasses++;
+}
+
+void TiledCanvas::DrawShape(const ShapeStore& shapes, ShapeHandle handle)
+{
+    ForEachCachedTile(shapes.Bounds(handle), (uint8_t)handle.layer, [&](CanvasTile& tile)
+    {
+        // A dirty tile gets the shape when it is re-rasterized anyway.
+        if(tile.dirty) return;
+
+        batch.Load();
+        BeginTile(tile);
+        BeginLayerContents();
+        batch.Begin(std::ldexp(1.0f, tile.level), &tessellation);
+        batch.Add(shapes, handle);
+        batch.Flush();
+        EndLayerContents();
+        EndTile();
+
+        stats.shapesDrawn++;
+        stats.tilePasses++;
+    });
+}
+
+void TiledCanvas::MarkDirty(Rectangle area, uint8_t layer)
+{
+    ForEachCachedTile(area, layer, [](CanvasTile& tile) { tile.dirty = true; });
+}
+
+void TiledCanvas::MarkAllDirty()
+{
+    for(auto& [key, tile]: tiles)
+        tile.dirty = true;
+}
+
+void TiledCanvas::Update(const ShapeStore& shapes)
+{
+    frame++;
+    float size = TileWorldSize(level);
+
+    for(const Layer& layer: shapes.Layers())
+    {
+        if(!layer.visible) continue;
+
+        for(int y = firstY; y <= lastY; y++)
+        {
+            for(int x = firstX; x <= lastX; x++)
+            {
+                // Empty tiles are neither drawn nor composited. One cached
+                // from before its shapes were erased isn't used this frame,
+                // so Render leaves it out too.
+                if(!shapes.Any({ x*size, y*size, size, size }, layer.id)) continue;
+
+                CanvasTile& tile = AcquireTile(layer.id, level, x, y);
+                tile.lastUsed = frame;
+                if(tile.dirty)
+                    DrawTile(shapes, tile);
+                stats.tilesComposited++;
+            }
+        }
+    }
+}
+
+void TiledCanvas::Render(const ShapeStore& shapes, float scale) const
+{
+    float size = TileWorldSize(level);
+
+    Camera2D view = camera;
+    view.offset = { camera.offset.x*scale, camera.offset.y*scale };
+    view.zoom = camera.zoom*scale;
+
+    BeginMode2D(view);
+    for(const Layer& layer: shapes.Layers())
+    {
+        if(!layer.visible) continue;
+
+        BeginLayerBlend(layer.blend);
+        for(int y = firstY; y <= lastY; y++)
+        {
+            for(int x = firstX; x <= lastX; x++)
+            {
+                auto tile = tiles.find(TileKey(layer.id, level, x, y));
+                if(tile != tiles.end() && tile->second.lastUsed == frame)
+                    DrawLayerTexture(tile->second.texture.texture, { x*size, y*size, size, size }, layer.opacity);
+            }
+        }
+        EndLayerBlend();
+    }
+    EndMode2D();
+}
+
+Image TiledCanvas::Capture(const ShapeStore& shapes, Rectangle area, int width, int height)
+{
+    Camera2D camera {};
+    camera.target = { area.x, area.y };
+    camera.zoom = width/area.width;
+
+    batch.Load();
+    RenderTexture2D target = LoadRenderTexture(width, height);
+    RenderTexture2D layerTarget = LoadRenderTexture(width, height);
+    BeginTextureMode(target);
+    ClearBackground(BackgroundColor);
+    EndTextureMode();
+
+    for(const Layer& layer: shapes.Layers())
+    {
+        if(!layer.visible) continue;
+
+        visibleShapes.clear();
+        shapes.Query(area, layer.id, visibleShapes);
+        if(visibleShapes.empty()) continue;
+
+        BeginTextureMode(layerTarget);
+        ClearBackground(BLANK);
+        BeginMode2D(camera);
+        BeginLayerContents();
+        batch.Begin(camera.zoom);
+        for(uint32_t position: visibleShapes)
+            batch.Add(shapes, shapes[position]);
+        batch.Flush();
+        EndLayerContents();
+        EndMode2D();
+        EndTextureMode();
+
+        BeginTextureMode(target);
+        BeginLayerBlend(layer.blend);
+        DrawLayerTexture(layerTarget.texture, { 0, 0, (float)width, (float)height }, layer.opacity);
+        EndLayerBlend();
+        EndTextureMode();
+    }
+
+    Image image = LoadImageFromTexture(target.texture);
+    UnloadRenderTexture(layerTarget);
+    UnloadRenderTexture(target);
+    return image;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <unordered_map>
+#include <vector>
+#include "shape_batch.hpp"
+#include "shape_store.hpp"
+
+constexpr int TileSize = 256;
+
+// Zoom range as powers of two. Tiles are rasterized at the first power of two
+// at or above the camera zoom and scaled down by at most half from there.
+constexpr int MinZoomLevel = -6;
+constexpr int MaxZoomLevel = 4;
+constexpr int ZoomLevelCount = MaxZoomLevel - MinZoomLevel + 1;
+
+// Tiles kept on the GPU across every zoom level and layer, 256KB each. More
+// than a screen of a few layers needs at any zoom so panning back doesn't
+// redraw.
+constexpr size_t MaxCachedTiles = 192;
+
+struct CanvasTile
+{
+    RenderTexture2D texture;
+    uint8_t layer;
+    int level;
+    int x, y;
+    bool dirty;
+    uint64_t lastUsed;
+};
+
+// Work the canvas did since the last ResetStats. Every tile pass switches the
+// render target, which makes rlgl flush its batch. Draw calls count the shape
+// batches plus one per tile composited on screen.
+struct CanvasStats
+{
+    uint32_t shapesDrawn = 0;
+    uint32_t tilesRedrawn = 0;
+    uint32_t tilePasses = 0;
+    uint32_t tilesComposited = 0;
+    uint32_t drawCalls = 0;
+};
+
+// The committed drawing in world space, cut into TileSize x TileSize render
+// textures per layer and zoom level. Only tiles of visible layers the camera
+// sees are rasterized, lazily and from the shapes the spatial index finds in
+// them, one ShapeBatch per tile. A layer gets no tile where it has nothing
+// and Render blends the layers over the background in one pass, so
+// an edit only redraws tiles of its own layer and hiding, fading or
+// reordering layers redraws none. A new shape is drawn into the cached tiles
+// it touches; removing one marks its tiles dirty. Least recently seen tiles
+// are dropped once the cache is full. Ellipses, strokes and fills are
+// tessellated once per zoom level, every tile they cross and every redraw
+// reuses the vertices.
+class TiledCanvas
+{
+public:
+    void Unload();
+
+    // World area a camera shows on a screen of the given size.
+    static Rectangle VisibleArea(Camera2D camera, int screenWidth, int screenHeight);
+
+    // Picks the zoom level and the tiles Update and Render work on.
+    void SetView(Camera2D camera, int screenWidth, int screenHeight);
+
+    // Tessellates a document that was just loaded at the current zoom level,
+    // on the pool, ahead of the tiles needing it.
+    void Prefill(const ShapeStore& shapes, ThreadPool& pool);
+
+    void DrawShape(const ShapeStore& shapes, ShapeHandle handle);
+    void MarkDirty(Rectangle area, uint8_t layer);
+    void MarkAllDirty();
+
+    // Draw order positions tiles are redrawn without, sorted. A selection
+    // drag draws those shapes itself and leaves the store alone.
+    void SetExcluded(const std::vector<uint32_t>& positions) { excluded = positions; }
+
+    void Update(const ShapeStore& shapes);
+    // Composites the tiles Update used this frame. A scale below 1 draws the
+    // same view into a smaller target.
+    void Render(const ShapeStore& shapes, float scale = 1.0f) const;
+
+    // A world area drawn straight into an image of the given size with the
+    // layers blended like on screen, read back from the GPU in a single
+    // transfer. Rows come out bottom-up like any render texture read back.
+    Image Capture(const ShapeStore& shapes, Rectangle area, int width, int height);
+
+    CanvasStats Stats() const
+    {
+        CanvasStats result = stats;
+        result.drawCalls = batch.DrawCalls() + stats.tilesComposited;
+        return result;
+    }
+
+    void ResetStats()
+    {
+        stats = {};
+        batch.ResetDrawCalls();
+    }
+
+private:
+    static uint64_t TileKey(uint8_t layer, int level, int x, int y);
+    static float TileWorldSize(int level);
+    static bool TileRange(int level, Rectangle area, int& firstX, int& firstY, int& lastX, int& lastY);
+
+    // Calls fn for every cached tile of a layer overlapping area, at every level.
+    template<typename Fn>
+    void ForEachCachedTile(Rectangle area, uint8_t layer, Fn&& fn);
+
+    CanvasTile& AcquireTile(uint8_t layer, int level, int x, int y);
+    void DrawTile(const ShapeStore& shapes, CanvasTile& tile);
+    void BeginTile(const CanvasTile& tile) const;
+    void EndTile() const;
+
+    std::unordered_map<uint64_t, CanvasTile> tiles;
+    int levelTiles[MaxLayers][ZoomLevelCount] = {};
+    uint64_t frame = 0;
+
+    Camera2D camera = { {0, 0}, {0, 0}, 0, 1 };
+    int level = 0;
+    int firstX = 0, firstY = 0, lastX = -1, lastY = -1;
+
+    ShapeBatch batch;
+    TessellationCache tessellation;
+    std::vector<uint32_t> visibleShapes;
+    std::vector<uint32_t> excluded;
+    CanvasStats stats;
+};
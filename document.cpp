@@ -0,0 +1,536 @@
+#include "document.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+// Header counts are indexed by Shape, FreeHand through Fill. Version 1
+// documents predate fills and stop at Triangle.
+constexpr int ShapeKinds = (int)Shape::Fill + 1;
+constexpr int ShapeKindsV1 = (int)Shape::Triangle + 1;
+
+// Flush the save buffer to disk every this many bytes.
+constexpr size_t SaveChunkSize = 1024*1024;
+
+// Flag byte of rectangles and ellipses. Documents before version 4 only ever
+// had 0 or 1 there, a rotation follows the other fields when it isn't zero.
+constexpr uint8_t FilledFlag = 1;
+constexpr uint8_t RotatedFlag = 2;
+
+static uint8_t ShapeFlags(bool filled, float rotation)
+{
+    return (filled ? FilledFlag : 0) | (rotation != 0 ? RotatedFlag : 0);
+}
+
+static void EncodeColor(ByteWriter& out, Color color)
+{
+    out.U8(color.r);
+    out.U8(color.g);
+    out.U8(color.b);
+    out.U8(color.a);
+}
+
+static Color DecodeColor(ByteReader& in)
+{
+    Color color;
+    color.r = in.U8();
+    color.g = in.U8();
+    color.b = in.U8();
+    color.a = in.U8();
+    return color;
+}
+
+static void EncodePoint(ByteWriter& out, Vector2 point)
+{
+    out.F32(point.x);
+    out.F32(point.y);
+}
+
+static Vector2 DecodePoint(ByteReader& in)
+{
+    float x = in.F32();
+    return { x, in.F32() };
+}
+
+// Runs of the stroke one after the other, each point as the difference from
+// the previous one in fixed point. Breaks are implied by the run boundaries.
+static void EncodeStrokePoints(ByteWriter& out, const Vector2* points, size_t count)
+{
+    size_t runs = 0;
+    ForEachStrokeRun(points, count, [&](const Vector2*, size_t) { runs++; });
+    out.Varint(runs);
+
+    int64_t previousX = 0, previousY = 0;
+    ForEachStrokeRun(points, count, [&](const Vector2* run, size_t runCount)
+    {
+        out.Varint(runCount);
+        for(size_t i = 0; i < runCount; i++)
+        {
+            int64_t x = std::llround(run[i].x*PointScale);
+            int64_t y = std::llround(run[i].y*PointScale);
+            out.Zigzag(x - previousX);
+            out.Zigzag(y - previousY);
+            previousX = x;
+            previousY = y;
+        }
+    });
+}
+
+static bool DecodeStrokePoints(ByteReader& in, std::vector<Vector2>& points)
+{
+    points.clear();
+
+    uint64_t runs = in.Varint();
+    int64_t x = 0, y = 0;
+    for(uint64_t run = 0; run < runs && !in.failed; run++)
+    {
+        // Every point takes at least two bytes, anything longer is corrupt.
+        uint64_t runCount = in.Varint();
+        if(runCount > in.Remaining()/2) return false;
+
+        if(run > 0) points.push_back(StrokeBreak);
+
+        size_t first = points.size();
+        points.resize(first + runCount);
+        Vector2* out = points.data() + first;
+        for(uint64_t i = 0; i < runCount; i++)
+        {
+            x += in.Zigzag();
+            y += in.Zigzag();
+            out[i] = { x*(1.0f/PointScale), y*(1.0f/PointScale) };
+        }
+    }
+
+    return !in.failed && !points.empty();
+}
+
+// Spans come sorted by row, so each row is stored as the step from the
+// previous span's.
+static void EncodeFillSpans(ByteWriter& out, const FillSpan* spans, size_t count)
+{
+    out.Varint(count);
+
+    int previousY = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        out.Zigzag(spans[i].y - previousY);
+        out.Varint(spans[i].x);
+        out.Varint(spans[i].width);
+        out.Varint(spans[i].height);
+        previousY = spans[i].y;
+    }
+}
+
+static bool DecodeFillSpans(ByteReader& in, std::vector<FillSpan>& spans)
+{
+    // Every span takes at least four bytes, anything longer is corrupt.
+    uint64_t count = in.Varint();
+    if(count == 0 || count > in.Remaining()/4) return false;
+
+    spans.resize(count);
+    int64_t y = 0;
+    for(FillSpan& span: spans)
+    {
+        y += in.Zigzag();
+        uint64_t x = in.Varint();
+        uint64_t width = in.Varint();
+        uint64_t height = in.Varint();
+        if(y < 0 || y > UINT16_MAX || x > UINT16_MAX) return false;
+        if(width == 0 || width > UINT16_MAX || height == 0 || height > UINT16_MAX) return false;
+
+        span = { (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height };
+    }
+
+    return !in.failed;
+}
+
+void EncodeLayers(ByteWriter& out, const std::vector<Layer>& layers)
+{
+    out.Varint(layers.size());
+    for(const Layer& layer: layers)
+    {
+        out.U8(layer.id);
+        out.Varint(layer.name.size());
+        for(char c: layer.name)
+            out.U8((uint8_t)c);
+        out.U8(layer.visible);
+        out.F32(layer.opacity);
+        out.U8((uint8_t)layer.blend);
+    }
+}
+
+bool DecodeLayers(ByteReader& in, std::vector<Layer>& layers)
+{
+    uint64_t count = in.Varint();
+    if(count == 0 || count > MaxLayers) return false;
+
+    layers.resize(count);
+    bool used[MaxLayers] = {};
+    for(Layer& layer: layers)
+    {
+        layer.id = in.U8();
+        uint64_t length = in.Varint();
+        if(layer.id >= MaxLayers || used[layer.id] || length > in.Remaining()) return false;
+
+        used[layer.id] = true;
+        layer.name.assign((const char*)in.cursor, length);
+        in.cursor += length;
+        layer.visible = in.U8() != 0;
+        layer.opacity = std::clamp(in.F32(), 0.0f, 1.0f);
+        layer.blend = (LayerBlend)in.U8();
+        if(layer.blend >= LayerBlend::Count) return false;
+    }
+
+    return !in.failed;
+}
+
+void EncodeShape(ByteWriter& out, const ShapeStore& shapes, ShapeHandle handle)
+{
+    // Documents before layers had zero in the upper bits, everything was on
+    // the first layer.
+    out.U8((uint8_t)(handle.kind | handle.layer << 4));
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = shapes.Get<Rect>(handle);
+            EncodeColor(out, rect.color);
+            out.U8(ShapeFlags(rect.filled, rect.rotation));
+            out.Zigzag(rect.thickness);
+            out.F32(rect.x);
+            out.F32(rect.y);
+            out.F32(rect.width);
+            out.F32(rect.height);
+            if(rect.rotation != 0)
+                out.F32(rect.rotation);
+        } break;
+
+        case Shape::Circle:
+        {
+            const Circle& circle = shapes.Get<Circle>(handle);
+            EncodeColor(out, circle.color);
+            out.U8(circle.filled);
+            out.Zigzag(circle.thickness);
+            EncodePoint(out, circle.center);
+            out.F32(circle.radius);
+        } break;
+
+        case Shape::Ellipse:
+        {
+            const Ellipse& ellipse = shapes.Get<Ellipse>(handle);
+            EncodeColor(out, ellipse.color);
+            out.U8(ShapeFlags(ellipse.filled, ellipse.rotation));
+            out.Zigzag(ellipse.thickness);
+            EncodePoint(out, ellipse.center);
+            out.F32(ellipse.radiusH);
+            out.F32(ellipse.radiusV);
+            if(ellipse.rotation != 0)
+                out.F32(ellipse.rotation);
+        } break;
+
+        case Shape::Line:
+        {
+            const Line& line = shapes.Get<Line>(handle);
+            EncodeColor(out, line.color);
+            out.Zigzag(line.thickness);
+            EncodePoint(out, line.start);
+            EncodePoint(out, line.end);
+        } break;
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = shapes.Get<Triangle>(handle);
+            EncodeColor(out, triangle.color);
+            out.U8(triangle.filled);
+            EncodePoint(out, triangle.v1);
+            EncodePoint(out, triangle.v2);
+            EncodePoint(out, triangle.v3);
+        } break;
+
+        case Shape::FreeHand:
+        {
+            const Stroke& stroke = shapes.Get<Stroke>(handle);
+            EncodeColor(out, stroke.color);
+            out.Zigzag(stroke.thickness);
+            EncodeStrokePoints(out, shapes.StrokePoints(stroke), stroke.pointCount);
+        } break;
+
+        case Shape::Fill:
+        {
+            const Fill& fill = shapes.Get<Fill>(handle);
+            EncodeColor(out, fill.color);
+            EncodePoint(out, fill.origin);
+            out.F32(fill.cellSize);
+            EncodeFillSpans(out, shapes.FillSpans(fill), fill.spanCount);
+        } break;
+
+        default: {}
+    }
+}
+
+ShapeHandle DecodeShape(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans)
+{
+    ShapeHandle invalid = {};
+    invalid.hidden = 1;
+
+    uint8_t tag = in.U8();
+    Shape kind = (Shape)(tag & 0x0F);
+    uint8_t layer = tag >> 4;
+    Color color = DecodeColor(in);
+    if(in.failed) return invalid;
+
+    switch(kind)
+    {
+        case Shape::Rectangle:
+        {
+            Rect rect;
+            rect.color = color;
+            uint8_t flags = in.U8();
+            rect.filled = (flags & FilledFlag) != 0;
+            rect.thickness = (int)in.Zigzag();
+            rect.x = in.F32();
+            rect.y = in.F32();
+            rect.width = in.F32();
+            rect.height = in.F32();
+            rect.rotation = (flags & RotatedFlag) ? in.F32() : 0.0f;
+            if(in.failed) return invalid;
+            return shapes.Create(rect, layer);
+        }
+
+        case Shape::Circle:
+        {
+            Circle circle;
+            circle.color = color;
+            circle.filled = in.U8() != 0;
+            circle.thickness = (int)in.Zigzag();
+            circle.center = DecodePoint(in);
+            circle.radius = in.F32();
+            if(in.failed) return invalid;
+            return shapes.Create(circle, layer);
+        }
+
+        case Shape::Ellipse:
+        {
+            Ellipse ellipse;
+            ellipse.color = color;
+            uint8_t flags = in.U8();
+            ellipse.filled = (flags & FilledFlag) != 0;
+            ellipse.thickness = (int)in.Zigzag();
+            ellipse.center = DecodePoint(in);
+            ellipse.radiusH = in.F32();
+            ellipse.radiusV = in.F32();
+            ellipse.rotation = (flags & RotatedFlag) ? in.F32() : 0.0f;
+            if(in.failed) return invalid;
+            return shapes.Create(ellipse, layer);
+        }
+
+        case Shape::Line:
+        {
+            Line line;
+            line.color = color;
+            line.thickness = (int)in.Zigzag();
+            line.start = DecodePoint(in);
+            line.end = DecodePoint(in);
+            if(in.failed) return invalid;
+            return shapes.Create(line, layer);
+        }
+
+        case Shape::Triangle:
+        {
+            Triangle triangle;
+            triangle.color = color;
+            triangle.filled = in.U8() != 0;
+            triangle.v1 = DecodePoint(in);
+            triangle.v2 = DecodePoint(in);
+            triangle.v3 = DecodePoint(in);
+            if(in.failed) return invalid;
+            return shapes.Create(triangle, layer);
+        }
+
+        case Shape::FreeHand:
+        {
+            int thickness = (int)in.Zigzag();
+            if(!DecodeStrokePoints(in, points)) return invalid;
+            return shapes.CreateStroke(points.data(), points.size(), color, thickness, layer);
+        }
+
+        case Shape::Fill:
+        {
+            Vector2 origin = DecodePoint(in);
+            float cellSize = in.F32();
+            if(!DecodeFillSpans(in, spans) || !(cellSize > 0)) return invalid;
+            return shapes.CreateFill(spans.data(), spans.size(), origin, cellSize, color, layer);
+        }
+
+        default:
+            in.failed = true;
+            return invalid;
+    }
+}
+
+static bool WriteChunk(std::FILE* file, ByteWriter& out)
+{
+    bool written = std::fwrite(out.bytes.data(), 1, out.bytes.size(), file) == out.bytes.size();
+    out.bytes.clear();
+    return written;
+}
+
+bool SaveDocument(const ShapeStore& shapes, const char* path)
+{
+    uint32_t kindCounts[ShapeKinds] = {};
+    uint64_t pointCount = 0;
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        if(!shapes.IsVisible(position)) continue;
+
+        ShapeHandle handle = shapes[position];
+        kindCounts[handle.kind]++;
+        if(handle.Kind() == Shape::FreeHand)
+            pointCount += shapes.Get<Stroke>(handle).pointCount;
+    }
+
+    // Written next to the target and renamed over it, a failed save never
+    // leaves a truncated document behind.
+    std::string temporaryPath = std::string(path) + ".tmp";
+    std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+    if(file == nullptr)
+    {
+        TraceLog(LOG_WARNING, "DOCUMENT: Failed to open %s for writing", temporaryPath.c_str());
+        return false;
+    }
+
+    ByteWriter out;
+    out.bytes.reserve(SaveChunkSize + 4096);
+    out.U32(DocumentMagic);
+    out.U16(DocumentVersion);
+    out.U16(0);
+    for(uint32_t count: kindCounts)
+        out.U32(count);
+    out.U64(pointCount);
+    EncodeLayers(out, shapes.Layers());
+
+    bool ok = true;
+    for(size_t position = 0; position < shapes.Count() && ok; position++)
+    {
+        if(!shapes.IsVisible(position)) continue;
+
+        EncodeShape(out, shapes, shapes[position]);
+        if(out.bytes.size() >= SaveChunkSize)
+            ok = WriteChunk(file, out);
+    }
+
+    // Synced before the rename, the journal trusts a document newer than its
+    // snapshot to be complete.
+    ok = ok && WriteChunk(file, out) && SyncFile(file);
+    ok = std::fclose(file) == 0 && ok;
+
+    std::error_code error;
+    if(ok)
+        std::filesystem::rename(temporaryPath, path, error);
+
+    if(!ok || error)
+    {
+        std::filesystem::remove(temporaryPath, error);
+        TraceLog(LOG_WARNING, "DOCUMENT: Failed to save %s", path);
+        return false;
+    }
+
+    TraceLog(LOG_INFO, "DOCUMENT: Saved %s", path);
+    return true;
+}
+
+bool SyncFile(std::FILE* file)
+{
+    if(std::fflush(file) != 0) return false;
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool LoadDocument(ShapeStore& shapes, const char* path)
+{
+    shapes.Clear();
+
+    MappedFile file;
+    if(!file.Open(path))
+    {
+        TraceLog(LOG_WARNING, "DOCUMENT: Failed to open %s", path);
+        return false;
+    }
+
+    ByteReader in(file.Data(), file.Size());
+    if(in.U32() != DocumentMagic)
+    {
+        TraceLog(LOG_WARNING, "DOCUMENT: %s is not a MyPaint document", path);
+        return false;
+    }
+
+    uint16_t version = in.U16();
+    in.U16();
+    if(version > DocumentVersion)
+    {
+        TraceLog(LOG_WARNING, "DOCUMENT: %s was written by a newer version (%d)", path, version);
+        return false;
+    }
+
+    uint32_t kindCounts[ShapeKinds] = {};
+    uint64_t shapeCount = 0;
+    bool tooMany = false;
+    int storedKinds = version < 2 ? ShapeKindsV1 : ShapeKinds;
+    for(int kind = 0; kind < storedKinds; kind++)
+    {
+        kindCounts[kind] = in.U32();
+        shapeCount += kindCounts[kind];
+        tooMany = tooMany || kindCounts[kind] > MaxShapesPerKind;
+    }
+    uint64_t pointCount = in.U64();
+
+    // Counts are only a hint for reserving, but absurd ones mean a broken header.
+    if(in.failed || tooMany || shapeCount > in.Remaining() || pointCount > in.Remaining())
+    {
+        TraceLog(LOG_WARNING, "DOCUMENT: %s has a corrupt header", path);
+        return false;
+    }
+
+    if(version >= 3)
+    {
+        std::vector<Layer> layers;
+        if(!DecodeLayers(in, layers))
+        {
+            TraceLog(LOG_WARNING, "DOCUMENT: %s has corrupt layers", path);
+            return false;
+        }
+        shapes.SetLayers(std::move(layers));
+    }
+
+    shapes.Reserve(kindCounts, (size_t)pointCount);
+
+    std::vector<Vector2> points;
+    std::vector<FillSpan> spans;
+    while(in.Remaining() > 0)
+    {
+        ShapeHandle handle = DecodeShape(in, shapes, points, spans);
+        if(in.failed || handle.hidden || shapes.FindLayer((uint8_t)handle.layer) == nullptr)
+        {
+            shapes.Clear();
+            TraceLog(LOG_WARNING, "DOCUMENT: %s is truncated or corrupt", path);
+            return false;
+        }
+
+        shapes.PushBack(handle);
+    }
+
+    TraceLog(LOG_INFO, "DOCUMENT: Loaded %s (%zu shapes)", path, shapes.Count());
+    return true;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "shape_store.hpp"
+
+constexpr uint32_t DocumentMagic = 0x4450594D; // "MYPD"
+constexpr uint16_t DocumentVersion = 4;
+constexpr const char* DocumentExtension = ".mypaint";
+
+// Stroke points are stored as fixed point with this many steps per pixel.
+constexpr float PointScale = 16.0f;
+
+// Little-endian writer for the document format. Integers that are usually
+// small (thickness, counts, point deltas) are LEB128 varints.
+struct ByteWriter
+{
+    std::vector<unsigned char> bytes;
+
+    void U8(uint8_t value) { bytes.push_back(value); }
+
+    void U16(uint16_t value)
+    {
+        U8((uint8_t)value);
+        U8((uint8_t)(value >> 8));
+    }
+
+    void U32(uint32_t value)
+    {
+        for(int shift = 0; shift < 32; shift += 8)
+            U8((uint8_t)(value >> shift));
+    }
+
+    void U64(uint64_t value)
+    {
+        for(int shift = 0; shift < 64; shift += 8)
+            U8((uint8_t)(value >> shift));
+    }
+
+    void F32(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        U32(bits);
+    }
+
+    void Varint(uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            U8((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        U8((uint8_t)value);
+    }
+
+    void Zigzag(int64_t value) { Varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63)); }
+};
+
+// Reads what ByteWriter wrote straight out of a buffer (usually a mapped
+// file). Reading past the end returns zeroes and sets failed.
+struct ByteReader
+{
+    const unsigned char* cursor;
+    const unsigned char* end;
+    bool failed = false;
+
+    ByteReader(const unsigned char* data, size_t size) : cursor(data), end(data + size) {}
+
+    size_t Remaining() const { return (size_t)(end - cursor); }
+
+    uint8_t U8()
+    {
+        if(cursor == end)
+        {
+            failed = true;
+            return 0;
+        }
+        return *cursor++;
+    }
+
+    uint16_t U16()
+    {
+        uint16_t low = U8();
+        return (uint16_t)(low | (U8() << 8));
+    }
+
+    uint32_t U32()
+    {
+        if(Remaining() < 4)
+        {
+            failed = true;
+            cursor = end;
+            return 0;
+        }
+
+        uint32_t value = (uint32_t)cursor[0] | (uint32_t)cursor[1] << 8 | (uint32_t)cursor[2] << 16 | (uint32_t)cursor[3] << 24;
+        cursor += 4;
+        return value;
+    }
+
+    uint64_t U64()
+    {
+        uint64_t low = U32();
+        return low | (uint64_t)U32() << 32;
+    }
+
+    float F32()
+    {
+        uint32_t bits = U32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint64_t Varint()
+    {
+        // Most point deltas fit in one byte.
+        if(cursor != end && *cursor < 0x80)
+            return *cursor++;
+
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7)
+        {
+            if(cursor == end) break;
+
+            uint8_t byte = *cursor++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if(!(byte & 0x80)) return value;
+        }
+
+        failed = true;
+        return 0;
+    }
+
+    int64_t Zigzag()
+    {
+        uint64_t value = Varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+};
+
+// The layer stack bottom to top: ids, names, visibility, opacity and blend.
+void EncodeLayers(ByteWriter& out, const std::vector<Layer>& layers);
+bool DecodeLayers(ByteReader& in, std::vector<Layer>& layers);
+
+// One shape record: kind and layer, color, the shape's fields and for strokes
+// the runs of delta encoded points. DecodeShape allocates the shape in the store
+// without adding it to the draw order, points and spans are reused scratch space.
+void EncodeShape(ByteWriter& out, const ShapeStore& shapes, ShapeHandle handle);
+ShapeHandle DecodeShape(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans);
+
+// Whole documents: a header with per-kind shape counts and the total point
+// count, the layers bottom to top, then the visible shapes in draw order. Loading maps the file and
+// fills the store in place, on failure the store is left empty.
+bool SaveDocument(const ShapeStore& shapes, const char* path);
+bool LoadDocument(ShapeStore& shapes, const char* path);
+
+// Pushes the data written so far past the OS cache onto the disk.
+bool SyncFile(std::FILE* file);
@@ -0,0 +1,213 @@
+#include "flood_fill.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FILL_SSE2
+    #include <emmintrin.h>
+#endif
+
+// What the fill knows about each pixel, one byte per pixel.
+constexpr uint8_t Blocked = 0;
+constexpr uint8_t Open = 1;
+constexpr uint8_t Filled = 2;
+
+// Open where all four channels of a pixel are within tolerance of seed,
+// Blocked elsewhere. Sixteen pixels per step on SSE2.
+static void MatchRow(const unsigned char* row, int width, const unsigned char* seed, int tolerance, uint8_t* mask)
+{
+    int x = 0;
+
+#if defined(FILL_SSE2)
+    int seedPixel;
+    std::memcpy(&seedPixel, seed, sizeof(seedPixel));
+    __m128i seeds = _mm_set1_epi32(seedPixel);
+    __m128i limit = _mm_set1_epi8((char)tolerance);
+    __m128i allChannels = _mm_set1_epi32(-1);
+
+    // -1 in the lanes of the four pixels at p that match, 0 elsewhere.
+    auto match = [&](const unsigned char* p)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)p);
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(pixels, seeds), _mm_subs_epu8(seeds, pixels));
+        __m128i within = _mm_cmpeq_epi8(_mm_subs_epu8(difference, limit), _mm_setzero_si128());
+        return _mm_cmpeq_epi32(within, allChannels);
+    };
+
+    for(; x + 16 <= width; x += 16)
+    {
+        const unsigned char* p = row + (size_t)x*4;
+        __m128i low = _mm_packs_epi32(match(p), match(p + 16));
+        __m128i high = _mm_packs_epi32(match(p + 32), match(p + 48));
+        __m128i matched = _mm_packs_epi16(low, high);
+        _mm_storeu_si128((__m128i*)(mask + x), _mm_and_si128(matched, _mm_set1_epi8(Open)));
+    }
+#endif
+
+    for(; x < width; x++)
+    {
+        const unsigned char* p = row + (size_t)x*4;
+        bool matched = true;
+        for(int channel = 0; channel < 4; channel++)
+            matched = matched && std::abs(p[channel] - seed[channel]) <= tolerance;
+        mask[x] = matched ? Open : Blocked;
+    }
+}
+
+// First position in [x, end) whose mask isn't value, end when there is none.
+static int SkipWhile(const uint8_t* mask, int x, int end, uint8_t value)
+{
+#if defined(FILL_SSE2)
+    __m128i values = _mm_set1_epi8((char)value);
+    for(; x + 16 <= end; x += 16)
+    {
+        unsigned other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), values)) & 0xFFFF;
+        if(other != 0) return x + std::countr_zero(other);
+    }
+#endif
+
+    while(x < end && mask[x] == value) x++;
+    return x;
+}
+
+// First position in [x, end) whose mask is value, end when there is none.
+static int SkipUntil(const uint8_t* mask, int x, int end, uint8_t value)
+{
+#if defined(FILL_SSE2)
+    __m128i values = _mm_set1_epi8((char)value);
+    for(; x + 16 <= end; x += 16)
+    {
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), values));
+        if(same != 0) return x + std::countr_zero(same);
+    }
+#endif
+
+    while(x < end && mask[x] != value) x++;
+    return x;
+}
+
+// Start of the run of value that ends right before x.
+static int SkipWhileBackward(const uint8_t* mask, int x, uint8_t value)
+{
+#if defined(FILL_SSE2)
+    __m128i values = _mm_set1_epi8((char)value);
+    for(; x >= 16; x -= 16)
+    {
+        unsigned other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x - 16)), values)) & 0xFFFF;
+        if(other != 0) return x - 16 + std::bit_width(other);
+    }
+#endif
+
+    while(x > 0 && mask[x - 1] == value) x--;
+    return x;
+}
+
+// Span filling after Heckbert's "A Seed Fill Algorithm": every pending entry
+// is a run of row y reached from row y - dy. Its open pixels are filled
+// left and right as far as they go, the parts of the result that stick out
+// past the run are queued for both neighbouring rows. Rows are only compared
+// against the seed the first time the fill reaches them.
+bool FloodFill(const unsigned char* pixels, ptrdiff_t stride, int width, int height,
+    int seedX, int seedY, int tolerance, std::vector<FillSpan>& spans)
+{
+    spans.clear();
+    if(seedX < 0 || seedY < 0 || seedX >= width || seedY >= height) return false;
+    if(width > UINT16_MAX || height > UINT16_MAX) return false;
+
+    unsigned char seed[4];
+    std::memcpy(seed, pixels + seedY*stride + (ptrdiff_t)seedX*4, sizeof(seed));
+    tolerance = std::clamp(tolerance, 0, 255);
+
+    std::unique_ptr<uint8_t[]> mask(new uint8_t[(size_t)width*height]);
+    std::vector<uint8_t> matched(height, 0);
+    auto row = [&](int y)
+    {
+        uint8_t* line = mask.get() + (size_t)y*width;
+        if(!matched[y])
+        {
+            MatchRow(pixels + y*stride, width, seed, tolerance, line);
+            matched[y] = 1;
+        }
+        return line;
+    };
+
+    struct Pending { int x1, x2, y, dy; };
+    std::vector<Pending> pending;
+    pending.push_back({ seedX, seedX, seedY, 1 });
+    pending.push_back({ seedX, seedX, seedY - 1, -1 });
+    int firstY = seedY, lastY = seedY;
+
+    while(!pending.empty())
+    {
+        auto [x1, x2, y, dy] = pending.back();
+        pending.pop_back();
+        if(y < 0 || y >= height) continue;
+
+        uint8_t* line = row(y);
+        firstY = std::min(firstY, y);
+        lastY = std::max(lastY, y);
+
+        int x = x1;
+        if(line[x] == Open)
+        {
+            x = SkipWhileBackward(line, x, Open);
+            std::memset(line + x, Filled, x1 - x);
+            if(x < x1)
+                pending.push_back({ x, x1 - 1, y - dy, -dy });
+        }
+
+        while(x1 <= x2)
+        {
+            int end = SkipWhile(line, x1, width, Open);
+            std::memset(line + x1, Filled, end - x1);
+            x1 = end;
+
+            if(x1 > x)
+                pending.push_back({ x, x1 - 1, y + dy, dy });
+            if(x1 - 1 > x2)
+                pending.push_back({ x2 + 1, x1 - 1, y - dy, -dy });
+
+            x1 = SkipUntil(line, x1 + 1, x2, Open);
+            x = x1;
+        }
+    }
+
+    // Runs of every filled row, extending the span above when it has exactly
+    // the same columns.
+    std::vector<uint32_t> above, current;
+    for(int y = firstY; y <= lastY; y++)
+    {
+        current.clear();
+        const uint8_t* line = mask.get() + (size_t)y*width;
+        size_t next = 0;
+
+        int x = matched[y] ? SkipUntil(line, 0, width, Filled) : width;
+        while(x < width)
+        {
+            int end = SkipWhile(line, x, width, Filled);
+            while(next < above.size() && spans[above[next]].x < x)
+                next++;
+
+            if(next < above.size() && spans[above[next]].x == x && spans[above[next]].width == end - x)
+            {
+                spans[above[next]].height++;
+                current.push_back(above[next]);
+            }
+            else
+            {
+                current.push_back((uint32_t)spans.size());
+                spans.push_back({ (uint16_t)x, (uint16_t)y, (uint16_t)(end - x), 1 });
+            }
+
+            x = SkipUntil(line, end, width, Filled);
+        }
+
+        std::swap(above, current);
+    }
+
+    return !spans.empty();
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "shapes.hpp"
+
+// How far each channel of a pixel may be from the clicked one and still get
+// filled. Enough to swallow the blending at shape edges.
+constexpr int DefaultFillTolerance = 32;
+
+// Bucket fill of an RGBA8 image from (seedX, seedY) over every pixel
+// 4-connected to it whose channels are all within tolerance of the seed's.
+// stride is the distance between rows in bytes, negative to walk a bottom-up
+// image from its last row. The filled area comes out as spans sorted by row,
+// identical runs of consecutive rows merged. False when the seed is outside
+// the image or the image is too big for FillSpan.
+bool FloodFill(const unsigned char* pixels, ptrdiff_t stride, int width, int height,
+    int seedX, int seedY, int tolerance, std::vector<FillSpan>& spans);
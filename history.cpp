@@ -0,0 +1,317 @@
+#include "history.hpp"
+#include <algorithm>
+
+// Handle kind used for shapes that were moved into an edit's archive, the
+// index is then the shape's position in the archive.
+constexpr uint32_t ArchivedKind = 15;
+
+static uint32_t ShapeKey(ShapeHandle handle)
+{
+    return ((uint32_t)handle.kind << 27) | handle.index;
+}
+
+static void AddUnique(std::vector<ShapeHandle>& handles, ShapeHandle handle)
+{
+    if(handle.kind == ArchivedKind) return;
+
+    handle.hidden = 0;
+    for(ShapeHandle existing: handles)
+        if(existing.SameShape(handle)) return;
+
+    handles.push_back(handle);
+}
+
+// Shapes that are in no draw order and only exist so this edit can be undone
+// (or redone, for an undone edit).
+static void CollectRetained(const Edit& edit, bool undone, std::vector<ShapeHandle>& retained)
+{
+    retained.clear();
+
+    if(undone)
+    {
+        for(ShapeHandle handle: edit.added)
+            AddUnique(retained, handle);
+
+        for(const ShapeChange& change: edit.changed)
+            if(!change.after.SameShape(change.before))
+                AddUnique(retained, change.after);
+    }
+    else
+    {
+        // A shape only hidden in place is still in the draw order.
+        for(const ShapeChange& change: edit.changed)
+            if(!change.after.SameShape(change.before))
+                AddUnique(retained, change.before);
+    }
+}
+
+static void CountReferences(const Edit& edit, std::unordered_map<uint32_t, uint32_t>& references, int delta)
+{
+    std::vector<ShapeHandle> handles;
+    for(ShapeHandle handle: edit.added)
+        AddUnique(handles, handle);
+
+    for(const ShapeChange& change: edit.changed)
+    {
+        AddUnique(handles, change.before);
+        AddUnique(handles, change.after);
+    }
+
+    for(ShapeHandle handle: handles)
+        references[ShapeKey(handle)] += delta;
+}
+
+size_t History::MeasureEdit(const ShapeStore& shapes, const Edit& edit, bool undone) const
+{
+    size_t bytes = sizeof(Edit)
+        + edit.added.capacity()*sizeof(ShapeHandle)
+        + edit.changed.capacity()*sizeof(ShapeChange)
+        + edit.archive.capacity();
+
+    std::vector<ShapeHandle> retained;
+    CollectRetained(edit, undone, retained);
+    for(ShapeHandle handle: retained)
+        bytes += shapes.ShapeBytes(handle);
+
+    return bytes;
+}
+
+void History::Archive(ShapeStore& shapes, Edit& edit, std::unordered_map<uint32_t, uint32_t>& references)
+{
+    edit.archived = true;
+
+    std::vector<ShapeHandle> retained;
+    CollectRetained(edit, false, retained);
+
+    // A shape another edit also points at has to stay where it is.
+    std::vector<ShapeHandle> archived;
+    std::vector<unsigned char> raw;
+    for(ShapeHandle handle: retained)
+    {
+        if(references[ShapeKey(handle)] > 1) continue;
+
+        shapes.Serialize(handle, raw);
+        archived.push_back(handle);
+    }
+
+    if(archived.empty()) return;
+
+    int compressedSize = 0;
+    unsigned char* compressed = CompressData(raw.data(), (int)raw.size(), &compressedSize);
+    edit.archive.assign(compressed, compressed + compressedSize);
+    MemFree(compressed);
+
+    CountReferences(edit, references, -1);
+
+    auto toArchived = [&](ShapeHandle& handle)
+    {
+        for(size_t i = 0; i < archived.size(); i++)
+        {
+            if(!handle.SameShape(archived[i])) continue;
+
+            handle.index = (uint32_t)i;
+            handle.kind = ArchivedKind;
+            return;
+        }
+    };
+
+    for(ShapeChange& change: edit.changed)
+    {
+        toArchived(change.before);
+        toArchived(change.after);
+    }
+
+    for(ShapeHandle handle: archived)
+        shapes.Release(handle);
+
+    edit.archivedShapes = (uint32_t)archived.size();
+    CountReferences(edit, references, 1);
+}
+
+void History::Unarchive(ShapeStore& shapes, Edit& edit)
+{
+    if(edit.archivedShapes > 0)
+    {
+        int rawSize = 0;
+        unsigned char* raw = DecompressData(edit.archive.data(), (int)edit.archive.size(), &rawSize);
+
+        std::vector<ShapeHandle> restored;
+        const unsigned char* cursor = raw;
+        for(uint32_t i = 0; i < edit.archivedShapes; i++)
+            restored.push_back(shapes.Deserialize(cursor));
+
+        MemFree(raw);
+
+        auto fromArchived = [&](ShapeHandle& handle)
+        {
+            if(handle.kind != ArchivedKind) return;
+
+            uint32_t hidden = handle.hidden;
+            handle = restored[handle.index];
+            handle.hidden = hidden;
+        };
+
+        for(ShapeChange& change: edit.changed)
+        {
+            fromArchived(change.before);
+            fromArchived(change.after);
+        }
+    }
+
+    edit.archive.clear();
+    edit.archive.shrink_to_fit();
+    edit.archivedShapes = 0;
+    edit.archived = false;
+}
+
+void History::ForgetUndone(ShapeStore& shapes, Edit& edit)
+{
+    std::vector<ShapeHandle> retained;
+    CollectRetained(edit, true, retained);
+
+    for(ShapeHandle handle: retained)
+        shapes.Release(handle);
+}
+
+void History::Push(ShapeStore& shapes, Edit edit)
+{
+    // Whatever was undone can't be redone anymore.
+    for(Edit& discarded: redoStack)
+    {
+        bytesUsed -= discarded.bytes;
+        ForgetUndone(shapes, discarded);
+    }
+    redoStack.clear();
+
+    edit.bytes = MeasureEdit(shapes, edit, false);
+    bytesUsed += edit.bytes;
+    undoStack.push_back(std::move(edit));
+
+    Trim(shapes);
+}
+
+void History::Reset()
+{
+    undoStack.clear();
+    redoStack.clear();
+    bytesUsed = 0;
+}
+
+bool History::Undo(ShapeStore& shapes, TiledCanvas& canvas)
+{
+    if(undoStack.empty()) return false;
+
+    Edit edit = std::move(undoStack.back());
+    undoStack.pop_back();
+    bytesUsed -= edit.bytes;
+
+    if(edit.archived)
+        Unarchive(shapes, edit);
+
+    for(auto change = edit.changed.rbegin(); change != edit.changed.rend(); change++)
+    {
+        ShapeHandle current = shapes[change->position];
+        if(!current.hidden)
+            canvas.MarkDirty(shapes.Bounds(current), (uint8_t)current.layer);
+
+        shapes.Replace(change->position, change->before);
+        if(!change->before.hidden)
+            canvas.MarkDirty(shapes.Bounds(change->before), (uint8_t)change->before.layer);
+    }
+
+    for(size_t i = 0; i < edit.added.size(); i++)
+    {
+        ShapeHandle handle = shapes.PopBack();
+        if(!handle.hidden)
+            canvas.MarkDirty(shapes.Bounds(handle), (uint8_t)handle.layer);
+    }
+
+    edit.bytes = MeasureEdit(shapes, edit, true);
+    bytesUsed += edit.bytes;
+    redoStack.push_back(std::move(edit));
+    return true;
+}
+
+bool History::Redo(ShapeStore& shapes, TiledCanvas& canvas)
+{
+    if(redoStack.empty()) return false;
+
+    Edit edit = std::move(redoStack.back());
+    redoStack.pop_back();
+    bytesUsed -= edit.bytes;
+
+    for(ShapeHandle handle: edit.added)
+    {
+        shapes.PushBack(handle);
+        canvas.DrawShape(shapes, handle);
+    }
+
+    for(const ShapeChange& change: edit.changed)
+    {
+        ShapeHandle current = shapes[change.position];
+        if(!current.hidden)
+            canvas.MarkDirty(shapes.Bounds(current), (uint8_t)current.layer);
+
+        shapes.Replace(change.position, change.after);
+        if(!change.after.hidden)
+            canvas.MarkDirty(shapes.Bounds(change.after), (uint8_t)change.after.layer);
+    }
+
+    edit.bytes = MeasureEdit(shapes, edit, false);
+    bytesUsed += edit.bytes;
+    undoStack.push_back(std::move(edit));
+
+    Trim(shapes);
+    return true;
+}
+
+void History::Trim(ShapeStore& shapes)
+{
+    if(bytesUsed <= HistoryBudget) return;
+
+    std::unordered_map<uint32_t, uint32_t> references;
+    for(const Edit& edit: undoStack)
+        CountReferences(edit, references, 1);
+    for(const Edit& edit: redoStack)
+        CountReferences(edit, references, 1);
+
+    size_t archived = 0;
+    for(size_t i = 0; i + UncompressedEdits < undoStack.size() && bytesUsed > HistoryBudget; i++)
+    {
+        Edit& edit = undoStack[i];
+        if(edit.archived) continue;
+
+        archived++;
+        bytesUsed -= edit.bytes;
+        Archive(shapes, edit, references);
+        edit.bytes = MeasureEdit(shapes, edit, false);
+        bytesUsed += edit.bytes;
+    }
+
+    size_t forgotten = 0;
+    while(bytesUsed > HistoryBudget && undoStack.size() > 1)
+    {
+        // The oldest edit can't be undone anymore, so what it kept alive is garbage.
+        Edit& edit = undoStack.front();
+        std::vector<ShapeHandle> retained;
+        CollectRetained(edit, false, retained);
+        for(ShapeHandle handle: retained)
+        {
+            if(references[ShapeKey(handle)] <= 1)
+                shapes.Release(handle);
+        }
+
+        CountReferences(edit, references, -1);
+        bytesUsed -= edit.bytes;
+        undoStack.pop_front();
+        forgotten++;
+    }
+
+    if(archived == 0 && forgotten == 0) return;
+
+    TraceLog(
+        LOG_INFO,
+        "HISTORY: %zu edits use %zu KB of %zu KB budget (%zu compressed, %zu forgotten)",
+        undoStack.size() + redoStack.size(), bytesUsed/1024, HistoryBudget/1024, archived, forgotten
+    );
+}
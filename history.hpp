@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "canvas.hpp"
+#include "shape_store.hpp"
+
+// Bytes the history may hold before it compresses and then forgets edits.
+constexpr size_t HistoryBudget = 64*1024*1024;
+
+// The most recent edits are never compressed so undoing them stays instant.
+constexpr size_t UncompressedEdits = 32;
+
+enum class EditKind
+{
+    Add = 0,
+    Erase,
+    Clear,
+    Transform,
+    Recolor,
+};
+
+struct ShapeChange
+{
+    uint32_t position;
+    ShapeHandle before;
+    ShapeHandle after;
+};
+
+// One undoable step: shapes pushed on top of the draw order, and draw order
+// entries that were swapped for another handle (erased, cut or cleared).
+struct Edit
+{
+    Edit(EditKind kind = EditKind::Add) : kind(kind) {}
+
+    EditKind kind;
+    std::vector<ShapeHandle> added;
+    std::vector<ShapeChange> changed;
+
+    // Shapes only this edit kept alive, deflated once the history went over
+    // budget. Changes refer to them by their index in the archive.
+    std::vector<unsigned char> archive;
+    uint32_t archivedShapes = 0;
+    bool archived = false;
+
+    size_t bytes = 0;
+};
+
+// Undo/redo stacks of edits. Memory held by the history (the edits plus the
+// shapes that only undo or redo can bring back) is kept under a byte budget by
+// compressing old edits first and forgetting the oldest ones after that.
+class History
+{
+public:
+    void Push(ShapeStore& shapes, Edit edit);
+    bool Undo(ShapeStore& shapes, TiledCanvas& canvas);
+    bool Redo(ShapeStore& shapes, TiledCanvas& canvas);
+
+    // Drops every edit without touching the store, for when the document
+    // they refer to was replaced.
+    void Reset();
+
+    size_t BytesUsed() const { return bytesUsed; }
+    size_t UndoCount() const { return undoStack.size(); }
+    size_t RedoCount() const { return redoStack.size(); }
+
+private:
+    size_t MeasureEdit(const ShapeStore& shapes, const Edit& edit, bool undone) const;
+    void Archive(ShapeStore& shapes, Edit& edit, std::unordered_map<uint32_t, uint32_t>& references);
+    void Unarchive(ShapeStore& shapes, Edit& edit);
+    void ForgetUndone(ShapeStore& shapes, Edit& edit);
+    void Trim(ShapeStore& shapes);
+
+    std::deque<Edit> undoStack;
+    std::vector<Edit> redoStack;
+    size_t bytesUsed = 0;
+};
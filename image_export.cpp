@@ -0,0 +1,110 @@
+#include "image_export.hpp"
+#include "png_writer.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "external/qoi.h"
+
+struct ImageExport::Job
+{
+    Image image;
+    bool bottomUp;
+    ExportFormat format;
+    std::string path;
+
+    std::atomic<float> progress = 0.0f;
+    bool finished = false;
+    bool saved = false;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+static bool WriteQoi(Image& image, bool bottomUp, const char* path)
+{
+    if(bottomUp)
+        ImageFlipVertical(&image);
+
+    qoi_desc desc;
+    desc.width = (unsigned int)image.width;
+    desc.height = (unsigned int)image.height;
+    desc.channels = 4;
+    desc.colorspace = QOI_SRGB;
+
+    int size = 0;
+    void* encoded = qoi_encode(image.data, &desc, &size);
+    if(encoded == nullptr) return false;
+
+    bool saved = SaveFileData(path, encoded, size);
+    MemFree(encoded);
+    return saved;
+}
+
+ImageExport::~ImageExport()
+{
+    Wait();
+}
+
+bool ImageExport::Start(ThreadPool& pool, Image image, bool bottomUp, ExportFormat format, std::string path)
+{
+    if(Busy()) return false;
+
+    job = std::make_shared<Job>();
+    job->image = image;
+    job->bottomUp = bottomUp;
+    job->format = format;
+    job->path = std::move(path);
+
+    std::shared_ptr<Job> running = job;
+    ThreadPool* workers = &pool;
+    pool.Submit([running, workers]()
+    {
+        Job& job = *running;
+        bool saved = false;
+        if(job.format == ExportFormat::Png)
+        {
+            std::vector<unsigned char> encoded;
+            saved = EncodePng(job.image, job.bottomUp, *workers, job.progress, encoded) &&
+                SaveFileData(job.path.c_str(), encoded.data(), (int)encoded.size());
+        }
+        else
+        {
+            saved = WriteQoi(job.image, job.bottomUp, job.path.c_str());
+        }
+
+        UnloadImage(job.image);
+        if(saved)
+            TraceLog(LOG_INFO, "EXPORT: Saved %s", job.path.c_str());
+        else
+            TraceLog(LOG_WARNING, "EXPORT: Failed to save %s", job.path.c_str());
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.progress = 1.0f;
+        job.finished = true;
+        job.saved = saved;
+        job.done.notify_all();
+    });
+
+    return true;
+}
+
+bool ImageExport::Busy() const
+{
+    if(!job) return false;
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return !job->finished;
+}
+
+float ImageExport::Progress() const
+{
+    return job ? job->progress.load() : 0.0f;
+}
+
+bool ImageExport::Wait()
+{
+    if(!job) return false;
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->done.wait(lock, [this]() { return job->finished; });
+    return job->saved;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <raylib.h>
+#include <string>
+#include "thread_pool.hpp"
+
+enum class ExportFormat
+{
+    Png = 0,
+    Qoi,
+};
+
+// Encodes and writes one image at a time on a pool thread, the render loop
+// only hands the read back pixels over and polls the progress.
+class ImageExport
+{
+public:
+    ImageExport() = default;
+    ImageExport(const ImageExport&) = delete;
+    ImageExport& operator=(const ImageExport&) = delete;
+    ~ImageExport();
+
+    // Takes ownership of image. Fails without touching it while an export is
+    // still running.
+    bool Start(ThreadPool& pool, Image image, bool bottomUp, ExportFormat format, std::string path);
+
+    bool Busy() const;
+    float Progress() const;
+
+    // Blocks until the current export is done, true if it was saved.
+    bool Wait();
+
+private:
+    struct Job;
+    std::shared_ptr<Job> job;
+};
@@ -0,0 +1,176 @@
+#include "input.hpp"
+#include <cstdlib>
+
+// Recordings are written to disk in chunks of about this size.
+constexpr size_t RecordChunkSize = 64*1024;
+
+enum : uint8_t
+{
+    FrameMouseDown = 1 << 0,
+    FrameMouseReleased = 1 << 1,
+};
+
+void FrameInput::Poll()
+{
+    frameTime = GetFrameTime();
+    mouse = GetMousePosition();
+    mouseDown = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
+    mouseReleased = IsMouseButtonReleased(MOUSE_BUTTON_LEFT);
+    events.clear();
+
+    if(IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL))
+    {
+        for(int key: { KEY_Z, KEY_Y, KEY_S })
+        {
+            if(IsKeyPressed(key))
+                events.push_back({ InputEventKind::Key, (uint32_t)key });
+        }
+    }
+}
+
+InputRecorder::~InputRecorder()
+{
+    Close();
+}
+
+bool InputRecorder::Open(const char* path)
+{
+    Close();
+
+    file = std::fopen(path, "wb");
+    if(file == nullptr)
+    {
+        TraceLog(LOG_WARNING, "INPUT: Failed to open %s for recording", path);
+        return false;
+    }
+
+    out.bytes.clear();
+    out.U32(InputMagic);
+    out.U16(InputVersion);
+    out.U16(0);
+    return true;
+}
+
+void InputRecorder::Write(const FrameInput& input)
+{
+    if(file == nullptr) return;
+
+    uint8_t flags = 0;
+    if(input.mouseDown) flags |= FrameMouseDown;
+    if(input.mouseReleased) flags |= FrameMouseReleased;
+
+    out.U8(flags);
+    out.F32(input.frameTime);
+    out.F32(input.mouse.x);
+    out.F32(input.mouse.y);
+    out.Varint(input.events.size());
+    for(const InputEvent& event: input.events)
+    {
+        out.U8((uint8_t)event.kind);
+        out.Varint(event.value);
+    }
+
+    if(out.bytes.size() >= RecordChunkSize)
+        Flush();
+}
+
+void InputRecorder::Flush()
+{
+    if(!out.bytes.empty())
+        std::fwrite(out.bytes.data(), 1, out.bytes.size(), file);
+    out.bytes.clear();
+}
+
+void InputRecorder::Close()
+{
+    if(file == nullptr) return;
+
+    Flush();
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool InputReplay::Load(const char* path)
+{
+    int size = 0;
+    unsigned char* loaded = LoadFileData(path, &size);
+    if(loaded == nullptr) return false;
+
+    data.assign(loaded, loaded + size);
+    UnloadFileData(loaded);
+
+    ByteReader in(data.data(), data.size());
+    bool recording = in.U32() == InputMagic;
+    version = in.U16();
+    if(!recording || version > InputVersion)
+    {
+        TraceLog(LOG_WARNING, "INPUT: %s is not a MyPaint input recording", path);
+        return false;
+    }
+    in.U16();
+
+    cursor = data.size() - in.Remaining();
+    frameIndex = 0;
+    return true;
+}
+
+bool InputReplay::Next(FrameInput& input)
+{
+    ByteReader in(data.data() + cursor, data.size() - cursor);
+    if(in.Remaining() == 0) return false;
+
+    uint8_t flags = in.U8();
+    input.frameTime = in.F32();
+    input.mouse.x = in.F32();
+    input.mouse.y = in.F32();
+    input.mouseDown = (flags & FrameMouseDown) != 0;
+    input.mouseReleased = (flags & FrameMouseReleased) != 0;
+
+    input.events.clear();
+    uint64_t count = in.Varint();
+    for(uint64_t i = 0; i < count && !in.failed; i++)
+    {
+        InputEventKind kind = (InputEventKind)in.U8();
+        uint32_t value = (uint32_t)in.Varint();
+
+        // Version 1 predates the fill tool, Erase came right after Triangle.
+        if(version < 2 && kind == InputEventKind::Tool && value == (uint32_t)Shape::Fill)
+            value = (uint32_t)Shape::Erase;
+
+        input.events.push_back({ kind, value });
+    }
+
+    if(in.failed)
+    {
+        TraceLog(LOG_WARNING, "INPUT: Recording is truncated after frame %zu", frameIndex);
+        cursor = data.size();
+        return false;
+    }
+
+    cursor = data.size() - in.Remaining();
+    frameIndex++;
+    return true;
+}
+
+size_t CompareImages(const Image& image, const Image& golden, int tolerance)
+{
+    if(image.width != golden.width || image.height != golden.height)
+        return (size_t)image.width*image.height;
+
+    const unsigned char* a = (const unsigned char*)image.data;
+    const unsigned char* b = (const unsigned char*)golden.data;
+    size_t differing = 0;
+    for(size_t i = 0; i < (size_t)image.width*image.height; i++, a += 4, b += 4)
+    {
+        for(int channel = 0; channel < 4; channel++)
+        {
+            if(std::abs(a[channel] - b[channel]) > tolerance)
+            {
+                differing++;
+                break;
+            }
+        }
+    }
+
+    return differing;
+}
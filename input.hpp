@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <raylib.h>
+#include <string>
+#include <vector>
+#include "document.hpp"
+
+constexpr uint32_t InputMagic = 0x4950594D; // "MYPI"
+constexpr uint16_t InputVersion = 2;
+
+// Things that happen in a frame besides the mouse: toolbar changes and the
+// shortcuts that edit the document.
+enum class InputEventKind : uint8_t
+{
+    Tool = 0,       // value is a Shape
+    Color,          // value is RGBA packed by ColorToInt
+    Thickness,
+    Filled,
+    Key,            // KEY_Z, KEY_Y or KEY_S pressed with control held
+    Clear,
+    Smooth,
+    CameraX,        // value is the float's bits
+    CameraY,
+    CameraZoom,
+    Tolerance,      // of the bucket fill
+    LayerAdd,
+    LayerSelect,    // value is the layer id
+    LayerVisible,   // the layer id, then the new state from bit 8 up
+    LayerOpacity,   // opacity as 0-255
+    LayerBlend,     // a LayerBlend
+    LayerMove,      // 1 to move up, 0 down
+    Recolor,        // the selection, value is RGBA packed by ColorToInt
+};
+
+// Layer events carry the layer id in the low byte of the value.
+inline uint32_t LayerEventValue(uint8_t layer, uint32_t state) { return layer | state << 8; }
+
+struct InputEvent
+{
+    InputEventKind kind;
+    uint32_t value;
+};
+
+// Everything Paint reads from the user in one frame. Live input is polled
+// from raylib, replayed input comes from a recording.
+struct FrameInput
+{
+    float frameTime = 0;
+    Vector2 mouse = {};
+    bool mouseDown = false;
+    bool mouseReleased = false;
+    std::vector<InputEvent> events;
+
+    void Poll();
+};
+
+// Appends frames to a recording file as they happen.
+class InputRecorder
+{
+public:
+    InputRecorder() = default;
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder& operator=(const InputRecorder&) = delete;
+    ~InputRecorder();
+
+    bool Open(const char* path);
+    void Write(const FrameInput& input);
+    void Close();
+    bool IsOpen() const { return file != nullptr; }
+
+private:
+    void Flush();
+
+    std::FILE* file = nullptr;
+    ByteWriter out;
+};
+
+struct ReplayOptions
+{
+    // Sleep between frames so they are as far apart as when recorded.
+    bool realtime = false;
+
+    // CSV of frame number and frame time in milliseconds.
+    std::string timingsPath;
+
+    // Image the final canvas must match. Written instead when missing.
+    std::string goldenPath;
+};
+
+class InputReplay
+{
+public:
+    bool Load(const char* path);
+
+    // Fills input with the next recorded frame, false once all were played.
+    bool Next(FrameInput& input);
+
+    size_t FrameIndex() const { return frameIndex; }
+
+private:
+    std::vector<unsigned char> data;
+    size_t cursor = 0;
+    size_t frameIndex = 0;
+    uint16_t version = 0;
+};
+
+// Compares two RGBA8 images allowing tolerance per channel, for the small
+// differences between GPU drivers. Returns the number of pixels that differ.
+size_t CompareImages(const Image& image, const Image& golden, int tolerance);
@@ -0,0 +1,502 @@
+#include "journal.hpp"
+#include "mapped_file.hpp"
+#include "png_writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <raylib.h>
+#include <system_error>
+
+// Frames are a sequence of these, each followed by its fields.
+enum class JournalRecord : uint8_t
+{
+    Layers = 0,     // the whole layer stack
+    Truncate,       // new draw order size
+    Push,           // hidden flag and shape
+    Replace,        // position, hidden flag and shape
+    Visibility,     // position and hidden flag of the shape already there
+};
+
+static void EncodeEntry(ByteWriter& out, const ShapeStore& shapes, ShapeHandle handle)
+{
+    out.U8(handle.hidden);
+    EncodeShape(out, shapes, handle);
+}
+
+static ShapeHandle DecodeEntry(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans)
+{
+    bool hidden = in.U8() != 0;
+    ShapeHandle handle = DecodeShape(in, shapes, points, spans);
+    if(handle.hidden || shapes.FindLayer((uint8_t)handle.layer) == nullptr)
+        in.failed = true;
+
+    handle.hidden = hidden;
+    return handle;
+}
+
+// The area a shape covers, before it is released.
+static void AddChangedArea(std::vector<ChangedArea>* changed, const ShapeStore& shapes, ShapeHandle handle)
+{
+    if(changed != nullptr)
+        changed->push_back({ shapes.Bounds(handle), (uint8_t)handle.layer });
+}
+
+bool ApplyChangeRecords(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans,
+    std::vector<ChangedArea>* changed)
+{
+    while(in.Remaining() > 0 && !in.failed)
+    {
+        switch((JournalRecord)in.U8())
+        {
+            case JournalRecord::Layers:
+            {
+                std::vector<Layer> layers;
+                if(!DecodeLayers(in, layers)) return false;
+                shapes.SetLayers(std::move(layers));
+            } break;
+
+            case JournalRecord::Truncate:
+            {
+                uint64_t count = in.Varint();
+                if(count > shapes.Count()) return false;
+                while(shapes.Count() > count)
+                {
+                    ShapeHandle handle = shapes.PopBack();
+                    if(!handle.hidden)
+                        AddChangedArea(changed, shapes, handle);
+                    shapes.Release(handle);
+                }
+            } break;
+
+            case JournalRecord::Push:
+            {
+                ShapeHandle handle = DecodeEntry(in, shapes, points, spans);
+                if(in.failed) return false;
+                shapes.PushBack(handle);
+                if(!handle.hidden)
+                    AddChangedArea(changed, shapes, handle);
+            } break;
+
+            case JournalRecord::Replace:
+            {
+                uint64_t position = in.Varint();
+                if(position >= shapes.Count()) return false;
+
+                ShapeHandle handle = DecodeEntry(in, shapes, points, spans);
+                if(in.failed) return false;
+
+                ShapeHandle previous = shapes[position];
+                AddChangedArea(changed, shapes, previous);
+                AddChangedArea(changed, shapes, handle);
+                shapes.Replace(position, handle);
+                shapes.Release(previous);
+            } break;
+
+            case JournalRecord::Visibility:
+            {
+                uint64_t position = in.Varint();
+                bool hidden = in.U8() != 0;
+                if(in.failed || position >= shapes.Count()) return false;
+
+                ShapeHandle handle = shapes[position];
+                handle.hidden = hidden;
+                shapes.Replace(position, handle);
+                AddChangedArea(changed, shapes, handle);
+            } break;
+
+            default:
+                return false;
+        }
+    }
+
+    return !in.failed;
+}
+
+static bool SameLayers(const std::vector<Layer>& a, const std::vector<Layer>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const Layer& x, const Layer& y)
+    {
+        return x.id == y.id && x.name == y.name && x.visible == y.visible &&
+            x.opacity == y.opacity && x.blend == y.blend;
+    });
+}
+
+// Journal and snapshot files start with the magic, the version and the
+// generation of the snapshot the journal continues.
+static bool WriteHeader(std::FILE* file, uint64_t generation)
+{
+    ByteWriter out;
+    out.U32(JournalMagic);
+    out.U16(JournalVersion);
+    out.U16(0);
+    out.U64(generation);
+    return std::fwrite(out.bytes.data(), 1, out.bytes.size(), file) == out.bytes.size();
+}
+
+static bool ReadHeader(ByteReader& in, uint64_t& generation)
+{
+    // Shapes are encoded like in documents, which only ever gained fields.
+    if(in.U32() != JournalMagic || in.U16() > JournalVersion) return false;
+    in.U16();
+    generation = in.U64();
+    return !in.failed;
+}
+
+// Length and checksum, then the records.
+static bool WriteFrame(std::FILE* file, const std::vector<unsigned char>& payload)
+{
+    ByteWriter header;
+    header.U32((uint32_t)payload.size());
+    header.U32(Crc32(0, payload.data(), payload.size()));
+    return std::fwrite(header.bytes.data(), 1, header.bytes.size(), file) == header.bytes.size() &&
+        std::fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+}
+
+// False at the first frame that is cut short, doesn't match its checksum or
+// doesn't apply, which is where a crash in the middle of a write ends up.
+static bool ApplyFrames(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans)
+{
+    while(in.Remaining() > 0)
+    {
+        uint32_t length = in.U32();
+        uint32_t checksum = in.U32();
+        if(in.failed || length > in.Remaining() || Crc32(0, in.cursor, length) != checksum)
+            return false;
+
+        ByteReader frame(in.cursor, length);
+        in.cursor += length;
+        if(!ApplyChangeRecords(frame, shapes, points, spans)) return false;
+    }
+
+    return true;
+}
+
+// The whole store as a single frame, written next to the target and renamed
+// over it once it is on the disk.
+static bool WriteSnapshot(const std::string& path, uint64_t generation, const ShapeStore& shapes, size_t& bytes)
+{
+    ByteWriter out;
+    out.U8((uint8_t)JournalRecord::Layers);
+    EncodeLayers(out, shapes.Layers());
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        out.U8((uint8_t)JournalRecord::Push);
+        EncodeEntry(out, shapes, shapes[position]);
+    }
+
+    std::string temporaryPath = path + ".tmp";
+    std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+    if(file == nullptr) return false;
+
+    bool ok = WriteHeader(file, generation) && WriteFrame(file, out.bytes) && SyncFile(file);
+    ok = std::fclose(file) == 0 && ok;
+
+    std::error_code error;
+    if(ok)
+        std::filesystem::rename(temporaryPath, path, error);
+    if(!ok || error)
+    {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    bytes = out.bytes.size();
+    return true;
+}
+
+void ChangeEncoder::Snapshot(const ShapeStore& shapes, ByteWriter& out)
+{
+    encodedLayers = shapes.Layers();
+    out.U8((uint8_t)JournalRecord::Layers);
+    EncodeLayers(out, encodedLayers);
+    out.U8((uint8_t)JournalRecord::Truncate);
+    out.Varint(0);
+
+    encoded.clear();
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        out.U8((uint8_t)JournalRecord::Push);
+        EncodeEntry(out, shapes, shapes[position]);
+        encoded.push_back(shapes[position]);
+    }
+}
+
+void ChangeEncoder::Encode(const ShapeStore& shapes, const ShapeChanges& changes, ByteWriter& out)
+{
+    if(!SameLayers(shapes.Layers(), encodedLayers))
+    {
+        out.U8((uint8_t)JournalRecord::Layers);
+        EncodeLayers(out, shapes.Layers());
+        encodedLayers = shapes.Layers();
+    }
+
+    if(changes.stableCount < encoded.size())
+    {
+        out.U8((uint8_t)JournalRecord::Truncate);
+        out.Varint(changes.stableCount);
+        encoded.resize(changes.stableCount);
+    }
+
+    // Erasing and clearing mostly flip the hidden bit, which doesn't need the
+    // shape written again.
+    for(uint32_t position: changes.replaced)
+    {
+        if(position >= encoded.size()) break;
+
+        ShapeHandle handle = shapes[position];
+        ShapeHandle previous = encoded[position];
+        if(handle.SameShape(previous) && handle.layer == previous.layer)
+        {
+            if(handle.hidden == previous.hidden) continue;
+
+            out.U8((uint8_t)JournalRecord::Visibility);
+            out.Varint(position);
+            out.U8(handle.hidden);
+        }
+        else
+        {
+            out.U8((uint8_t)JournalRecord::Replace);
+            out.Varint(position);
+            EncodeEntry(out, shapes, handle);
+        }
+        encoded[position] = handle;
+    }
+
+    for(size_t position = encoded.size(); position < shapes.Count(); position++)
+    {
+        out.U8((uint8_t)JournalRecord::Push);
+        EncodeEntry(out, shapes, shapes[position]);
+        encoded.push_back(shapes[position]);
+    }
+}
+
+void ChangeEncoder::Clear()
+{
+    encoded.clear();
+    encodedLayers.clear();
+}
+
+Journal::~Journal()
+{
+    Stop();
+}
+
+void Journal::Start(const ShapeStore& shapes, const std::string& documentPath)
+{
+    Stop();
+
+    journalPath = documentPath + JournalExtension;
+    snapshotPath = documentPath + SnapshotExtension;
+
+    // The state journaling starts from, the writer keeps it in memory and
+    // only writes a snapshot of it once something changes.
+    ByteWriter out;
+    encoder.Snapshot(shapes, out);
+
+    pending.clear();
+    pending.push_back(std::move(out.bytes));
+    stopping = false;
+
+    // Only has to differ from the generation of a journal left by an earlier
+    // session.
+    uint64_t generation = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    writer = std::thread(&Journal::WriterLoop, this, generation);
+}
+
+void Journal::Stop()
+{
+    if(!writer.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    encoder.Clear();
+}
+
+void Journal::Record(const ShapeStore& shapes, const ShapeChanges& changes)
+{
+    if(!IsOpen()) return;
+
+    ByteWriter out;
+    encoder.Encode(shapes, changes, out);
+
+    if(out.bytes.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(out.bytes));
+    }
+    wake.notify_one();
+}
+
+void Journal::WriterLoop(uint64_t generation)
+{
+    ShapeStore replica;
+    std::vector<Vector2> points;
+    std::vector<FillSpan> spans;
+    std::vector<std::vector<unsigned char>> frames;
+
+    std::FILE* file = nullptr;
+    size_t journalBytes = 0;
+    size_t snapshotBytes = 0;
+    bool unsynced = false;
+    bool initial = true;
+    auto lastSync = std::chrono::steady_clock::now();
+
+    // A new snapshot of the replica, then an empty journal continuing it. Until
+    // both made it the old journal is kept going.
+    auto compact = [&]()
+    {
+        if(!WriteSnapshot(snapshotPath, generation + 1, replica, snapshotBytes))
+        {
+            TraceLog(LOG_WARNING, "JOURNAL: Failed to write %s", snapshotPath.c_str());
+            return;
+        }
+
+        generation++;
+        if(file != nullptr)
+            std::fclose(file);
+
+        file = std::fopen(journalPath.c_str(), "wb");
+        if(file != nullptr && !(WriteHeader(file, generation) && SyncFile(file)))
+        {
+            std::fclose(file);
+            file = nullptr;
+        }
+        if(file == nullptr)
+            TraceLog(LOG_WARNING, "JOURNAL: Failed to start %s", journalPath.c_str());
+
+        journalBytes = 0;
+        unsynced = false;
+    };
+
+    for(bool running = true; running;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, std::chrono::duration<double>(JournalSyncSeconds), [&]()
+            {
+                return stopping || !pending.empty();
+            });
+            std::swap(frames, pending);
+            running = !stopping;
+        }
+
+        for(const std::vector<unsigned char>& frame: frames)
+        {
+            ByteReader in(frame.data(), frame.size());
+            if(!ApplyChangeRecords(in, replica, points, spans))
+                TraceLog(LOG_WARNING, "JOURNAL: Dropped a frame that doesn't apply");
+
+            if(initial)
+            {
+                initial = false;
+                continue;
+            }
+
+            // Frames that couldn't be written are in the replica, the next
+            // snapshot picks them up.
+            if(file == nullptr)
+            {
+                compact();
+                continue;
+            }
+
+            if(!WriteFrame(file, frame))
+            {
+                TraceLog(LOG_WARNING, "JOURNAL: Failed to write %s", journalPath.c_str());
+                std::fclose(file);
+                file = nullptr;
+                continue;
+            }
+
+            journalBytes += frame.size() + 8;
+            unsynced = true;
+        }
+        frames.clear();
+
+        if(file == nullptr) continue;
+
+        std::fflush(file);
+        if(journalBytes > std::max(JournalCompactBytes, snapshotBytes))
+            compact();
+
+        auto now = std::chrono::steady_clock::now();
+        if(unsynced && file != nullptr && (!running || now - lastSync >= std::chrono::duration<double>(JournalSyncSeconds)))
+        {
+            SyncFile(file);
+            lastSync = now;
+            unsynced = false;
+        }
+    }
+
+    if(file != nullptr)
+        std::fclose(file);
+}
+
+bool Journal::CanRecover(const char* documentPath)
+{
+    std::error_code error;
+    auto journaled = std::filesystem::last_write_time(std::string(documentPath) + SnapshotExtension, error);
+    if(error) return false;
+
+    auto appended = std::filesystem::last_write_time(std::string(documentPath) + JournalExtension, error);
+    if(!error)
+        journaled = std::max(journaled, appended);
+
+    auto saved = std::filesystem::last_write_time(documentPath, error);
+    return error || journaled > saved;
+}
+
+bool Journal::Recover(ShapeStore& shapes, const char* documentPath)
+{
+    shapes.Clear();
+
+    std::string snapshotPath = std::string(documentPath) + SnapshotExtension;
+    MappedFile snapshot;
+    if(!snapshot.Open(snapshotPath.c_str())) return false;
+
+    ShapeStore journaled;
+    std::vector<Vector2> points;
+    std::vector<FillSpan> spans;
+    uint64_t generation = 0;
+    ByteReader in(snapshot.Data(), snapshot.Size());
+    if(!ReadHeader(in, generation) || !ApplyFrames(in, journaled, points, spans))
+    {
+        TraceLog(LOG_WARNING, "JOURNAL: %s is corrupt", snapshotPath.c_str());
+        return false;
+    }
+
+    // A journal of another generation was compacted into this snapshot
+    // already, or belongs to a snapshot that never made it to the disk.
+    std::string journalPath = std::string(documentPath) + JournalExtension;
+    MappedFile journal;
+    uint64_t journalGeneration = 0;
+    if(journal.Open(journalPath.c_str()))
+    {
+        ByteReader tail(journal.Data(), journal.Size());
+        if(ReadHeader(tail, journalGeneration) && journalGeneration == generation && !ApplyFrames(tail, journaled, points, spans))
+            TraceLog(LOG_WARNING, "JOURNAL: %s ends with a torn frame, recovered what came before it", journalPath.c_str());
+    }
+
+    // Hidden entries only mattered to the undo history of the lost session.
+    std::vector<unsigned char> bytes;
+    for(size_t position = 0; position < journaled.Count(); position++)
+    {
+        if(!journaled.IsVisible(position)) continue;
+
+        bytes.clear();
+        journaled.Serialize(journaled[position], bytes);
+        const unsigned char* cursor = bytes.data();
+        shapes.PushBack(shapes.Deserialize(cursor));
+    }
+    shapes.SetLayers(journaled.Layers());
+
+    TraceLog(LOG_INFO, "JOURNAL: Recovered %s (%zu shapes)", documentPath, shapes.Count());
+    return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <raylib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "document.hpp"
+#include "shape_store.hpp"
+
+constexpr uint32_t JournalMagic = 0x4A50594D; // "MYPJ"
+constexpr uint16_t JournalVersion = 2;
+constexpr const char* JournalExtension = ".journal";
+constexpr const char* SnapshotExtension = ".snapshot";
+
+// Writes reach the OS every time the journal thread wakes up, the disk at
+// most this long after.
+constexpr double JournalSyncSeconds = 1.0;
+
+// Past this size, and once it is bigger than the snapshot, the journal is
+// folded into a new snapshot.
+constexpr size_t JournalCompactBytes = 8*1024*1024;
+
+// Where applied records changed the canvas, for redrawing it.
+struct ChangedArea
+{
+    Rectangle area;
+    uint8_t layer;
+};
+
+// Turns draw order changes into journal records: the layer stack when it
+// changed, truncations, visibility flips and pushed or replaced shapes. It
+// keeps the handles and layers it already encoded to diff against, so every
+// follower of the store (the journal, each mirror viewer) has its own.
+class ChangeEncoder
+{
+public:
+    // Records that rebuild the whole store from whatever the reader has.
+    void Snapshot(const ShapeStore& shapes, ByteWriter& out);
+
+    // Records for the changes since the last Snapshot or Encode.
+    void Encode(const ShapeStore& shapes, const ShapeChanges& changes, ByteWriter& out);
+
+    void Clear();
+
+private:
+    std::vector<ShapeHandle> encoded;
+    std::vector<Layer> encodedLayers;
+};
+
+// Applies what ChangeEncoder wrote. With changed given, the areas of shapes
+// that were added, removed or swapped are appended to it.
+// Points and spans are scratch space for decoding shapes.
+bool ApplyChangeRecords(ByteReader& in, ShapeStore& shapes, std::vector<Vector2>& points, std::vector<FillSpan>& spans,
+    std::vector<ChangedArea>* changed = nullptr);
+
+// Crash-safe autosave. Every frame Record encodes what changed in the draw
+// order and the layers and hands it to a background thread, which appends
+// it to <document>.journal as one checksummed frame and applies it to a
+// copy of the document of its own. From that copy it writes
+// <document>.snapshot and starts the journal over when the journal grows
+// too big, so neither compaction nor any file I/O ever runs on the main
+// thread. Entries are addressed by draw order position, hidden ones
+// included, so the journal mirrors the live store exactly.
+class Journal
+{
+public:
+    Journal() = default;
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Writes what is still queued and syncs it.
+    ~Journal();
+
+    // Journals shapes as the document at documentPath, from a snapshot of
+    // their current state. Stops journaling any other document first. The
+    // changes taken before that are already part of the snapshot.
+    void Start(const ShapeStore& shapes, const std::string& documentPath);
+    void Stop();
+    bool IsOpen() const { return writer.joinable(); }
+
+    void Record(const ShapeStore& shapes, const ShapeChanges& changes);
+
+    // Whether a journal newer than the document (or without one) exists.
+    static bool CanRecover(const char* documentPath);
+
+    // The journaled state of a document, visible shapes only. Stops at the
+    // first torn or corrupt frame. On failure the store is left empty.
+    static bool Recover(ShapeStore& shapes, const char* documentPath);
+
+private:
+    void WriterLoop(uint64_t generation);
+
+    // Main thread side: what the journal already has.
+    ChangeEncoder encoder;
+
+    // Handed to the writer thread, one frame per entry.
+    std::vector<std::vector<unsigned char>> pending;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::string journalPath;
+    std::string snapshotPath;
+    std::thread writer;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Shape handles have four bits for the layer.
+constexpr int MaxLayers = 16;
+
+// How a layer is combined with what is under it, the usual Photoshop names.
+enum class LayerBlend : uint8_t
+{
+    Normal = 0,
+    Multiply,
+    Add,
+    Screen,
+    Count,
+};
+
+inline const char* LayerBlendName(LayerBlend mode)
+{
+    switch(mode)
+    {
+        case LayerBlend::Normal: return "Normal";
+        case LayerBlend::Multiply: return "Multiply";
+        case LayerBlend::Add: return "Add";
+        case LayerBlend::Screen: return "Screen";
+        default: return "";
+    }
+}
+
+// Shapes refer to their layer by id. Where the layer sits in the stack is
+// separate, moving a layer doesn't touch its shapes.
+struct Layer
+{
+    uint8_t id = 0;
+    std::string name;
+    bool visible = true;
+    float opacity = 1.0f;
+    LayerBlend blend = LayerBlend::Normal;
+};
@@ -1,7 +1,176 @@
 #include "paint.hpp"
+#include "image_export.hpp"
+#include "raster.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 
-int main()
+static int Usage()
 {
+    std::fprintf(stderr,
+        "usage: mypaint [document]\n"
+        "       mypaint --render <document> <image.png|image.qoi> [--width N] [--height N]\n"
+        "       mypaint --record <input> [document]\n"
+        "       mypaint --replay <input> [document] [--realtime] [--timings file.csv] [--golden image.png]\n"
+        "       mypaint --publish <unix:path|[host:]port> [document]\n"
+        "       mypaint --view <unix:path|[host:]port>\n");
+    return 1;
+}
+
+// Area covered by the shapes that get drawn, the window when there are none.
+static Rectangle DrawnArea(const ShapeStore& shapes)
+{
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+    for(size_t i = 0; i < shapes.Count(); i++)
+    {
+        const Layer* layer = shapes.FindLayer(shapes[i].layer);
+        if(!shapes.IsVisible(i) || layer == nullptr || !layer->visible) continue;
+
+        Rectangle bounds = shapes.Bounds(shapes[i]);
+        x0 = std::min(x0, bounds.x);
+        y0 = std::min(y0, bounds.y);
+        x1 = std::max(x1, bounds.x + bounds.width);
+        y1 = std::max(y1, bounds.y + bounds.height);
+    }
+
+    if(x1 <= x0 || y1 <= y0)
+        return { 0, 0, (float)WindowWidth, (float)WindowHeight };
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+// Renders a document to an image file on the CPU, no window is opened.
+static int RenderHeadless(int argc, char** argv)
+{
+    if(argc < 4) return Usage();
+
+    const char* documentPath = argv[2];
+    const char* imagePath = argv[3];
+    int width = 0, height = 0;
+    for(int i = 4; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            width = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+            height = std::atoi(argv[++i]);
+        else
+            return Usage();
+    }
+
+    ExportFormat format;
+    if(IsFileExtension(imagePath, ".png"))
+        format = ExportFormat::Png;
+    else if(IsFileExtension(imagePath, ".qoi"))
+        format = ExportFormat::Qoi;
+    else
+        return Usage();
+
+    ShapeStore shapes;
+    if(!LoadDocument(shapes, documentPath)) return 1;
+
+    // Everything drawn is rendered, wherever it is. Without a size it comes
+    // out at one pixel per unit, with one the other follows its aspect ratio.
+    Rectangle view = DrawnArea(shapes);
+    if(width <= 0 && height <= 0)
+    {
+        width = (int)std::ceil(view.width);
+        height = (int)std::ceil(view.height);
+    }
+    else if(height <= 0)
+    {
+        height = (int)(width*view.height/view.width + 0.5f);
+    }
+    else if(width <= 0)
+    {
+        width = (int)(height*view.width/view.height + 0.5f);
+    }
+
+    ThreadPool workers;
+    Image image = RasterizeShapes(shapes, view, width, height, BackgroundColor, workers);
+    if(image.data == nullptr)
+    {
+        TraceLog(LOG_WARNING, "RENDER: Failed to allocate a %dx%d image", width, height);
+        return 1;
+    }
+
+    ImageExport imageExport;
+    imageExport.Start(workers, image, false, format, imagePath);
+    return imageExport.Wait() ? 0 : 1;
+}
+
+// Records everything drawn into a file, or plays such a file back. The document
+// must be the same for both or the replay won't end on the same canvas.
+static int RunInput(int argc, char** argv)
+{
+    bool record = std::strcmp(argv[1], "--record") == 0;
+    if(argc < 3) return Usage();
+
+    const char* inputPath = argv[2];
+    const char* documentPath = nullptr;
+    ReplayOptions options;
+    for(int i = 3; i < argc; i++)
+    {
+        if(!record && std::strcmp(argv[i], "--realtime") == 0)
+            options.realtime = true;
+        else if(!record && std::strcmp(argv[i], "--timings") == 0 && i + 1 < argc)
+            options.timingsPath = argv[++i];
+        else if(!record && std::strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            options.goldenPath = argv[++i];
+        else if(argv[i][0] != '-' && documentPath == nullptr)
+            documentPath = argv[i];
+        else
+            return Usage();
+    }
+
+    Paint paint;
+    if(documentPath != nullptr && !paint.Open(documentPath, false))
+        return 1;
+
+    bool started = record ? paint.StartRecording(inputPath) : paint.StartReplay(inputPath, std::move(options));
+    if(!started) return 1;
+    return paint.Run();
+}
+
+// Draws as usual while read-only viewers watch, or is one of those viewers.
+static int RunMirror(int argc, char** argv)
+{
+    bool publish = std::strcmp(argv[1], "--publish") == 0;
+    if(argc < 3 || argc > (publish ? 4 : 3)) return Usage();
+
+    Paint paint;
+    if(!publish)
+    {
+        paint.StartViewing(argv[2]);
+        return paint.Run();
+    }
+
+    if(argc > 3)
+        paint.Open(argv[3]);
+    else if(Journal::CanRecover(DefaultDocumentPath))
+        paint.Open(DefaultDocumentPath);
+    if(!paint.StartPublishing(argv[2])) return 1;
+    return paint.Run();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1 && std::strcmp(argv[1], "--render") == 0)
+        return RenderHeadless(argc, argv);
+    if(argc > 1 && (std::strcmp(argv[1], "--record") == 0 || std::strcmp(argv[1], "--replay") == 0))
+        return RunInput(argc, argv);
+    if(argc > 1 && (std::strcmp(argv[1], "--publish") == 0 || std::strcmp(argv[1], "--view") == 0))
+        return RunMirror(argc, argv);
+    if(argc > 1 && argv[1][0] == '-')
+        return Usage();
+
+    // Without a document, an untitled drawing that was never saved comes back.
     Paint paint;
-    paint.Run();
+    if(argc > 1)
+        paint.Open(argv[1]);
+    else if(Journal::CanRecover(DefaultDocumentPath))
+        paint.Open(DefaultDocumentPath);
+    return paint.Run();
 }
@@ -0,0 +1,108 @@
+#include "mapped_file.hpp"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(data == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    size = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data != nullptr) UnmapViewOfFile(data);
+    if(mapping != nullptr) CloseHandle(mapping);
+    if(file != nullptr) CloseHandle(file);
+
+    data = nullptr;
+    mapping = nullptr;
+    file = nullptr;
+    size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    file = open(path, O_RDONLY);
+    if(file < 0) return false;
+
+    struct stat info;
+    if(fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(mapped == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+
+    madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+    data = (const unsigned char*)mapped;
+    size = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data != nullptr) munmap((void*)data, size);
+    if(file >= 0) close(file);
+
+    data = nullptr;
+    size = 0;
+    file = -1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. Lives in its own translation unit
+// because <windows.h> can't be included next to raylib.h.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool Open(const char* path);
+    void Close();
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
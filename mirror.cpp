@@ -0,0 +1,346 @@
+#include "mirror.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+enum class MirrorFrame : uint8_t
+{
+    Changes = 0,    // journal records
+    Live,           // the stroke in progress
+};
+
+constexpr size_t MirrorHeaderBytes = 8;
+
+// Largest frame a viewer accepts, anything bigger is a broken stream.
+constexpr uint32_t MaxMirrorFrame = 1u << 30;
+
+// Stroke points on the fixed point grid documents store them on.
+static int64_t FixedPoint(float value)
+{
+    return (int64_t)std::llround(value*PointScale);
+}
+
+static void AppendFrame(std::vector<unsigned char>& out, MirrorFrame kind, const ByteWriter& payload)
+{
+    ByteWriter header;
+    header.U32((uint32_t)payload.bytes.size() + 1);
+    header.U8((uint8_t)kind);
+    out.insert(out.end(), header.bytes.begin(), header.bytes.end());
+    out.insert(out.end(), payload.bytes.begin(), payload.bytes.end());
+}
+
+bool MirrorPublisher::Start(const char* address)
+{
+    Stop();
+
+    listener = MirrorSocket::Listen(address);
+    if(!listener.IsOpen())
+    {
+        TraceLog(LOG_WARNING, "MIRROR: Failed to listen on %s", address);
+        return false;
+    }
+
+    TraceLog(LOG_INFO, "MIRROR: Publishing on %s", address);
+    return true;
+}
+
+void MirrorPublisher::Stop()
+{
+    viewers.clear();
+    listener.Close();
+}
+
+void MirrorPublisher::Resync()
+{
+    for(Viewer& viewer: viewers)
+    {
+        viewer.snapshotPending = true;
+        viewer.behind = false;
+    }
+}
+
+void MirrorPublisher::Publish(const ShapeStore& shapes, const ShapeChanges& changes, const LiveStroke& live)
+{
+    if(!IsOpen()) return;
+
+    while(viewers.size() < MaxMirrorViewers)
+    {
+        MirrorSocket socket = listener.Accept();
+        if(!socket.IsOpen()) break;
+
+        Viewer& viewer = viewers.emplace_back();
+        viewer.socket = std::move(socket);
+
+        ByteWriter header;
+        header.U32(MirrorMagic);
+        header.U16(MirrorVersion);
+        header.U16(0);
+        viewer.outgoing = std::move(header.bytes);
+        TraceLog(LOG_INFO, "MIRROR: Viewer connected, %zu watching", viewers.size());
+    }
+
+    for(size_t i = 0; i < viewers.size();)
+    {
+        Viewer& viewer = viewers[i];
+        size_t backlog = viewer.outgoing.size() - viewer.sent;
+
+        if(backlog > MirrorBacklogBytes)
+        {
+            // A snapshot taken later covers these changes anyway.
+            if(viewer.snapshotPending) {}
+            else if(viewer.behind)
+                viewer.skipped.Merge(changes);
+            else
+                viewer.skipped = changes;
+            viewer.behind = !viewer.snapshotPending;
+        }
+        else
+        {
+            frame.bytes.clear();
+            if(viewer.snapshotPending)
+                viewer.encoder.Snapshot(shapes, frame);
+            else if(viewer.behind)
+            {
+                viewer.skipped.Merge(changes);
+                viewer.encoder.Encode(shapes, viewer.skipped, frame);
+            }
+            else
+                viewer.encoder.Encode(shapes, changes, frame);
+
+            viewer.snapshotPending = false;
+            viewer.behind = false;
+            if(!frame.bytes.empty())
+                AppendFrame(viewer.outgoing, MirrorFrame::Changes, frame);
+
+            EncodeLive(viewer, live);
+        }
+
+        if(Flush(viewer))
+        {
+            i++;
+            continue;
+        }
+
+        viewers.erase(viewers.begin() + i);
+        TraceLog(LOG_INFO, "MIRROR: Viewer disconnected, %zu watching", viewers.size());
+    }
+}
+
+// Only the points past what the viewer already has, from the first one that
+// differs. The simplifier only ever changes the newest point, so that is
+// usually one or two.
+void MirrorPublisher::EncodeLive(Viewer& viewer, const LiveStroke& live)
+{
+    bool sameStroke = live.count > 0 && !viewer.live.empty() &&
+        ColorToInt(live.color) == ColorToInt(viewer.liveColor) && live.thickness == viewer.liveThickness &&
+        live.layer == viewer.liveLayer && live.smooth == viewer.liveSmooth;
+
+    size_t keep = 0;
+    if(sameStroke)
+    {
+        size_t shared = std::min(live.count, viewer.live.size());
+        while(keep < shared && live.points[keep].x == viewer.live[keep].x && live.points[keep].y == viewer.live[keep].y)
+            keep++;
+        if(keep == live.count && keep == viewer.live.size()) return;
+    }
+    else if(live.count == 0 && viewer.live.empty())
+    {
+        return;
+    }
+
+    frame.bytes.clear();
+    frame.U8(live.count > 0);
+    if(live.count > 0)
+    {
+        frame.U8(live.layer);
+        frame.U32((uint32_t)ColorToInt(live.color));
+        frame.Varint((uint64_t)std::max(live.thickness, 0));
+        frame.U8(live.smooth);
+        frame.Varint(keep);
+        frame.Varint(live.count - keep);
+
+        int64_t x = keep > 0 ? FixedPoint(live.points[keep - 1].x) : 0;
+        int64_t y = keep > 0 ? FixedPoint(live.points[keep - 1].y) : 0;
+        for(size_t i = keep; i < live.count; i++)
+        {
+            int64_t nextX = FixedPoint(live.points[i].x), nextY = FixedPoint(live.points[i].y);
+            frame.Zigzag(nextX - x);
+            frame.Zigzag(nextY - y);
+            x = nextX;
+            y = nextY;
+        }
+    }
+    AppendFrame(viewer.outgoing, MirrorFrame::Live, frame);
+
+    viewer.live.assign(live.points, live.points + live.count);
+    viewer.liveColor = live.color;
+    viewer.liveThickness = live.thickness;
+    viewer.liveLayer = live.layer;
+    viewer.liveSmooth = live.smooth;
+}
+
+// False once the viewer is gone.
+bool MirrorPublisher::Flush(Viewer& viewer)
+{
+    while(viewer.sent < viewer.outgoing.size())
+    {
+        long sent = viewer.socket.Send(viewer.outgoing.data() + viewer.sent, viewer.outgoing.size() - viewer.sent);
+        if(sent < 0) return false;
+        if(sent == 0) break;
+
+        viewer.sent += (size_t)sent;
+        bytesSent += (uint64_t)sent;
+    }
+
+    // Sent bytes are dropped once they are most of the buffer.
+    if(viewer.sent == viewer.outgoing.size())
+    {
+        viewer.outgoing.clear();
+        viewer.sent = 0;
+    }
+    else if(viewer.sent > viewer.outgoing.size()/2)
+    {
+        viewer.outgoing.erase(viewer.outgoing.begin(), viewer.outgoing.begin() + viewer.sent);
+        viewer.sent = 0;
+    }
+
+    return true;
+}
+
+void MirrorViewer::Connect(const char* address)
+{
+    this->address = address;
+    Disconnect();
+
+    lastAttempt = GetTime();
+    socket = MirrorSocket::Connect(address);
+    if(socket.IsOpen() && !socket.Connecting())
+        TraceLog(LOG_INFO, "MIRROR: Connected to %s", address);
+}
+
+void MirrorViewer::Disconnect()
+{
+    socket.Close();
+    handshaken = false;
+    incoming.clear();
+    live.clear();
+}
+
+void MirrorViewer::Update(ShapeStore& shapes, std::vector<ChangedArea>& changed)
+{
+    if(!socket.IsOpen())
+    {
+        if(!address.empty() && GetTime() - lastAttempt >= MirrorRetrySeconds)
+            Connect(address.c_str());
+        if(!socket.IsOpen()) return;
+    }
+
+    if(socket.Connecting())
+    {
+        if(!socket.FinishConnect() || socket.Connecting()) return;
+        TraceLog(LOG_INFO, "MIRROR: Connected to %s", address.c_str());
+    }
+
+    size_t received = 0;
+    while(received < MirrorReceiveBytes)
+    {
+        size_t size = incoming.size();
+        incoming.resize(size + 64*1024);
+        long count = socket.Receive(incoming.data() + size, incoming.size() - size);
+        incoming.resize(size + (size_t)std::max(count, 0L));
+
+        if(count < 0)
+        {
+            TraceLog(LOG_INFO, "MIRROR: Disconnected from %s", address.c_str());
+            Disconnect();
+            return;
+        }
+        if(count == 0) break;
+
+        received += (size_t)count;
+        bytesReceived += (uint64_t)count;
+    }
+
+    ByteReader in(incoming.data(), incoming.size());
+    if(!handshaken)
+    {
+        if(in.Remaining() < MirrorHeaderBytes) return;
+
+        if(in.U32() != MirrorMagic || in.U16() != MirrorVersion)
+        {
+            TraceLog(LOG_WARNING, "MIRROR: %s isn't a compatible publisher", address.c_str());
+            Disconnect();
+            address.clear();
+            return;
+        }
+        in.U16();
+        handshaken = true;
+    }
+
+    while(in.Remaining() >= 4)
+    {
+        const unsigned char* start = in.cursor;
+        uint32_t length = in.U32();
+        if(length == 0 || length > MaxMirrorFrame)
+        {
+            Disconnect();
+            return;
+        }
+        if(in.Remaining() < length)
+        {
+            in.cursor = start;
+            break;
+        }
+
+        ByteReader payload(in.cursor, length);
+        in.cursor += length;
+        if(!ApplyFrame(payload, shapes, changed))
+        {
+            TraceLog(LOG_WARNING, "MIRROR: Dropped a frame that doesn't apply, starting over");
+            Disconnect();
+            return;
+        }
+    }
+
+    incoming.erase(incoming.begin(), incoming.begin() + (in.cursor - incoming.data()));
+}
+
+bool MirrorViewer::ApplyFrame(ByteReader& in, ShapeStore& shapes, std::vector<ChangedArea>& changed)
+{
+    switch((MirrorFrame)in.U8())
+    {
+        case MirrorFrame::Changes:
+            return ApplyChangeRecords(in, shapes, points, spans, &changed);
+
+        case MirrorFrame::Live:
+        {
+            if(in.U8() == 0)
+            {
+                live.clear();
+                return !in.failed;
+            }
+
+            liveLayer = in.U8();
+            liveColor = GetColor(in.U32());
+            liveThickness = (int)in.Varint();
+            liveSmooth = in.U8() != 0;
+            uint64_t keep = in.Varint();
+            uint64_t count = in.Varint();
+            if(in.failed || keep > live.size() || count > in.Remaining()) return false;
+
+            live.resize(keep);
+            int64_t x = keep > 0 ? FixedPoint(live.back().x) : 0;
+            int64_t y = keep > 0 ? FixedPoint(live.back().y) : 0;
+            for(uint64_t i = 0; i < count; i++)
+            {
+                x += in.Zigzag();
+                y += in.Zigzag();
+                live.push_back({ x/PointScale, y/PointScale });
+            }
+            return !in.failed;
+        }
+
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <string>
+#include <vector>
+#include "document.hpp"
+#include "journal.hpp"
+#include "mirror_socket.hpp"
+#include "shape_store.hpp"
+
+constexpr uint32_t MirrorMagic = 0x4D50594D; // "MYPM"
+constexpr uint16_t MirrorVersion = 1;
+
+constexpr size_t MaxMirrorViewers = 8;
+
+// A viewer with more than this still to be sent is behind. Its changes are
+// folded together until the socket drained, then go out as one delta.
+constexpr size_t MirrorBacklogBytes = 1024*1024;
+
+// Most a viewer reads per frame, so a big snapshot arrives over a few frames
+// instead of stalling one.
+constexpr size_t MirrorReceiveBytes = 4*1024*1024;
+
+// Past this many changed areas in a frame (a snapshot) the viewer redraws
+// every tile rather than looking each area up.
+constexpr size_t MirrorChangedAreas = 256;
+
+constexpr double MirrorRetrySeconds = 1.0;
+
+// The freehand stroke being drawn, points as the simplifier has them.
+struct LiveStroke
+{
+    const Vector2* points = nullptr;
+    size_t count = 0;
+    Color color = BLANK;
+    int thickness = 0;
+    uint8_t layer = 0;
+    bool smooth = false;
+};
+
+// Streams the canvas to read-only viewers over a MirrorSocket. The stream is
+// a header (magic, version) followed by frames of a length, a kind and a
+// payload. Change frames carry journal records from a ChangeEncoder per
+// viewer, which starts with a snapshot. Live frames carry the points of the
+// stroke in progress the viewer doesn't have yet, delta encoded in fixed
+// point like document strokes. Everything one frame of the loop changed goes
+// out as at most one frame of each kind, written without blocking.
+class MirrorPublisher
+{
+public:
+    bool Start(const char* address);
+    void Stop();
+    bool IsOpen() const { return listener.IsOpen(); }
+
+    size_t Viewers() const { return viewers.size(); }
+    uint64_t BytesSent() const { return bytesSent; }
+
+    // Every viewer starts over from a snapshot, for a document that replaced
+    // the one they had.
+    void Resync();
+
+    // Once a frame with the changes taken from shapes: accepts new viewers,
+    // encodes for the ones keeping up and sends what the sockets take.
+    void Publish(const ShapeStore& shapes, const ShapeChanges& changes, const LiveStroke& live);
+
+private:
+    struct Viewer
+    {
+        MirrorSocket socket;
+        ChangeEncoder encoder;
+        bool snapshotPending = true;
+
+        // Changes folded together while the viewer is behind.
+        ShapeChanges skipped;
+        bool behind = false;
+
+        std::vector<unsigned char> outgoing;
+        size_t sent = 0;
+
+        // The live stroke as the viewer has it.
+        std::vector<Vector2> live;
+        Color liveColor = BLANK;
+        int liveThickness = 0;
+        uint8_t liveLayer = 0;
+        bool liveSmooth = false;
+    };
+
+    void EncodeLive(Viewer& viewer, const LiveStroke& live);
+    bool Flush(Viewer& viewer);
+
+    MirrorSocket listener;
+    std::vector<Viewer> viewers;
+    ByteWriter frame;
+    uint64_t bytesSent = 0;
+};
+
+// The other end: connects to a publisher, reconnecting every
+// MirrorRetrySeconds while it can't, and applies what it receives to a store.
+class MirrorViewer
+{
+public:
+    void Connect(const char* address);
+    bool Connected() const { return socket.IsOpen() && handshaken; }
+    const std::string& Address() const { return address; }
+    uint64_t BytesReceived() const { return bytesReceived; }
+
+    // Applies the frames that arrived since the last call. The areas of the
+    // shapes that changed are appended to changed.
+    void Update(ShapeStore& shapes, std::vector<ChangedArea>& changed);
+
+    // The publisher's stroke in progress, no points when there is none.
+    const std::vector<Vector2>& LivePoints() const { return live; }
+    Color LiveColor() const { return liveColor; }
+    int LiveThickness() const { return liveThickness; }
+    uint8_t LiveLayer() const { return liveLayer; }
+    bool LiveSmooth() const { return liveSmooth; }
+
+private:
+    bool ApplyFrame(ByteReader& in, ShapeStore& shapes, std::vector<ChangedArea>& changed);
+    void Disconnect();
+
+    std::string address;
+    MirrorSocket socket;
+    double lastAttempt = 0;
+    bool handshaken = false;
+    std::vector<unsigned char> incoming;
+    std::vector<Vector2> points;
+    std::vector<FillSpan> spans;
+    uint64_t bytesReceived = 0;
+
+    std::vector<Vector2> live;
+    Color liveColor = BLANK;
+    int liveThickness = 0;
+    uint8_t liveLayer = 0;
+    bool liveSmooth = false;
+};
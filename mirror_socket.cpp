@@ -0,0 +1,282 @@
+#include "mirror_socket.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if defined(_WIN32)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <afunix.h>
+    using SocketLength = int;
+    static void CloseSocket(intptr_t handle) { closesocket((SOCKET)handle); }
+    static bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+    static bool ConnectPending() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+    static int PollWritable(intptr_t handle)
+    {
+        WSAPOLLFD entry = { (SOCKET)handle, POLLOUT, 0 };
+        return WSAPoll(&entry, 1, 0);
+    }
+    static bool SetNonBlocking(intptr_t handle)
+    {
+        u_long enabled = 1;
+        return ioctlsocket((SOCKET)handle, FIONBIO, &enabled) == 0;
+    }
+    static bool StartSockets()
+    {
+        static bool started = []()
+        {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+    }
+    constexpr int SendFlags = 0;
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+    using SocketLength = socklen_t;
+    static void CloseSocket(intptr_t handle) { close((int)handle); }
+    static bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+    static bool ConnectPending() { return errno == EINPROGRESS || errno == EINTR; }
+    static int PollWritable(intptr_t handle)
+    {
+        pollfd entry = { (int)handle, POLLOUT, 0 };
+        return poll(&entry, 1, 0);
+    }
+    static bool SetNonBlocking(intptr_t handle)
+    {
+        int flags = fcntl((int)handle, F_GETFL, 0);
+        return flags != -1 && fcntl((int)handle, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+    static bool StartSockets() { return true; }
+    // A viewer that went away must not take the publisher down with SIGPIPE.
+    #if defined(MSG_NOSIGNAL)
+        constexpr int SendFlags = MSG_NOSIGNAL;
+    #else
+        constexpr int SendFlags = 0;
+    #endif
+#endif
+
+constexpr const char* UnixPrefix = "unix:";
+constexpr int ListenBacklog = 8;
+
+// The socket address of either kind, or false when it can't be resolved.
+static bool ResolveAddress(const char* address, sockaddr_storage& storage, SocketLength& length, bool listening)
+{
+    std::memset(&storage, 0, sizeof(storage));
+
+    if(std::strncmp(address, UnixPrefix, std::strlen(UnixPrefix)) == 0)
+    {
+        const char* path = address + std::strlen(UnixPrefix);
+        sockaddr_un& unixAddress = (sockaddr_un&)storage;
+        if(std::strlen(path) >= sizeof(unixAddress.sun_path)) return false;
+
+        unixAddress.sun_family = AF_UNIX;
+        std::strcpy(unixAddress.sun_path, path);
+        length = (SocketLength)sizeof(sockaddr_un);
+        return true;
+    }
+
+    // "host:port", ":port" or just "port".
+    std::string host = "127.0.0.1";
+    const char* port = address;
+    if(const char* colon = std::strrchr(address, ':'))
+    {
+        if(colon != address)
+            host.assign(address, colon);
+        port = colon + 1;
+    }
+
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+    addrinfo* found = nullptr;
+    if(getaddrinfo(host.c_str(), port, &hints, &found) != 0 || found == nullptr) return false;
+
+    std::memcpy(&storage, found->ai_addr, found->ai_addrlen);
+    length = (SocketLength)found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+// Small writes go out right away, a stroke point is worth more than a full
+// packet.
+static void DisableDelay(intptr_t handle, int family)
+{
+    if(family == AF_UNIX) return;
+
+    int enabled = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&enabled, sizeof(enabled));
+}
+
+MirrorSocket::MirrorSocket(MirrorSocket&& other) noexcept
+    : handle(std::exchange(other.handle, InvalidHandle)), connecting(std::exchange(other.connecting, false)),
+      unlinkPath(std::move(other.unlinkPath))
+{
+    other.unlinkPath.clear();
+}
+
+MirrorSocket& MirrorSocket::operator=(MirrorSocket&& other) noexcept
+{
+    if(this != &other)
+    {
+        Close();
+        handle = std::exchange(other.handle, InvalidHandle);
+        connecting = std::exchange(other.connecting, false);
+        unlinkPath = std::move(other.unlinkPath);
+        other.unlinkPath.clear();
+    }
+    return *this;
+}
+
+MirrorSocket::~MirrorSocket()
+{
+    Close();
+}
+
+MirrorSocket MirrorSocket::Listen(const char* address)
+{
+    MirrorSocket result;
+    sockaddr_storage storage;
+    SocketLength length;
+    if(!StartSockets() || !ResolveAddress(address, storage, length, true)) return result;
+
+    intptr_t handle = (intptr_t)socket(storage.ss_family, SOCK_STREAM, 0);
+    if(handle == InvalidHandle) return result;
+    result.handle = handle;
+
+    if(storage.ss_family == AF_UNIX)
+    {
+        // A socket file left by a publisher that didn't exit cleanly.
+        const char* path = ((sockaddr_un&)storage).sun_path;
+        std::remove(path);
+        result.unlinkPath = path;
+    }
+    else
+    {
+        int enabled = 1;
+        setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&enabled, sizeof(enabled));
+    }
+
+    if(bind(handle, (sockaddr*)&storage, length) != 0 || listen(handle, ListenBacklog) != 0 || !SetNonBlocking(handle))
+        result.Close();
+    return result;
+}
+
+MirrorSocket MirrorSocket::Connect(const char* address)
+{
+    MirrorSocket result;
+    sockaddr_storage storage;
+    SocketLength length;
+    if(!StartSockets() || !ResolveAddress(address, storage, length, false)) return result;
+
+    intptr_t handle = (intptr_t)socket(storage.ss_family, SOCK_STREAM, 0);
+    if(handle == InvalidHandle) return result;
+    result.handle = handle;
+
+    // Non-blocking before connecting, a host that never answers must not
+    // stall the frame. FinishConnect picks the attempt up from there.
+    if(!SetNonBlocking(handle))
+    {
+        result.Close();
+        return result;
+    }
+
+    if(connect(handle, (sockaddr*)&storage, length) != 0)
+    {
+        if(!ConnectPending())
+        {
+            result.Close();
+            return result;
+        }
+        result.connecting = true;
+    }
+
+    DisableDelay(handle, storage.ss_family);
+    return result;
+}
+
+bool MirrorSocket::FinishConnect()
+{
+    if(!connecting) return IsOpen();
+
+    int ready = PollWritable(handle);
+    if(ready == 0) return true;
+
+    int error = 0;
+    SocketLength length = sizeof(error);
+    if(ready < 0 || getsockopt(handle, SOL_SOCKET, SO_ERROR, (char*)&error, &length) != 0 || error != 0)
+    {
+        Close();
+        return false;
+    }
+
+    connecting = false;
+    return true;
+}
+
+MirrorSocket MirrorSocket::Accept()
+{
+    MirrorSocket result;
+    if(!IsOpen()) return result;
+
+    sockaddr_storage storage;
+    SocketLength length = sizeof(storage);
+    intptr_t accepted = (intptr_t)accept(handle, (sockaddr*)&storage, &length);
+    if(accepted == InvalidHandle) return result;
+    result.handle = accepted;
+
+    if(!SetNonBlocking(accepted))
+    {
+        result.Close();
+        return result;
+    }
+
+#if defined(SO_NOSIGPIPE)
+    int enabled = 1;
+    setsockopt(accepted, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+    DisableDelay(accepted, storage.ss_family);
+    return result;
+}
+
+void MirrorSocket::Close()
+{
+    if(IsOpen())
+        CloseSocket(handle);
+    handle = InvalidHandle;
+    connecting = false;
+
+    if(!unlinkPath.empty())
+        std::remove(unlinkPath.c_str());
+    unlinkPath.clear();
+}
+
+long MirrorSocket::Send(const void* data, size_t size)
+{
+    if(!IsOpen()) return -1;
+
+    long sent = (long)send(handle, (const char*)data, (int)size, SendFlags);
+    if(sent >= 0) return sent;
+    return WouldBlock() ? 0 : -1;
+}
+
+long MirrorSocket::Receive(void* data, size_t size)
+{
+    if(!IsOpen()) return -1;
+
+    long received = (long)recv(handle, (char*)data, (int)size, 0);
+    if(received > 0) return received;
+    if(received < 0 && WouldBlock()) return 0;
+    return -1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Non-blocking stream socket for the mirror. Addresses are "unix:<path>" for
+// a Unix domain socket, otherwise "[host]:port" over TCP (the host defaults
+// to the loopback address). Kept apart from raylib, whose names clash with
+// the Windows socket headers.
+class MirrorSocket
+{
+public:
+    MirrorSocket() = default;
+    MirrorSocket(const MirrorSocket&) = delete;
+    MirrorSocket& operator=(const MirrorSocket&) = delete;
+    MirrorSocket(MirrorSocket&& other) noexcept;
+    MirrorSocket& operator=(MirrorSocket&& other) noexcept;
+    ~MirrorSocket();
+
+    static MirrorSocket Listen(const char* address);
+
+    // Starts connecting without waiting, the socket stays Connecting until
+    // FinishConnect sees the attempt through.
+    static MirrorSocket Connect(const char* address);
+
+    // Checks on a pending connect without blocking. False once it failed,
+    // which closes the socket.
+    bool FinishConnect();
+    bool Connecting() const { return connecting; }
+
+    // A pending connection, or a closed socket when there is none.
+    MirrorSocket Accept();
+
+    bool IsOpen() const { return handle != InvalidHandle; }
+    void Close();
+
+    // Bytes written or read, 0 when the call would block and -1 once the
+    // connection is gone. Receive returns -1 for a peer that closed it too.
+    long Send(const void* data, size_t size);
+    long Receive(void* data, size_t size);
+
+private:
+    static constexpr intptr_t InvalidHandle = -1;
+
+    intptr_t handle = InvalidHandle;
+    bool connecting = false;
+
+    // Unix socket a listener created, removed again when it closes.
+    std::string unlinkPath;
+};
@@ -1,58 +1,62 @@
 #include "paint.hpp"
 #include "raylib.h"
 #include "raymath.h"
+#include "render.hpp"
 #include "shapes.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <cstdint>
+#include <filesystem>
 #include <rlImGui.h>
 #include <imgui.h>
 
 using u8 = uint8_t;
 
 Paint::Paint()
-    : currentShape(Shape::FreeHand),
+    : activeErase(EditKind::Erase),
+      newDrawing(true),
+      currentShape(Shape::FreeHand),
       brushSize(2.0f),
       currentColor(BLACK),
       drawing(true),
+      erasing(false),
+      filled(false),
+      smooth(false),
       thickness(5),
-      erasing(false)
+      fillTolerance(DefaultFillTolerance),
+      activeLayer(0),
+      documentPath(DefaultDocumentPath),
+      timelapseInterval(DefaultTimelapseInterval),
+      viewing(false),
+      replaying(false),
+      showProfiler(false),
+      framesToIdle(IdleFrames),
+      waitingForEvents(false)
 {
     InitWindow(WindowWidth, WindowHeight, "MyPaint");
     rlImGuiSetup(true);
     SetTargetFPS(FPS);
-}
 
-Paint::~Paint() {}
+    camera = {};
+    camera.zoom = 1.0f;
+}
 
-static std::vector<Vector2> vLerp(Vector2 start, Vector2 end, float spacing)
+Paint::~Paint()
 {
-    std::vector<Vector2> points;
-    float distance = Vector2Distance(start, end);
-
-    if(distance < spacing)
-    {
-        points.push_back(end);
-        return points;
-    }
-
-    int pointsBetween = static_cast<int>(distance / spacing);
-
-    for(int i = 0; i < pointsBetween; i++)
-    {
-        float t = i / static_cast<float>(pointsBetween);
-        Vector2 p
-        {
-            start.x + (end.x - start.x)*t,
-            start.y + (end.y - start.y)*t,
-        };
-
-        points.push_back(p);
-    }
-
-    return points;
+    canvas.Unload();
+    selection.Unload();
+    reference.Unload();
+    timelapse.Stop();
+    rlImGuiShutdown();
+    CloseWindow();
 }
 
 void Paint::RenderColorPicker()
 {
+    ProfileZone zone(profiler, "RenderColorPicker");
     static bool alpha_preview = true;
     static bool alpha_half_preview = false;
     static bool drag_and_drop = true;
@@ -135,6 +139,7 @@ void Paint::RenderColorPicker()
 
 void Paint::RenderUI()
 {
+    ProfileZone zone(profiler, "RenderUI");
     DrawLineEx({0, 60}, {WindowWidth, 60}, 10.0f, {66, 65, 54, 255});
 
     ImGuiWindowFlags window_flags =
@@ -196,62 +201,302 @@ void Paint::RenderUI()
         erasing = false;
     }
     ImGui::SameLine();
+    if(ImGui::Button("Fill", ImVec2(70, 30)))
+    {
+        currentShape = Shape::Fill;
+        erasing = false;
+    }
+    ImGui::SameLine();
     if(ImGui::Button("Erase", ImVec2(70, 30)))
     {
-        currentShape = Shape::FreeHand;
-        currentColor = BackgroundColor;
+        currentShape = Shape::Erase;
         erasing = true;
     }
     ImGui::SameLine();
+    if(ImGui::Button("Select", ImVec2(70, 30)))
+    {
+        currentShape = Shape::Select;
+        erasing = false;
+    }
+    ImGui::SameLine();
+    if(ImGui::Button("Clear", ImVec2(70, 30)))
+        frameInput.events.push_back({ InputEventKind::Clear, 0 });
+    ImGui::SameLine();
     ImGui::Checkbox("Filled", &filled);
     ImGui::SameLine();
+    ImGui::Checkbox("Smooth", &smooth);
+    ImGui::SameLine();
 
     RenderColorPicker();
     ImGui::SameLine();
-    ImGui::SliderInt("Thickness", &thickness, 0, 100, "%d", ImGuiSliderFlags_None);
+    if(currentShape == Shape::Select)
+    {
+        // Gives the selected shapes the current color.
+        ImGui::BeginDisabled(selection.Empty());
+        if(ImGui::Button("Recolor", ImVec2(70, 30)))
+            frameInput.events.push_back({ InputEventKind::Recolor, (uint32_t)ColorToInt(currentColor) });
+        ImGui::EndDisabled();
+    }
+    else if(currentShape == Shape::Fill)
+        ImGui::SliderInt("Tolerance", &fillTolerance, 0, 255, "%d", ImGuiSliderFlags_None);
+    else
+        ImGui::SliderInt("Thickness", &thickness, 0, 100, "%d", ImGuiSliderFlags_None);
+    ImGui::SameLine();
+    if(imageExport.Busy())
+    {
+        ImGui::ProgressBar(imageExport.Progress(), ImVec2(70, 30), "Exporting");
+    }
+    else
+    {
+        if(ImGui::Button("Export", ImVec2(70, 30)))
+            ImGui::OpenPopup("export");
+
+        if(ImGui::BeginPopup("export"))
+        {
+            if(ImGui::Selectable("PNG"))
+                Export(ExportFormat::Png);
+            if(ImGui::Selectable("QOI"))
+                Export(ExportFormat::Qoi);
+            if(ImGui::Selectable("SVG"))
+                ExportSvg();
+            ImGui::EndPopup();
+        }
+    }
     ImGui::PopStyleColor(3);
     ImGui::End();
+
+    RenderLayers();
+    if(showProfiler)
+        RenderProfiler();
 }
 
-void Paint::HandleDrawFreeHand(Vector2 currentPos)
+void Paint::RenderProfiler()
 {
-    if(currentPos.y <= toolbarPadding) return;
+    ProfileZone zone(profiler, "RenderProfiler");
 
-    float spacing = brushSize/2;
-    if(newDrawing)
+    ImGui::SetNextWindowPos(ImVec2(WindowWidth - 340, toolbarPadding + 10), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(330, 440), ImGuiCond_FirstUseEver);
+    if(!ImGui::Begin("Profiler", &showProfiler))
     {
-        auto shape = new ShapeObject();
-        shape->shapeKind = Shape::FreeHand;
-        shape->shape = new FreeHandPoint(currentPos, currentColor, thickness);
+        ImGui::End();
+        return;
+    }
 
-        shapes.push_back(shape);
+    size_t count = profiler.FrameCount();
+    if(count == 0)
+    {
+        ImGui::End();
+        return;
+    }
 
-        newDrawing = false;
+    const ProfileFrame& last = profiler.Frame(count - 1);
+    profilerSamples.resize(count);
+    float total = 0, slowest = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        profilerSamples[i] = (float)(profiler.Frame(i).duration/1000);
+        total += profilerSamples[i];
+        slowest = std::max(slowest, profilerSamples[i]);
     }
-    else
+
+    ImGui::Text("Frame %.2f ms, avg %.2f ms, max %.2f ms", last.duration/1000, total/count, slowest);
+    ImGui::PlotLines("##Frame", profilerSamples.data(), (int)count, 0, nullptr, 0.0f,
+        std::max(slowest, 1000.0f/FPS)*1.1f, ImVec2(-1, 60));
+
+    ImGui::Separator();
+
+    // One graph per zone name of the last frame, nested zones indented.
+    char overlay[96];
+    for(size_t i = 0; i < last.zones.size(); i++)
     {
-        if(Vector2Distance(currentPos, lastFreeHandPoint) > spacing)
-        {
-            auto lerped = vLerp(lastFreeHandPoint, currentPos, spacing);
+        const ProfileZoneRecord& record = last.zones[i];
+        bool seen = false;
+        for(size_t j = 0; j < i && !seen; j++)
+            seen = std::strcmp(last.zones[j].name, record.name) == 0;
+        if(seen) continue;
+
+        profiler.ZoneHistory(record.name, profilerSamples);
+        float zoneSlowest = *std::max_element(profilerSamples.begin(), profilerSamples.end());
+        std::snprintf(overlay, sizeof(overlay), "%*s%s %.3f ms", (int)record.depth*2, "", record.name, profilerSamples.back());
+
+        ImGui::PushID(record.name);
+        ImGui::PlotLines("##Zone", profilerSamples.data(), (int)count, 0, overlay, 0.0f,
+            std::max(zoneSlowest, 0.1f)*1.1f, ImVec2(-1, 28));
+        ImGui::PopID();
+    }
 
-            for(auto lerpedp: lerped)
-            {
-                auto shape = new ShapeObject();
-                shape->shapeKind = Shape::FreeHand;
-                shape->shape = new FreeHandPoint(lerpedp, currentColor, thickness);
+    ImGui::Separator();
+
+    for(size_t c = 0; c < (size_t)ProfileCounter::Count; c++)
+    {
+        ProfileCounter counter = (ProfileCounter)c;
+        bool bytes = counter == ProfileCounter::ShapeBytes ||
+            counter == ProfileCounter::HistoryBytes ||
+            counter == ProfileCounter::ResidentBytes;
+
+        if(bytes)
+            ImGui::Text("%s: %.2f MB", CounterName(counter), last.Counter(counter)/(1024*1024));
+        else
+            ImGui::Text("%s: %.0f", CounterName(counter), last.Counter(counter));
+    }
+
+    ImGui::Separator();
+    if(ImGui::Button("Save trace"))
+    {
+        if(profiler.WriteTrace(TracePath))
+            TraceLog(LOG_INFO, "PROFILER: Wrote the last %zu frames to %s", count, TracePath);
+    }
+
+    ImGui::End();
+}
+
+// Top of the stack first, like every other paint program.
+void Paint::RenderLayers()
+{
+    ProfileZone zone(profiler, "RenderLayers");
+
+    ImGui::SetNextWindowPos(ImVec2(WindowWidth - 230, toolbarPadding + 10), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(220, 260), ImGuiCond_FirstUseEver);
+    if(!ImGui::Begin("Layers"))
+    {
+        ImGui::End();
+        return;
+    }
+
+    std::vector<InputEvent>& events = frameInput.events;
+    const std::vector<Layer>& layers = shapes.Layers();
+    for(size_t i = layers.size(); i-- > 0;)
+    {
+        const Layer& layer = layers[i];
+        ImGui::PushID(layer.id);
+
+        bool visible = layer.visible;
+        if(ImGui::Checkbox("##Visible", &visible))
+            events.push_back({ InputEventKind::LayerVisible, LayerEventValue(layer.id, visible ? 1u : 0u) });
+        ImGui::SameLine();
+        if(ImGui::Selectable(layer.name.c_str(), layer.id == activeLayer))
+            activeLayer = layer.id;
+
+        ImGui::PopID();
+    }
+
+    ImGui::Separator();
+
+    Layer* active = shapes.FindLayer(activeLayer);
+    if(active)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s", active->name.c_str());
+        if(ImGui::InputText("Name", name, sizeof(name)))
+            active->name = name;
+
+        float opacity = active->opacity;
+        if(ImGui::SliderFloat("Opacity", &opacity, 0.0f, 1.0f, "%.2f"))
+            events.push_back({ InputEventKind::LayerOpacity, LayerEventValue(activeLayer, (uint32_t)std::lround(opacity*255)) });
 
-                shapes.push_back(shape);
+        if(ImGui::BeginCombo("Blend", LayerBlendName(active->blend)))
+        {
+            for(int mode = 0; mode < (int)LayerBlend::Count; mode++)
+            {
+                if(ImGui::Selectable(LayerBlendName((LayerBlend)mode), mode == (int)active->blend))
+                    events.push_back({ InputEventKind::LayerBlend, LayerEventValue(activeLayer, (uint32_t)mode) });
             }
+            ImGui::EndCombo();
         }
+
+        if(ImGui::Button("Up"))
+            events.push_back({ InputEventKind::LayerMove, LayerEventValue(activeLayer, 1) });
+        ImGui::SameLine();
+        if(ImGui::Button("Down"))
+            events.push_back({ InputEventKind::LayerMove, LayerEventValue(activeLayer, 0) });
+        ImGui::SameLine();
+    }
+
+    ImGui::BeginDisabled(layers.size() >= MaxLayers);
+    if(ImGui::Button("Add layer"))
+        events.push_back({ InputEventKind::LayerAdd, 0 });
+    ImGui::EndDisabled();
+
+    if(svgImport.Busy())
+    {
+        ImGui::Separator();
+        ImGui::ProgressBar(svgImport.Progress(), ImVec2(-1, 0), "Importing SVG");
+    }
+
+    ImGui::Separator();
+    if(timelapse.Recording())
+    {
+        ImGui::Text("Timelapse: %d frames, %d dropped", timelapse.Frames(), timelapse.DroppedFrames());
+        if(ImGui::Button("Stop timelapse"))
+            timelapse.Stop();
+    }
+    else
+    {
+        ImGui::BeginDisabled(timelapse.Busy());
+        if(ImGui::Button("Record timelapse"))
+            StartTimelapse();
+        ImGui::EndDisabled();
+        ImGui::SliderFloat("##TimelapseInterval", &timelapseInterval, 0.1f, 30.0f, "Every %.1f s");
+    }
+
+    if(publisher.IsOpen())
+    {
+        ImGui::Separator();
+        ImGui::Text("Mirror: %zu viewers, %.1f KB sent", publisher.Viewers(), publisher.BytesSent()/1024.0);
     }
 
-    lastFreeHandPoint = currentPos;
+    // Not part of the document, a drawing aid only.
+    if(reference.Loading())
+    {
+        ImGui::Separator();
+        ImGui::ProgressBar(reference.Progress(), ImVec2(-1, 0), "Loading reference");
+    }
+    else if(reference.Loaded())
+    {
+        ImGui::Separator();
+        bool visible = reference.Visible();
+        if(ImGui::Checkbox("Reference", &visible))
+            reference.SetVisible(visible);
+        ImGui::SameLine();
+        if(ImGui::Button("Remove"))
+            reference.Unload();
+
+        float opacity = reference.Opacity();
+        if(ImGui::SliderFloat("##ReferenceOpacity", &opacity, 0.0f, 1.0f, "%.2f"))
+            reference.SetOpacity(opacity);
+    }
+
+    ImGui::End();
 }
 
-void Paint::HandleDrawCircle(Vector2 currentPos)
+void Paint::HandleDrawFreeHand(Vector2 currentPos)
 {
-    if(currentPos.y <= toolbarPadding) return;
+    ProfileZone zone(profiler, "HandleDrawFreeHand");
+    float spacing = brushSize/2;
+    if(newDrawing)
+    {
+        strokeSimplifier.Begin(currentPos, StrokeTolerance(thickness));
+        newDrawing = false;
+    }
+    else if(Vector2Distance(currentPos, strokeSimplifier.Last()) > spacing)
+    {
+        strokeSimplifier.Add(currentPos);
+    }
 
+    if(smooth)
+    {
+        SmoothStroke(strokeSimplifier.Points(), strokeSimplifier.Count(), StrokeTolerance(thickness), strokePoints);
+        DrawStroke(strokePoints.data(), strokePoints.size(), currentColor, thickness, camera.zoom);
+    }
+    else
+    {
+        DrawStroke(strokeSimplifier.Points(), strokeSimplifier.Count(), currentColor, thickness, camera.zoom);
+    }
+}
+
+void Paint::HandleDrawCircle(Vector2 currentPos)
+{
+    ProfileZone zone(profiler, "HandleDrawCircle");
     if(newDrawing)
     {
         boundingBoxStart = currentPos;
@@ -286,8 +531,7 @@ void Paint::HandleDrawCircle(Vector2 currentPos)
 
 void Paint::HandleDrawRectangle(Vector2 currentPos)
 {
-    if(currentPos.y <= toolbarPadding) return;
-
+    ProfileZone zone(profiler, "HandleDrawRectangle");
     if(newDrawing)
     {
         boundingBoxStart = currentPos;
@@ -308,8 +552,7 @@ void Paint::HandleDrawRectangle(Vector2 currentPos)
 
 void Paint::HandleDrawTriangle(Vector2 currentPos)
 {
-    if(currentPos.y <= toolbarPadding) return;
-
+    ProfileZone zone(profiler, "HandleDrawTriangle");
     if(newDrawing)
     {
         triangleTop = currentPos;
@@ -330,8 +573,7 @@ void Paint::HandleDrawTriangle(Vector2 currentPos)
 
 void Paint::HandleDrawEllipse(Vector2 currentPos)
 {
-    if(currentPos.y <= toolbarPadding) return;
-
+    ProfileZone zone(profiler, "HandleDrawEllipse");
     if(newDrawing)
     {
         boundingBoxStart = currentPos;
@@ -370,8 +612,7 @@ void Paint::HandleDrawEllipse(Vector2 currentPos)
 
 void Paint::HandleDrawLine(Vector2 currentPos)
 {
-    if(currentPos.y <= toolbarPadding) return;
-
+    ProfileZone zone(profiler, "HandleDrawLine");
     if(newDrawing)
     {
         lineStart = currentPos;
@@ -384,100 +625,709 @@ void Paint::HandleDrawLine(Vector2 currentPos)
     }
 }
 
-void Paint::RenderAll()
+void Paint::HandleErase(Vector2 currentPos)
 {
-    for(const auto& shape: shapes)
+    ProfileZone zone(profiler, "HandleErase");
+    if(newDrawing)
     {
-        switch(shape->shapeKind)
-        {
-            case Shape::Rectangle:
-            {
-                Rect* rect = (Rect*)shape->shape;
-                if(rect->filled)
-                    DrawRectangleV({rect->x, rect->y}, {rect->width, rect->height}, rect->color);
-                else
-                    DrawRectangleLinesEx({rect->x, rect->y, rect->width, rect->height}, rect->thickness, rect->color);
-            } break;
-
-            case Shape::Circle:
-            {
-                Circle* circle = (Circle*)shape->shape;
-                if(circle->filled)
-                    DrawCircleV(circle->center, circle->radius, circle->color);
-                else
-                    DrawRing(circle->center, circle->radius, circle->radius + circle->thickness, 0, 360, 0, circle->color);
-            } break;
-
-            case Shape::Line:
-            {
-                Line* line = (Line*)shape->shape;
-                DrawLineEx(line->start, line->end, line->thickness, line->color);
-            } break;
+        lastErasePoint = currentPos;
+        newDrawing = false;
+    }
+
+    float radius = (float)std::max(thickness, 1);
+    Rectangle area
+    {
+        std::min(lastErasePoint.x, currentPos.x) - radius,
+        std::min(lastErasePoint.y, currentPos.y) - radius,
+        std::fabs(currentPos.x - lastErasePoint.x) + 2*radius,
+        std::fabs(currentPos.y - lastErasePoint.y) + 2*radius,
+    };
+
+    eraseCandidates.clear();
+    shapes.Query(area, activeLayer, eraseCandidates);
+
+    for(uint32_t position: eraseCandidates)
+    {
+        ShapeHandle before = shapes[position];
+        if(!shapes.Intersects(before, lastErasePoint, currentPos, radius)) continue;
+
+        ShapeHandle after = before;
+        if(before.Kind() == Shape::FreeHand)
+            after = shapes.EraseFromStroke(before, lastErasePoint, currentPos, radius);
+        else
+            after.hidden = 1;
+
+        if(after.SameShape(before) && after.hidden == before.hidden) continue;
 
-            case Shape::Ellipse:
+        canvas.MarkDirty(shapes.Bounds(before), (uint8_t)before.layer);
+        shapes.Replace(position, after);
+        activeErase.changed.push_back({position, before, after});
+    }
+
+    lastErasePoint = currentPos;
+    DrawCircleLinesV(currentPos, radius, RAYWHITE);
+}
+
+// Fills what is on screen under the click, at screen resolution.
+void Paint::HandleFill(Vector2 mouse)
+{
+    ProfileZone zone(profiler, "HandleFill");
+
+    int width = GetScreenWidth();
+    int height = GetScreenHeight();
+    Rectangle area = TiledCanvas::VisibleArea(camera, width, height);
+    Image view = canvas.Capture(shapes, area, width, height);
+
+    // The read back is bottom-up, walk it from the last row.
+    const unsigned char* lastRow = (const unsigned char*)view.data + (size_t)(height - 1)*width*4;
+    if(FloodFill(lastRow, -(ptrdiff_t)width*4, width, height, (int)mouse.x, (int)mouse.y, fillTolerance, fillSpans))
+        CommitShape(shapes.AddFill(fillSpans.data(), fillSpans.size(), { area.x, area.y }, area.width/width, currentColor, activeLayer));
+
+    UnloadImage(view);
+}
+
+// A press on the selection or one of its grips drags it, anywhere else it
+// starts a marquee.
+void Paint::HandleSelect(Vector2 currentPos)
+{
+    ProfileZone zone(profiler, "HandleSelect");
+    if(newDrawing)
+    {
+        boundingBoxStart = currentPos;
+        newDrawing = false;
+
+        SelectionGrip grip = selection.GripAt(currentPos, camera.zoom);
+        if(grip != SelectionGrip::None)
+            selection.BeginDrag(shapes, canvas, grip, currentPos);
+        return;
+    }
+
+    if(selection.Dragging())
+    {
+        selection.Drag(currentPos);
+        return;
+    }
+
+    Rectangle marquee
+    {
+        std::min(boundingBoxStart.x, currentPos.x),
+        std::min(boundingBoxStart.y, currentPos.y),
+        std::fabs(currentPos.x - boundingBoxStart.x),
+        std::fabs(currentPos.y - boundingBoxStart.y),
+    };
+    DrawRectangleLinesEx(marquee, 1/camera.zoom, SelectionColor);
+}
+
+// Ends a drag, or selects what the marquee encloses. A click without much of
+// a marquee picks the shape under it.
+void Paint::FinishSelect(Vector2 currentPos)
+{
+    if(selection.Dragging())
+    {
+        Edit edit(EditKind::Transform);
+        if(selection.EndDrag(shapes, canvas, edit))
+            history.Push(shapes, std::move(edit));
+        return;
+    }
+
+    float reach = SelectionGripPixels/camera.zoom;
+    Rectangle marquee
+    {
+        std::min(boundingBoxStart.x, currentPos.x),
+        std::min(boundingBoxStart.y, currentPos.y),
+        std::fabs(currentPos.x - boundingBoxStart.x),
+        std::fabs(currentPos.y - boundingBoxStart.y),
+    };
+
+    if(marquee.width < reach && marquee.height < reach)
+        selection.Pick(shapes, activeLayer, boundingBoxStart, reach/2);
+    else
+        selection.SelectArea(shapes, activeLayer, marquee);
+}
+
+void Paint::CommitShape(ShapeHandle handle)
+{
+    if(handle.hidden)
+    {
+        TraceLog(LOG_WARNING, "PAINT: Too many shapes of one kind, the shape was dropped");
+        return;
+    }
+
+    canvas.DrawShape(shapes, handle);
+    Edit edit(EditKind::Add);
+    edit.added.push_back(handle);
+    history.Push(shapes, std::move(edit));
+}
+
+void Paint::ClearCanvas()
+{
+    selection.Clear(canvas);
+
+    Edit edit(EditKind::Clear);
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        if(!shapes.IsVisible(position)) continue;
+
+        ShapeHandle before = shapes[position];
+        ShapeHandle after = before;
+        after.hidden = 1;
+
+        shapes.Replace(position, after);
+        edit.changed.push_back({(uint32_t)position, before, after});
+    }
+
+    if(!edit.changed.empty())
+    {
+        canvas.MarkAllDirty();
+        history.Push(shapes, std::move(edit));
+    }
+}
+
+bool Paint::Open(const char* path, bool recover)
+{
+    ShapeStore loaded;
+    bool recovered = recover && Journal::CanRecover(path) && Journal::Recover(loaded, path);
+    if(!recovered && !LoadDocument(loaded, path)) return false;
+
+    selection.Clear(canvas);
+    svgImport.Cancel();
+    shapes = std::move(loaded);
+    activeLayer = shapes.Layers().back().id;
+    history.Reset();
+    activeErase = Edit(EditKind::Erase);
+    strokeSimplifier.Clear();
+    newDrawing = true;
+    canvas.MarkAllDirty();
+    canvas.Prefill(shapes, workers);
+
+    documentPath = path;
+    SetWindowTitle(TextFormat(recovered ? "MyPaint - %s (recovered)" : "MyPaint - %s", GetFileName(path)));
+
+    // The journal and the viewers start over from the new document.
+    shapes.TakeChanges(changes);
+    publisher.Resync();
+    if(journal.IsOpen())
+        journal.Start(shapes, documentPath);
+    return true;
+}
+
+bool Paint::Save()
+{
+    if(!SaveDocument(shapes, documentPath.c_str())) return false;
+
+    SetWindowTitle(TextFormat("MyPaint - %s", GetFileName(documentPath.c_str())));
+    return true;
+}
+
+bool Paint::Export(ExportFormat format)
+{
+    if(imageExport.Busy()) return false;
+
+    std::filesystem::path path = documentPath;
+    path.replace_extension(format == ExportFormat::Png ? ".png" : ".qoi");
+
+    // Only the read back happens on this thread, encoding runs on the pool.
+    return imageExport.Start(workers, CaptureView(), true, format, path.string());
+}
+
+bool Paint::ExportSvg()
+{
+    std::filesystem::path path = documentPath;
+    path.replace_extension(SvgExtension);
+    return SaveSvg(shapes, path.string().c_str());
+}
+
+bool Paint::StartTimelapse()
+{
+    std::filesystem::path path = documentPath;
+    path.replace_extension(TimelapseExtension);
+    return timelapse.Start(path.string().c_str(), GetScreenWidth(), GetScreenHeight(), timelapseInterval);
+}
+
+bool Paint::StartPublishing(const char* address)
+{
+    return publisher.Start(address);
+}
+
+void Paint::StartViewing(const char* address)
+{
+    viewing = true;
+    viewer.Connect(address);
+    SetWindowTitle(TextFormat("MyPaint - viewing %s", address));
+}
+
+bool Paint::StartRecording(const char* path)
+{
+    recordedTools.valid = false;
+    return recorder.Open(path);
+}
+
+bool Paint::StartReplay(const char* path, ReplayOptions options)
+{
+    if(!replay.Load(path)) return false;
+
+    // Frames run back to back, --realtime paces them itself.
+    SetTargetFPS(0);
+    replayOptions = std::move(options);
+    replaying = true;
+    return true;
+}
+
+void Paint::ApplyEvent(const InputEvent& event)
+{
+    switch(event.kind)
+    {
+        case InputEventKind::Tool:
+            currentShape = (Shape)event.value;
+            erasing = currentShape == Shape::Erase;
+            break;
+
+        case InputEventKind::Color:
+            currentColor = GetColor(event.value);
+            break;
+
+        case InputEventKind::Thickness:
+            thickness = (int)event.value;
+            break;
+
+        case InputEventKind::Filled:
+            filled = event.value != 0;
+            break;
+
+        case InputEventKind::Smooth:
+            smooth = event.value != 0;
+            break;
+
+        case InputEventKind::Tolerance:
+            fillTolerance = (int)event.value;
+            break;
+
+        case InputEventKind::CameraX:
+            camera.target.x = std::bit_cast<float>(event.value);
+            break;
+
+        case InputEventKind::CameraY:
+            camera.target.y = std::bit_cast<float>(event.value);
+            break;
+
+        case InputEventKind::CameraZoom:
+            camera.zoom = std::bit_cast<float>(event.value);
+            break;
+
+        case InputEventKind::Key:
+            // Positions the selection and an open erase hold may not survive
+            // undo or redo, so the erase so far becomes its own edit first.
+            if(event.value == KEY_Z || event.value == KEY_Y)
             {
-                Ellipse* ellipse = (Ellipse*)shape->shape;
-                if(ellipse->filled)
-                    DrawEllipse(ellipse->center.x, ellipse->center.y, ellipse->radiusH, ellipse->radiusV , ellipse->color);
-                else
-                    DrawEllipseLines(ellipse->center.x, ellipse->center.y, ellipse->radiusH, ellipse->radiusV , ellipse->color);
-            } break;
-
-            case Shape::Triangle:
+                selection.Clear(canvas);
+                if(!activeErase.changed.empty())
+                    history.Push(shapes, std::move(activeErase));
+                activeErase = Edit(EditKind::Erase);
+            }
+
+            if(event.value == KEY_Z)
+                history.Undo(shapes, canvas);
+            else if(event.value == KEY_Y)
+                history.Redo(shapes, canvas);
+            else if(event.value == KEY_S && !replaying)
+                Save();
+            break;
+
+        case InputEventKind::Clear:
+            ClearCanvas();
+            break;
+
+        case InputEventKind::LayerAdd:
+        {
+            int id = shapes.AddLayer(TextFormat("Layer %zu", shapes.Layers().size() + 1));
+            if(id >= 0)
+                activeLayer = (uint8_t)id;
+        } break;
+
+        case InputEventKind::LayerSelect:
+            if(shapes.FindLayer((uint8_t)event.value))
+                activeLayer = (uint8_t)event.value;
+            break;
+
+        case InputEventKind::LayerVisible:
+            if(Layer* layer = shapes.FindLayer(event.value & 0xFF))
+                layer->visible = (event.value >> 8) != 0;
+            break;
+
+        case InputEventKind::LayerOpacity:
+            if(Layer* layer = shapes.FindLayer(event.value & 0xFF))
+                layer->opacity = std::min(event.value >> 8, 255u)/255.0f;
+            break;
+
+        case InputEventKind::LayerBlend:
+            if(Layer* layer = shapes.FindLayer(event.value & 0xFF); layer && (event.value >> 8) < (uint32_t)LayerBlend::Count)
+                layer->blend = (LayerBlend)(event.value >> 8);
+            break;
+
+        case InputEventKind::LayerMove:
+            shapes.MoveLayer(event.value & 0xFF, (event.value >> 8) != 0);
+            break;
+
+        case InputEventKind::Recolor:
+        {
+            Edit edit(EditKind::Recolor);
+            if(selection.Recolor(shapes, canvas, GetColor(event.value), edit))
+                history.Push(shapes, std::move(edit));
+        } break;
+    }
+}
+
+// The toolbar writes straight into Paint, a recording gets the differences.
+void Paint::RecordToolChanges()
+{
+    if(!recorder.IsOpen()) return;
+
+    std::vector<InputEvent>& events = frameInput.events;
+    if(!recordedTools.valid || recordedTools.shape != currentShape)
+        events.push_back({ InputEventKind::Tool, (uint32_t)currentShape });
+    if(!recordedTools.valid || ColorToInt(recordedTools.color) != ColorToInt(currentColor))
+        events.push_back({ InputEventKind::Color, (uint32_t)ColorToInt(currentColor) });
+    if(!recordedTools.valid || recordedTools.thickness != thickness)
+        events.push_back({ InputEventKind::Thickness, (uint32_t)thickness });
+    if(!recordedTools.valid || recordedTools.filled != filled)
+        events.push_back({ InputEventKind::Filled, filled ? 1u : 0u });
+    if(!recordedTools.valid || recordedTools.smooth != smooth)
+        events.push_back({ InputEventKind::Smooth, smooth ? 1u : 0u });
+    if(!recordedTools.valid || recordedTools.fillTolerance != fillTolerance)
+        events.push_back({ InputEventKind::Tolerance, (uint32_t)fillTolerance });
+    if(!recordedTools.valid || recordedTools.activeLayer != activeLayer)
+        events.push_back({ InputEventKind::LayerSelect, activeLayer });
+
+    if(!recordedTools.valid || recordedTools.camera.target.x != camera.target.x)
+        events.push_back({ InputEventKind::CameraX, std::bit_cast<uint32_t>(camera.target.x) });
+    if(!recordedTools.valid || recordedTools.camera.target.y != camera.target.y)
+        events.push_back({ InputEventKind::CameraY, std::bit_cast<uint32_t>(camera.target.y) });
+    if(!recordedTools.valid || recordedTools.camera.zoom != camera.zoom)
+        events.push_back({ InputEventKind::CameraZoom, std::bit_cast<uint32_t>(camera.zoom) });
+
+    recordedTools = { true, currentShape, currentColor, thickness, filled, smooth, fillTolerance, activeLayer, camera };
+}
+
+// At rest EndDrawing blocks until the next input event, so an idle window
+// costs no CPU or GPU. A frame woken by input, a stroke in progress, an
+// export or anything ImGui is busy with keeps the full frame rate. The back
+// buffer isn't kept across swaps, so every frame that does run still draws
+// everything. Publishing or viewing a mirror polls its sockets every frame.
+void Paint::UpdateIdle()
+{
+    const ImGuiIO& io = ImGui::GetIO();
+    bool busy = replaying || viewing || publisher.IsOpen() || waitingForEvents || frameInput.mouseDown ||
+        !frameInput.events.empty() || imageExport.Busy() || svgImport.Busy() || timelapse.Busy() ||
+        reference.Loading() || reference.Streaming() || showProfiler || io.WantTextInput || ImGui::IsAnyItemActive();
+
+    if(busy)
+        framesToIdle = IdleFrames;
+    else if(framesToIdle > 0)
+        framesToIdle--;
+
+    bool wait = framesToIdle == 0;
+    if(wait == waitingForEvents) return;
+
+    if(wait)
+        EnableEventWaiting();
+    else
+        DisableEventWaiting();
+    waitingForEvents = wait;
+}
+
+int Paint::FinishReplay()
+{
+    int status = 0;
+
+    if(!frameTimes.empty())
+    {
+        std::vector<float> sorted = frameTimes;
+        std::sort(sorted.begin(), sorted.end());
+        TraceLog(LOG_INFO, "REPLAY: %zu frames, median %.3f ms, p95 %.3f ms, max %.3f ms",
+            sorted.size(), sorted[sorted.size()/2], sorted[sorted.size()*95/100], sorted.back());
+    }
+
+    if(!replayOptions.timingsPath.empty())
+    {
+        std::string csv = "frame,ms\n";
+        for(size_t frame = 0; frame < frameTimes.size(); frame++)
+            csv += TextFormat("%zu,%.4f\n", frame, frameTimes[frame]);
+        if(!SaveFileText(replayOptions.timingsPath.c_str(), csv.data()))
+            status = 1;
+    }
+
+    if(!replayOptions.goldenPath.empty())
+    {
+        const char* goldenPath = replayOptions.goldenPath.c_str();
+        Image image = CaptureView();
+        ImageFlipVertical(&image);
+
+        if(!FileExists(goldenPath))
+        {
+            if(ExportImage(image, goldenPath))
+                TraceLog(LOG_INFO, "REPLAY: Wrote golden image %s", goldenPath);
+            else
+                status = 1;
+        }
+        else
+        {
+            Image golden = LoadImage(goldenPath);
+            ImageFormat(&golden, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+            // A couple of levels per channel absorb driver rounding.
+            size_t differing = CompareImages(image, golden, 2);
+            if(differing > 0)
             {
-                Triangle* triangle = (Triangle*)shape->shape;
-                if(triangle->filled)
-                    DrawTriangle(triangle->v1, triangle->v2, triangle->v3, triangle->color);
-                else
-                    DrawTriangleLines(triangle->v1, triangle->v2, triangle->v3, triangle->color);
-            } break;
-
-            case Shape::FreeHand:
+                TraceLog(LOG_WARNING, "REPLAY: %zu pixels differ from %s", differing, goldenPath);
+                status = 1;
+            }
+            else
             {
-                FreeHandPoint* fhp = (FreeHandPoint*)shape->shape;
-                DrawCircleV(fhp->pos, fhp->thickness, fhp->color);
-            } break;
+                TraceLog(LOG_INFO, "REPLAY: Canvas matches %s", goldenPath);
+            }
+            UnloadImage(golden);
+        }
+
+        UnloadImage(image);
+    }
+
+    return status;
+}
+
+Image Paint::CaptureView()
+{
+    int width = GetScreenWidth();
+    int height = GetScreenHeight();
+    return canvas.Capture(shapes, TiledCanvas::VisibleArea(camera, width, height), width, height);
+}
+
+// Wheel zooms around the cursor, the middle or right button drags the view.
+void Paint::UpdateCamera()
+{
+    if(IsKeyPressed(KEY_HOME))
+    {
+        camera.target = { 0, 0 };
+        camera.zoom = 1.0f;
+    }
+
+    if(ImGui::GetIO().WantCaptureMouse) return;
+
+    float wheel = GetMouseWheelMove();
+    if(wheel != 0)
+    {
+        Vector2 mouse = GetMousePosition();
+        Vector2 anchor = GetScreenToWorld2D(mouse, camera);
+        camera.zoom = std::clamp(camera.zoom*powf(ZoomStep, wheel), MinZoom, MaxZoom);
+        camera.target = Vector2Subtract(anchor, Vector2Scale(mouse, 1/camera.zoom));
+    }
+
+    if(IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+        camera.target = Vector2Subtract(camera.target, Vector2Scale(GetMouseDelta(), 1/camera.zoom));
+}
+
+// Applies what the publisher sent, redrawing only the tiles it touched unless
+// that is most of them anyway.
+void Paint::UpdateViewer()
+{
+    ProfileZone zone(profiler, "Mirror");
+    mirrorChanges.clear();
+    viewer.Update(shapes, mirrorChanges);
+
+    if(mirrorChanges.size() > MirrorChangedAreas)
+    {
+        canvas.MarkAllDirty();
+        return;
+    }
+    for(const ChangedArea& changed: mirrorChanges)
+        canvas.MarkDirty(changed.area, changed.layer);
+}
+
+LiveStroke Paint::CurrentLiveStroke() const
+{
+    LiveStroke live;
+    if(currentShape != Shape::FreeHand || strokeSimplifier.Empty()) return live;
+
+    live.points = strokeSimplifier.Points();
+    live.count = strokeSimplifier.Count();
+    live.color = currentColor;
+    live.thickness = thickness;
+    live.layer = activeLayer;
+    live.smooth = smooth;
+    return live;
+}
 
-            default: {}
+void Paint::RenderViewerStatus()
+{
+    ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_Always);
+    ImGui::Begin("##Mirror", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+        ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings);
+    if(viewer.Connected())
+        ImGui::Text("Viewing %s, %.1f KB received", viewer.Address().c_str(), viewer.BytesReceived()/1024.0);
+    else if(!viewer.Address().empty())
+        ImGui::Text("Connecting to %s...", viewer.Address().c_str());
+    else
+        ImGui::Text("Not a compatible publisher");
+    ImGui::End();
+
+    if(showProfiler)
+        RenderProfiler();
+}
+
+void Paint::RenderAll()
+{
+    ProfileZone zone(profiler, "RenderAll");
+    {
+        // Last frame's sample, before this frame gives the GPU more to do.
+        ProfileZone readBack(profiler, "Timelapse Read Back");
+        timelapse.ReadBack();
+    }
+    {
+        ProfileZone update(profiler, "Canvas Update");
+        canvas.SetView(camera, GetScreenWidth(), GetScreenHeight());
+        canvas.Update(shapes);
+        selection.Update(shapes, camera.zoom);
+        timelapse.Sample(canvas, shapes, GetScreenWidth(), GetScreenHeight());
+    }
+    {
+        ProfileZone update(profiler, "Reference Update");
+        reference.Update(workers, camera, GetScreenWidth(), GetScreenHeight());
+    }
+
+    BeginMode2D(camera);
+    reference.Render();
+    EndMode2D();
+    canvas.Render(shapes);
+
+    const Layer* liveLayer = viewing ? shapes.FindLayer(viewer.LiveLayer()) : nullptr;
+    if(!viewer.LivePoints().empty() && liveLayer != nullptr && liveLayer->visible)
+    {
+        const Vector2* points = viewer.LivePoints().data();
+        size_t count = viewer.LivePoints().size();
+        if(viewer.LiveSmooth())
+        {
+            SmoothStroke(points, count, StrokeTolerance(viewer.LiveThickness()), strokePoints);
+            points = strokePoints.data();
+            count = strokePoints.size();
         }
+
+        BeginMode2D(camera);
+        DrawStroke(points, count, viewer.LiveColor(), viewer.LiveThickness(), camera.zoom);
+        EndMode2D();
     }
+
+    // A dragged selection shows above the layers on top of its own.
+    BeginMode2D(camera);
+    selection.Render(shapes, camera.zoom);
+    EndMode2D();
 }
 
-void Paint::Run()
+int Paint::Run()
 {
+    // Replays and recordings start from the document as saved and leave it
+    // alone.
+    // A viewer's document is the publisher's.
+    shapes.TakeChanges(changes);
+    if(!replaying && !viewing && !recorder.IsOpen() && !journal.IsOpen())
+        journal.Start(shapes, documentPath);
+
     while(!WindowShouldClose())
     {
+        double frameStart = GetTime();
+        if(replaying)
+        {
+            if(!replay.Next(frameInput)) break;
+        }
+        else
+        {
+            frameInput.Poll();
+            if(IsKeyPressed(KEY_F3))
+                showProfiler = !showProfiler;
+        }
+
+        profiler.BeginFrame();
+        canvas.ResetStats();
+        if(viewing)
+            UpdateViewer();
+
         BeginDrawing();
         ClearBackground(BackgroundColor);
 
         rlImGuiBegin();
 
         RenderAll();
-        RenderUI();
 
-        if(IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL))
+        // A replay owns the toolbar state, the real mouse must not change it.
+        if(!replaying)
         {
-            if(IsKeyPressed(KEY_Z))
+            UpdateCamera();
+            if(viewing)
             {
-                if(!shapes.empty())
-                {
-                    undoedShapes.push_back(shapes.back());
-                    shapes.pop_back();
-                }
+                RenderViewerStatus();
+                frameInput.events.clear();
             }
-            else if(IsKeyPressed(KEY_Y))
+            else
+            {
+                RenderUI();
+                RecordToolChanges();
+            }
+
+            // Clicks on a panel over the canvas are not for the canvas, and
+            // a viewer only looks.
+            if(viewing || ImGui::GetIO().WantCaptureMouse)
+            {
+                frameInput.mouseDown = false;
+                frameInput.mouseReleased = false;
+            }
+        }
+
+        for(const InputEvent& event: frameInput.events)
+            ApplyEvent(event);
+        recorder.Write(frameInput);
+
+        // The selection belongs to the select tool and the active layer.
+        if(!selection.Empty() && (currentShape != Shape::Select || selection.SelectedLayer() != activeLayer))
+            selection.Clear(canvas);
+
+        // Drops aren't input events, a recording couldn't replay them.
+        if(!replaying && !viewing && !recorder.IsOpen() && IsFileDropped())
+        {
+            FilePathList dropped = LoadDroppedFiles();
+            for(unsigned int i = 0; i < dropped.count; i++)
             {
-                if(!undoedShapes.empty())
+                if(IsFileExtension(dropped.paths[i], DocumentExtension) && Open(dropped.paths[i]))
+                    break;
+
+                // Dropped SVGs are imported into the active layer, their origin where they were dropped.
+                if(IsFileExtension(dropped.paths[i], SvgExtension))
                 {
-                    shapes.push_back(undoedShapes.back());
-                    undoedShapes.pop_back();
+                    svgImport.Start(workers, dropped.paths[i], GetScreenToWorld2D(GetMousePosition(), camera));
+                    break;
+                }
+
+                // Dropped images become the reference, their corner where they were dropped.
+                if(ReferenceImage::IsSupported(dropped.paths[i]))
+                {
+                    reference.Load(workers, dropped.paths[i], GetScreenToWorld2D(GetMousePosition(), camera));
+                    break;
                 }
             }
+            UnloadDroppedFiles(dropped);
+        }
+
+        // An import lands as a single edit, undone in one step.
+        Edit imported(EditKind::Add);
+        Rectangle importedArea;
+        if(svgImport.Finish(shapes, activeLayer, imported.added, importedArea))
+        {
+            canvas.MarkDirty(importedArea, activeLayer);
+            history.Push(shapes, std::move(imported));
         }
 
-        if(IsMouseButtonDown(MOUSE_BUTTON_LEFT))
+        // Nothing is drawn under the toolbar.
+        if(frameInput.mouseDown && frameInput.mouse.y > toolbarPadding)
         {
-            Vector2 currentPos = GetMousePosition();
+            Vector2 currentPos = GetScreenToWorld2D(frameInput.mouse, camera);
+            BeginMode2D(camera);
 
             switch(currentShape)
             {
@@ -505,13 +1355,57 @@ void Paint::Run()
                     HandleDrawEllipse(currentPos);
                     break;
 
+                case Shape::Erase:
+                    HandleErase(currentPos);
+                    break;
+
+                case Shape::Select:
+                    HandleSelect(currentPos);
+                    break;
+
                 default: {}
             }
+
+            EndMode2D();
         }
-        else if(IsMouseButtonReleased(MOUSE_BUTTON_LEFT))
+        else if(frameInput.mouseReleased)
         {
+            // A stroke is committed as a whole, even if the mouse ends up over the toolbar.
+            if(!strokeSimplifier.Empty())
+            {
+                const Vector2* points = strokeSimplifier.Points();
+                size_t count = strokeSimplifier.Count();
+                if(smooth)
+                {
+                    SmoothStroke(points, count, StrokeTolerance(thickness), strokePoints);
+                    points = strokePoints.data();
+                    count = strokePoints.size();
+                }
+
+                CommitShape(shapes.AddStroke(points, count, currentColor, thickness, activeLayer));
+
+                strokeSimplifier.Clear();
+                newDrawing = true;
+            }
+
+            if(currentShape == Shape::Erase)
+            {
+                if(!activeErase.changed.empty())
+                    history.Push(shapes, std::move(activeErase));
+
+                activeErase = Edit(EditKind::Erase);
+                newDrawing = true;
+            }
+
+            // Like a stroke, a drag ends wherever the mouse is let go.
+            if(currentShape == Shape::Select && !newDrawing)
+            {
+                FinishSelect(GetScreenToWorld2D(frameInput.mouse, camera));
+                newDrawing = true;
+            }
+
             // NASTY TRICK
-            Vector2 mousePos = GetMousePosition();
+            Vector2 mousePos = frameInput.mouse;
             if(mousePos.y <= toolbarPadding)
                 goto endRendering;
 
@@ -519,19 +1413,15 @@ void Paint::Run()
             {
                 case Shape::Rectangle:
                 {
-                    auto shape = new ShapeObject();
-                    shape->shapeKind = Shape::Rectangle;
-                    shape->shape = new Rect({
+                    CommitShape(shapes.Add(Rect(
                         lastBoundingBox.x,
                         lastBoundingBox.y,
                         lastBoundingBox.width,
                         lastBoundingBox.height,
                         currentColor,
                         thickness,
-                        filled,
-                    });
-
-                    shapes.push_back(shape);
+                        filled
+                    ), activeLayer));
 
                 } break;
 
@@ -548,18 +1438,13 @@ void Paint::Run()
                         lastBoundingBox.y + lastBoundingBox.height,
                     });
 
-                    auto shape = new ShapeObject();
-
-                    shape->shapeKind = Shape::Circle;
-                        shape->shape = new Circle(
+                    CommitShape(shapes.Add(Circle(
                         center,
                         radius,
                         currentColor,
                         thickness,
                         filled
-                    );
-
-                    shapes.push_back(shape);
+                    ), activeLayer));
                 } break;
 
                 case Shape::Ellipse:
@@ -580,50 +1465,41 @@ void Paint::Run()
                         center
                     );
 
-                    auto shape = new ShapeObject();
-                    shape->shapeKind = Shape::Ellipse;
-                    shape->shape = new Ellipse(
+                    CommitShape(shapes.Add(Ellipse(
                        center,
                        radiusH,
                        radiusV,
                        currentColor,
                        thickness,
                        filled
-                    );
-                    shapes.push_back(shape);
+                    ), activeLayer));
 
                 } break;
 
                 case Shape::Line:
                 {
-                    auto shape = new ShapeObject();
-
-                    shape->shapeKind = Shape::Line;
-                        shape->shape = new Line(
+                    CommitShape(shapes.Add(Line(
                        lineStart,
                        lineEnd,
                        currentColor,
                        thickness
-                    );
-
-                    shapes.push_back(shape);
+                    ), activeLayer));
                 } break;
 
                 case Shape::Triangle:
                 {
-                    auto shape = new ShapeObject();
-
-                    shape->shapeKind = Shape::Triangle;
-                        shape->shape = new Triangle(
+                    CommitShape(shapes.Add(Triangle(
                        lastTriangle.v1,
                        lastTriangle.v2,
                        lastTriangle.v3,
-                       currentColor, filled);
-
-                    shapes.push_back(shape);
+                       currentColor, filled), activeLayer));
 
                 } break;
 
+                case Shape::Fill:
+                    HandleFill(mousePos);
+                    break;
+
                 default: {}
             }
 
@@ -631,7 +1507,44 @@ void Paint::Run()
         }
 
 endRendering:
-        rlImGuiEnd();
-        EndDrawing();
+        {
+            ProfileZone zone(profiler, "Journal");
+            shapes.TakeChanges(changes);
+            journal.Record(shapes, changes);
+        }
+        if(publisher.IsOpen())
+        {
+            ProfileZone zone(profiler, "Mirror");
+            publisher.Publish(shapes, changes, CurrentLiveStroke());
+        }
+        UpdateIdle();
+        {
+            ProfileZone zone(profiler, "rlImGuiEnd");
+            rlImGuiEnd();
+        }
+        {
+            // Includes the wait for the target frame rate, or for input when idle.
+            ProfileZone zone(profiler, "EndDrawing");
+            EndDrawing();
+        }
+
+        CanvasStats canvasStats = canvas.Stats();
+        profiler.SetCounter(ProfileCounter::ShapesDrawn, canvasStats.shapesDrawn);
+        profiler.SetCounter(ProfileCounter::TilesRedrawn, canvasStats.tilesRedrawn);
+        profiler.SetCounter(ProfileCounter::DrawCalls, canvasStats.drawCalls);
+        profiler.SetCounter(ProfileCounter::ShapeBytes, (double)shapes.BytesUsed());
+        profiler.SetCounter(ProfileCounter::HistoryBytes, (double)history.BytesUsed());
+        profiler.SetCounter(ProfileCounter::TimelapseDropped, timelapse.DroppedFrames());
+        profiler.EndFrame();
+
+        if(replaying)
+        {
+            double elapsed = GetTime() - frameStart;
+            frameTimes.push_back((float)(elapsed*1000));
+            if(replayOptions.realtime && frameInput.frameTime > elapsed)
+                WaitTime(frameInput.frameTime - elapsed);
+        }
     }
+
+    return replaying ? FinishReplay() : 0;
 }
@@ -1,35 +1,46 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <raylib.h>
+#include <string>
 #include <vector>
+#include "canvas.hpp"
+#include "document.hpp"
+#include "flood_fill.hpp"
+#include "history.hpp"
+#include "image_export.hpp"
+#include "input.hpp"
+#include "journal.hpp"
+#include "mirror.hpp"
+#include "profiler.hpp"
+#include "reference_image.hpp"
+#include "render.hpp"
+#include "selection.hpp"
+#include "shape_store.hpp"
 #include "shapes.hpp"
+#include "stroke_simplify.hpp"
+#include "svg.hpp"
+#include "thread_pool.hpp"
+#include "timelapse.hpp"
 
 constexpr int WindowWidth = 950;
 constexpr int WindowHeight = 600;
 
 constexpr int FPS = 60;
-constexpr int toolbarPadding = 70;
-
-constexpr Color BackgroundColor = {34, 34, 27, 255};
 
-static int g_zIndex = 0;
+// Frames still drawn after the last input before the loop sleeps until the
+// next one. ImGui needs a couple to show what a click did.
+constexpr int IdleFrames = 3;
+constexpr int toolbarPadding = 70;
 
-enum class Shape
-{
-    FreeHand = 0,
-    Rectangle,
-    Circle,
-    Line,
-    Ellipse,
-    Triangle,
-    Erase,
-};
+constexpr const char* DefaultDocumentPath = "untitled.mypaint";
+// Zoom per mouse wheel notch, and the range the tile cache has levels for.
+constexpr float ZoomStep = 1.1f;
+constexpr float MinZoom = 1.0f/(1 << -MinZoomLevel);
+constexpr float MaxZoom = (float)(1 << MaxZoomLevel);
 
-struct ShapeObject
-{
-    Shape shapeKind;
-    void* shape;
-};
+constexpr const char* TracePath = "mypaint_trace.json";
 
 struct Paint
 {
@@ -42,13 +53,68 @@ public:
     void HandleDrawTriangle(Vector2 currentPos);
     void HandleDrawEllipse(Vector2 currentPos);
     void HandleDrawLine(Vector2 currentPos);
+    void HandleErase(Vector2 currentPos);
+    void HandleFill(Vector2 mouse);
+    void HandleSelect(Vector2 currentPos);
+    void FinishSelect(Vector2 currentPos);
+    // Picks up the journal instead when it is newer than the document,
+    // unless recover is false.
+    bool Open(const char* path, bool recover = true);
+    bool Save();
+    bool Export(ExportFormat format);
+    bool ExportSvg();
+    bool StartTimelapse();
+    bool StartPublishing(const char* address);
+    // The window only shows what the publisher at address draws.
+    void StartViewing(const char* address);
+    bool StartRecording(const char* path);
+    bool StartReplay(const char* path, ReplayOptions options);
     void RenderColorPicker();
     void RenderAll();
     void RenderUI();
-    void Run();
+    void RenderProfiler();
+    void RenderLayers();
+    void RenderViewerStatus();
+
+    // Returns the process exit code, non zero when a replay didn't match its
+    // golden image.
+    int Run();
 private:
-    std::vector<ShapeObject*> shapes;
-    std::vector<ShapeObject*> undoedShapes;
+    // Toolbar state as last written to the recording.
+    struct RecordedTools
+    {
+        bool valid = false;
+        Shape shape;
+        Color color;
+        int thickness;
+        bool filled;
+        bool smooth;
+        int fillTolerance;
+        uint8_t activeLayer;
+        Camera2D camera;
+    };
+
+    void CommitShape(ShapeHandle handle);
+    void ClearCanvas();
+    void UpdateCamera();
+    Image CaptureView();
+    void ApplyEvent(const InputEvent& event);
+    void RecordToolChanges();
+    void UpdateIdle();
+    void UpdateViewer();
+    LiveStroke CurrentLiveStroke() const;
+    int FinishReplay();
+
+    ShapeStore shapes;
+    History history;
+    Journal journal;
+    Edit activeErase;
+    Vector2 lastErasePoint;
+    std::vector<uint32_t> eraseCandidates;
+    TiledCanvas canvas;
+    Selection selection;
+    ReferenceImage reference;
+    Camera2D camera;
     bool newDrawing;
     Shape currentShape;
     float brushSize;
@@ -61,7 +127,36 @@ private:
     bool drawing;
     bool erasing;
     bool filled;
+    bool smooth;
     Rectangle lastBoundingBox;
     int thickness;
-    Vector2 lastFreeHandPoint;
+    int fillTolerance;
+    std::vector<FillSpan> fillSpans;
+    uint8_t activeLayer;
+    StrokeSimplifier strokeSimplifier;
+    std::vector<Vector2> strokePoints;
+    std::string documentPath;
+    ThreadPool workers;
+    ImageExport imageExport;
+    SvgImport svgImport;
+    Timelapse timelapse;
+    float timelapseInterval;
+    MirrorPublisher publisher;
+    MirrorViewer viewer;
+    bool viewing;
+    // What changed in shapes this frame, for the journal and the publisher.
+    ShapeChanges changes;
+    std::vector<ChangedArea> mirrorChanges;
+    FrameInput frameInput;
+    InputRecorder recorder;
+    RecordedTools recordedTools;
+    InputReplay replay;
+    ReplayOptions replayOptions;
+    bool replaying;
+    std::vector<float> frameTimes;
+    Profiler profiler;
+    bool showProfiler;
+    int framesToIdle;
+    bool waitingForEvents;
+    std::vector<float> profilerSamples;
 };
@@ -0,0 +1,326 @@
+#include "png_writer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+// sdefl is compiled into raylib already, but that copy only writes whole
+// streams. This one is renamed so bands can be ended without the final
+// block flag and stitched together.
+#define sdeflate PngSdeflate
+#define zsdeflate PngZsdeflate
+#define sdefl_bound PngSdeflBound
+#define SDEFL_IMPLEMENTATION
+#if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "external/sdefl.h"
+#if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+#endif
+
+// Filtered bytes per band. Smaller bands spread better over the cores but
+// lose the matches that would have crossed a band boundary.
+constexpr size_t PngBandBytes = 1024*1024;
+constexpr int PngCompressionLevel = SDEFL_LVL_DEF;
+
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t length)
+{
+    static const auto table = []()
+    {
+        std::unique_ptr<uint32_t[]> table(new uint32_t[256]);
+        for(uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Adler-32 of two buffers back to back from the checksums of each (zlib's
+// adler32_combine).
+static uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondLength)
+{
+    const uint32_t Base = 65521;
+    uint32_t remainder = (uint32_t)(secondLength % Base);
+    uint32_t sum1 = first & 0xFFFF;
+    uint32_t sum2 = (uint32_t)(((uint64_t)remainder*sum1) % Base);
+    sum1 += (second & 0xFFFF) + Base - 1;
+    sum2 += ((first >> 16) & 0xFFFF) + ((second >> 16) & 0xFFFF) + Base - remainder;
+    if(sum1 >= Base) sum1 -= Base;
+    if(sum1 >= Base) sum1 -= Base;
+    if(sum2 >= (Base << 1)) sum2 -= (Base << 1);
+    if(sum2 >= Base) sum2 -= Base;
+    return sum1 | (sum2 << 16);
+}
+
+static int FilterCost(const unsigned char* row, size_t length)
+{
+    int cost = 0;
+    for(size_t i = 0; i < length; i++)
+        cost += std::abs((int)(signed char)row[i]);
+    return cost;
+}
+
+static unsigned char Paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if(pa <= pb && pa <= pc) return (unsigned char)a;
+    if(pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+// Writes the filter type byte and the filtered row, trying the five PNG
+// filters and keeping the one with the smallest sum of absolute values.
+static void FilterRow(const unsigned char* row, const unsigned char* above, size_t length, unsigned char* out, unsigned char* scratch)
+{
+    constexpr size_t Bpp = 4;
+    int bestCost = FilterCost(row, length);
+    out[0] = 0;
+    std::memcpy(out + 1, row, length);
+
+    for(int type = 1; type <= 4; type++)
+    {
+        if(above == nullptr && type != 1) continue;
+
+        for(size_t i = 0; i < length; i++)
+        {
+            int left = i >= Bpp ? row[i - Bpp] : 0;
+            int up = above ? above[i] : 0;
+            int upLeft = (above && i >= Bpp) ? above[i - Bpp] : 0;
+
+            switch(type)
+            {
+                case 1: scratch[i] = (unsigned char)(row[i] - left); break;
+                case 2: scratch[i] = (unsigned char)(row[i] - up); break;
+                case 3: scratch[i] = (unsigned char)(row[i] - ((left + up) >> 1)); break;
+                default: scratch[i] = (unsigned char)(row[i] - Paeth(left, up, upLeft)); break;
+            }
+        }
+
+        int cost = FilterCost(scratch, length);
+        if(cost < bestCost)
+        {
+            bestCost = cost;
+            out[0] = (unsigned char)type;
+            std::memcpy(out + 1, scratch, length);
+        }
+    }
+}
+
+// sdefl_compr with the final block flag left to the caller. A band that is
+// not last ends with an empty stored block (a zlib sync flush) so the next
+// one starts on a byte boundary.
+static void DeflateBand(const unsigned char* in, int length, bool last, std::vector<unsigned char>& out)
+{
+    static const unsigned char pref[] = {8,10,14,24,30,48,65,96,130};
+    const int lvl = PngCompressionLevel;
+    const int maxChain = (lvl < 8) ? (1 << (lvl + 1)) : (1 << 13);
+
+    std::unique_ptr<sdefl> state = std::make_unique<sdefl>();
+    sdefl* s = state.get();
+    for(int n = 0; n < SDEFL_HASH_SIZ; ++n)
+        s->tbl[n] = SDEFL_NIL;
+
+    out.resize((size_t)sdefl_bound(length) + 8);
+    unsigned char* q = out.data();
+
+    int i = 0, litlen = 0;
+    do
+    {
+        int blkBegin = i;
+        int blkEnd = ((i + SDEFL_BLK_MAX) < length) ? (i + SDEFL_BLK_MAX) : length;
+        while(i < blkEnd)
+        {
+            struct sdefl_match m = {0, 0};
+            int left = blkEnd - i;
+            int maxMatch = (left > SDEFL_MAX_MATCH) ? SDEFL_MAX_MATCH : left;
+            int niceMatch = pref[lvl] < maxMatch ? pref[lvl] : maxMatch;
+            int run = 1, inc = 1, runInc = 0;
+            if(maxMatch > SDEFL_MIN_MATCH)
+                sdefl_fnd(&m, s, maxChain, maxMatch, in, i, length);
+
+            if(lvl >= 5 && m.len >= SDEFL_MIN_MATCH && m.len + 1 < niceMatch)
+            {
+                struct sdefl_match m2 = {0, 0};
+                sdefl_fnd(&m2, s, maxChain, m.len + 1, in, i + 1, length);
+                m.len = (m2.len > m.len) ? 0 : m.len;
+            }
+
+            if(m.len >= SDEFL_MIN_MATCH)
+            {
+                if(litlen)
+                {
+                    sdefl_seq(s, i - litlen, litlen);
+                    litlen = 0;
+                }
+                sdefl_seq(s, -m.off, m.len);
+                sdefl_reg_match(s, m.off, m.len);
+                if(lvl < 2 && m.len >= niceMatch)
+                    inc = m.len;
+                else
+                    run = m.len;
+            }
+            else
+            {
+                s->freq.lit[in[i]]++;
+                litlen++;
+            }
+
+            runInc = run*inc;
+            if(length - (i + runInc) > SDEFL_MIN_MATCH)
+            {
+                while(run-- > 0)
+                {
+                    unsigned h = sdefl_hash32(&in[i]);
+                    s->prv[i & SDEFL_WIN_MSK] = s->tbl[h];
+                    s->tbl[h] = i;
+                    i += inc;
+                }
+            }
+            else
+            {
+                i += runInc;
+            }
+        }
+
+        if(litlen)
+        {
+            sdefl_seq(s, i - litlen, litlen);
+            litlen = 0;
+        }
+        sdefl_flush(&q, s, last && blkEnd == length, in, blkBegin, blkEnd);
+    } while(i < length);
+
+    if(!last)
+    {
+        sdefl_put(&q, s, 0, 1);
+        sdefl_put(&q, s, 0, 2);
+    }
+    if(s->bitcnt)
+        sdefl_put(&q, s, 0, 8 - s->bitcnt);
+    if(!last)
+    {
+        sdefl_put16(&q, 0x0000);
+        sdefl_put16(&q, 0xFFFF);
+    }
+
+    out.resize((size_t)(q - out.data()));
+}
+
+static void AppendU32(std::vector<unsigned char>& out, uint32_t value)
+{
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+// Chunk length, type and CRC around data that is already in out.
+static void BeginChunk(std::vector<unsigned char>& out, const char* type, uint32_t length)
+{
+    AppendU32(out, length);
+    out.insert(out.end(), type, type + 4);
+}
+
+static void EndChunk(std::vector<unsigned char>& out, size_t typeOffset)
+{
+    AppendU32(out, Crc32(0, out.data() + typeOffset, out.size() - typeOffset));
+}
+
+bool EncodePng(const Image& image, bool bottomUp, ThreadPool& pool, std::atomic<float>& progress, std::vector<unsigned char>& out)
+{
+    if(image.data == nullptr || image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) return false;
+
+    const size_t width = (size_t)image.width;
+    const size_t height = (size_t)image.height;
+    const size_t rowBytes = width*4;
+    const size_t stride = rowBytes + 1;
+    const unsigned char* pixels = (const unsigned char*)image.data;
+
+    // sdefl counts in int, no band may get near that.
+    const size_t rowsPerBand = std::max<size_t>(1, PngBandBytes/stride);
+    const size_t bandCount = (height + rowsPerBand - 1)/rowsPerBand;
+    if(stride*rowsPerBand > (size_t)(INT32_MAX/2)) return false;
+
+    std::vector<unsigned char> filtered(stride*height);
+    std::vector<std::vector<unsigned char>> compressed(bandCount);
+    std::vector<uint32_t> adlers(bandCount);
+    std::atomic<size_t> bandsDone = 0;
+    progress = 0.0f;
+
+    auto sourceRow = [&](size_t y)
+    {
+        return pixels + (bottomUp ? height - 1 - y : y)*rowBytes;
+    };
+
+    pool.ParallelFor(bandCount, [&](size_t band)
+    {
+        size_t firstRow = band*rowsPerBand;
+        size_t lastRow = std::min(height, firstRow + rowsPerBand);
+        std::vector<unsigned char> scratch(rowBytes);
+
+        for(size_t y = firstRow; y < lastRow; y++)
+            FilterRow(sourceRow(y), y > 0 ? sourceRow(y - 1) : nullptr, rowBytes, filtered.data() + y*stride, scratch.data());
+
+        const unsigned char* bandData = filtered.data() + firstRow*stride;
+        int bandLength = (int)((lastRow - firstRow)*stride);
+        adlers[band] = sdefl_adler32(SDEFL_ADLER_INIT, bandData, bandLength);
+        DeflateBand(bandData, bandLength, band == bandCount - 1, compressed[band]);
+
+        progress = (float)++bandsDone/(float)bandCount;
+    });
+
+    size_t idatLength = 2 + 4;
+    uint32_t adler = SDEFL_ADLER_INIT;
+    for(size_t band = 0; band < bandCount; band++)
+    {
+        size_t firstRow = band*rowsPerBand;
+        size_t lastRow = std::min(height, firstRow + rowsPerBand);
+        adler = band == 0 ? adlers[0] : CombineAdler32(adler, adlers[band], (lastRow - firstRow)*stride);
+        idatLength += compressed[band].size();
+    }
+    if(idatLength > INT32_MAX) return false;
+
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    out.clear();
+    out.reserve(idatLength + 64);
+    out.insert(out.end(), signature, signature + 8);
+
+    BeginChunk(out, "IHDR", 13);
+    size_t typeOffset = out.size() - 4;
+    AppendU32(out, (uint32_t)width);
+    AppendU32(out, (uint32_t)height);
+    out.push_back(8);   // bits per channel
+    out.push_back(6);   // RGBA
+    out.push_back(0);
+    out.push_back(0);
+    out.push_back(0);
+    EndChunk(out, typeOffset);
+
+    BeginChunk(out, "IDAT", (uint32_t)idatLength);
+    typeOffset = out.size() - 4;
+    out.push_back(0x78);
+    out.push_back(0x01);
+    for(const auto& band: compressed)
+        out.insert(out.end(), band.begin(), band.end());
+    AppendU32(out, adler);
+    EndChunk(out, typeOffset);
+
+    BeginChunk(out, "IEND", 0);
+    EndChunk(out, out.size() - 4);
+
+    progress = 1.0f;
+    return true;
+}
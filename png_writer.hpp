@@ -0,0 +1,17 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <vector>
+#include "thread_pool.hpp"
+
+// Encodes an RGBA8 image as PNG. Row filtering and deflate run on the pool,
+// large images are cut into bands that are compressed independently and
+// joined into one zlib stream. bottomUp is for render texture read backs,
+// whose rows come out last to first. progress goes from 0 to 1.
+bool EncodePng(const Image& image, bool bottomUp, ThreadPool& pool, std::atomic<float>& progress, std::vector<unsigned char>& out);
+
+// CRC-32 of PNG chunks, zlib's crc32. Pass the previous result to continue a
+// checksum over several buffers, 0 to start one.
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t length);
@@ -0,0 +1,102 @@
+#include "process_stats.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+    #include <psapi.h>
+#elif defined(__APPLE__)
+    #include <mach/mach.h>
+    #include <sys/resource.h>
+#else
+    #include <cstdio>
+    #include <sys/resource.h>
+    #include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+size_t CurrentResidentBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters {};
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+}
+
+size_t PeakResidentBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters {};
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+}
+
+#elif defined(__APPLE__)
+
+size_t CurrentResidentBytes()
+{
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return info.resident_size;
+}
+
+size_t PeakResidentBytes()
+{
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss;
+}
+
+#else
+
+size_t CurrentResidentBytes()
+{
+    std::FILE* file = std::fopen("/proc/self/statm", "r");
+    if(file == nullptr) return 0;
+
+    unsigned long long pages = 0, resident = 0;
+    int read = std::fscanf(file, "%llu %llu", &pages, &resident);
+    std::fclose(file);
+    return read == 2 ? (size_t)resident*(size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+size_t PeakResidentBytes()
+{
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss*1024;
+}
+
+#endif
+
+static std::atomic<uint64_t> g_allocations = 0;
+static std::atomic<uint64_t> g_allocatedBytes = 0;
+static std::atomic<uint64_t> g_deallocations = 0;
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept
+{
+    if(p == nullptr) return;
+    g_deallocations.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+uint64_t AllocationCount() { return g_allocations.load(std::memory_order_relaxed); }
+uint64_t AllocatedBytes() { return g_allocatedBytes.load(std::memory_order_relaxed); }
+uint64_t LiveAllocations() { return AllocationCount() - g_deallocations.load(std::memory_order_relaxed); }
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Resident memory of this process in bytes, 0 where the platform doesn't say.
+// Its own translation unit for the same reason as MappedFile.
+size_t CurrentResidentBytes();
+size_t PeakResidentBytes();
+
+// Calls to the global operator new since startup, the bytes they asked for, and
+// how many of them were not deleted yet. Allocations raylib and ImGui make with
+// malloc are not seen.
+uint64_t AllocationCount();
+uint64_t AllocatedBytes();
+uint64_t LiveAllocations();
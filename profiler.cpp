@@ -0,0 +1,151 @@
+#include "profiler.hpp"
+#include "process_stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <raylib.h>
+#include <string>
+
+// Reading the resident size is a system call, it doesn't move fast enough to
+// be worth one every frame.
+constexpr uint64_t ResidentSampleInterval = 30;
+
+const char* CounterName(ProfileCounter counter)
+{
+    switch(counter)
+    {
+        case ProfileCounter::ShapesDrawn: return "Shapes drawn";
+        case ProfileCounter::TilesRedrawn: return "Tiles redrawn";
+        case ProfileCounter::DrawCalls: return "Draw calls";
+        case ProfileCounter::Allocations: return "Allocations";
+        case ProfileCounter::LiveAllocations: return "Live allocations";
+        case ProfileCounter::ShapeBytes: return "Shape bytes";
+        case ProfileCounter::HistoryBytes: return "History bytes";
+        case ProfileCounter::ResidentBytes: return "Resident bytes";
+        case ProfileCounter::TimelapseDropped: return "Timelapse dropped";
+        default: return "";
+    }
+}
+
+Profiler::Profiler()
+    : epoch(std::chrono::steady_clock::now()),
+      frames(ProfilerFrames)
+{
+}
+
+double Profiler::Now() const
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::BeginFrame()
+{
+    ProfileFrame& frame = frames[next];
+    frame.zones.clear();
+    openZones.clear();
+
+    // Counters nobody sets this frame keep their last value.
+    if(count > 0)
+        std::copy(std::begin(Frame(count - 1).counters), std::end(Frame(count - 1).counters), frame.counters);
+
+    frame.start = Now();
+    frameAllocations = AllocationCount();
+    inFrame = true;
+}
+
+void Profiler::EndFrame()
+{
+    if(!inFrame) return;
+
+    ProfileFrame& frame = frames[next];
+    frame.duration = Now() - frame.start;
+    frame.counters[(size_t)ProfileCounter::Allocations] = (double)(AllocationCount() - frameAllocations);
+    frame.counters[(size_t)ProfileCounter::LiveAllocations] = (double)LiveAllocations();
+    if(frameNumber%ResidentSampleInterval == 0)
+        frame.counters[(size_t)ProfileCounter::ResidentBytes] = (double)CurrentResidentBytes();
+
+    next = (next + 1)%ProfilerFrames;
+    count = std::min(count + 1, ProfilerFrames);
+    frameNumber++;
+    inFrame = false;
+}
+
+void Profiler::BeginZone(const char* name)
+{
+    if(!inFrame) return;
+
+    std::vector<ProfileZoneRecord>& zones = frames[next].zones;
+    openZones.push_back(zones.size());
+    zones.push_back({ name, (uint32_t)(openZones.size() - 1), Now(), 0 });
+}
+
+void Profiler::EndZone()
+{
+    if(!inFrame || openZones.empty()) return;
+
+    ProfileZoneRecord& zone = frames[next].zones[openZones.back()];
+    zone.duration = Now() - zone.start;
+    openZones.pop_back();
+}
+
+void Profiler::SetCounter(ProfileCounter counter, double value)
+{
+    frames[next].counters[(size_t)counter] = value;
+}
+
+const ProfileFrame& Profiler::Frame(size_t i) const
+{
+    return frames[(next + ProfilerFrames - count + i)%ProfilerFrames];
+}
+
+void Profiler::ZoneHistory(const char* name, std::vector<float>& milliseconds) const
+{
+    milliseconds.assign(count, 0.0f);
+    for(size_t i = 0; i < count; i++)
+    {
+        for(const ProfileZoneRecord& zone: Frame(i).zones)
+        {
+            if(std::strcmp(zone.name, name) == 0)
+                milliseconds[i] += (float)(zone.duration/1000);
+        }
+    }
+}
+
+bool Profiler::WriteTrace(const char* path) const
+{
+    std::string json = "{\"traceEvents\":[\n";
+    char line[256];
+    bool first = true;
+    auto append = [&](int length)
+    {
+        if(!first) json += ",\n";
+        json.append(line, (size_t)std::max(0, std::min(length, (int)sizeof(line) - 1)));
+        first = false;
+    };
+
+    for(size_t i = 0; i < count; i++)
+    {
+        const ProfileFrame& frame = Frame(i);
+        append(std::snprintf(line, sizeof(line),
+            "{\"name\":\"Frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+            frame.start, frame.duration));
+
+        for(const ProfileZoneRecord& zone: frame.zones)
+        {
+            append(std::snprintf(line, sizeof(line),
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                zone.name, zone.start, zone.duration));
+        }
+
+        // One track per counter, their scales are too far apart to share one.
+        for(size_t c = 0; c < (size_t)ProfileCounter::Count; c++)
+        {
+            append(std::snprintf(line, sizeof(line),
+                "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%.0f}}",
+                CounterName((ProfileCounter)c), frame.start, frame.counters[c]));
+        }
+    }
+
+    json += "\n]}\n";
+    return SaveFileText(path, json.data());
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Frames kept for the graphs and the trace dump, 4 seconds at 60 FPS.
+constexpr size_t ProfilerFrames = 240;
+
+enum class ProfileCounter
+{
+    ShapesDrawn = 0,
+    TilesRedrawn,
+    DrawCalls,
+    Allocations,        // made during the frame
+    LiveAllocations,
+    ShapeBytes,
+    HistoryBytes,
+    ResidentBytes,
+    TimelapseDropped,   // samples the encoder was too far behind for
+    Count,
+};
+
+const char* CounterName(ProfileCounter counter);
+
+struct ProfileZoneRecord
+{
+    const char* name;
+    uint32_t depth;
+
+    // Microseconds, start is relative to when the profiler was created.
+    double start;
+    double duration;
+};
+
+struct ProfileFrame
+{
+    double start = 0;
+    double duration = 0;
+    std::vector<ProfileZoneRecord> zones;
+    double counters[(size_t)ProfileCounter::Count] = {};
+
+    double Counter(ProfileCounter counter) const { return counters[(size_t)counter]; }
+};
+
+// Nested timing zones and counters of the frame loop. The last ProfilerFrames
+// frames are kept in a ring so a slow frame can still be looked at, or dumped
+// as a Chrome trace, after it happened. Zone names are stored by pointer and
+// must outlive the profiler, string literals in practice.
+class Profiler
+{
+public:
+    Profiler();
+
+    void BeginFrame();
+    void EndFrame();
+    void BeginZone(const char* name);
+    void EndZone();
+    void SetCounter(ProfileCounter counter, double value);
+
+    // Finished frames kept, index 0 is the oldest one.
+    size_t FrameCount() const { return count; }
+    const ProfileFrame& Frame(size_t i) const;
+    uint64_t FrameNumber() const { return frameNumber; }
+
+    // Total time of every zone with this name in each kept frame, oldest first.
+    void ZoneHistory(const char* name, std::vector<float>& milliseconds) const;
+
+    // The kept frames in the Chrome trace event format, for chrome://tracing
+    // or Perfetto.
+    bool WriteTrace(const char* path) const;
+
+private:
+    double Now() const;
+
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<ProfileFrame> frames;
+    size_t next = 0;
+    size_t count = 0;
+    uint64_t frameNumber = 0;
+    uint64_t frameAllocations = 0;
+    std::vector<size_t> openZones;
+    bool inFrame = false;
+};
+
+// Times the enclosing scope.
+class ProfileZone
+{
+public:
+    ProfileZone(Profiler& profiler, const char* name) : profiler(profiler) { profiler.BeginZone(name); }
+    ~ProfileZone() { profiler.EndZone(); }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    Profiler& profiler;
+};
@@ -0,0 +1,630 @@
+#include "raster.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RASTER_SSE2
+    #include <emmintrin.h>
+#endif
+
+// Four adjacent pixels of one row. The distance functions below are written
+// once against this type and run on SSE2 where available.
+#if defined(RASTER_SSE2)
+
+struct F4
+{
+    __m128 v;
+
+    F4() = default;
+    F4(__m128 v) : v(v) {}
+    F4(float s) : v(_mm_set1_ps(s)) {}
+
+    static F4 Load(const float* p) { return _mm_loadu_ps(p); }
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+    static F4 Ramp(float first) { return _mm_setr_ps(first, first + 1, first + 2, first + 3); }
+};
+
+inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+inline F4 operator/(F4 a, F4 b) { return _mm_div_ps(a.v, b.v); }
+inline F4 Min(F4 a, F4 b) { return _mm_min_ps(a.v, b.v); }
+inline F4 Max(F4 a, F4 b) { return _mm_max_ps(a.v, b.v); }
+inline F4 Sqrt(F4 a) { return _mm_sqrt_ps(a.v); }
+inline F4 Abs(F4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+// -a where sign < 0, a elsewhere.
+inline F4 CopySignOf(F4 a, F4 sign) { return _mm_xor_ps(a.v, _mm_and_ps(sign.v, _mm_set1_ps(-0.0f))); }
+
+#else
+
+struct F4
+{
+    float v[4];
+
+    F4() = default;
+    F4(float s) : v{s, s, s, s} {}
+
+    static F4 Load(const float* p) { F4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+    void Store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+    static F4 Ramp(float first) { F4 r; for(int i = 0; i < 4; i++) r.v[i] = first + i; return r; }
+};
+
+template<typename Op>
+inline F4 Lanes(F4 a, F4 b, Op op) { F4 r; for(int i = 0; i < 4; i++) r.v[i] = op(a.v[i], b.v[i]); return r; }
+
+inline F4 operator+(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return x + y; }); }
+inline F4 operator-(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return x - y; }); }
+inline F4 operator*(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return x*y; }); }
+inline F4 operator/(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return x/y; }); }
+inline F4 Min(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline F4 Max(F4 a, F4 b) { return Lanes(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline F4 Sqrt(F4 a) { return Lanes(a, a, [](float x, float) { return std::sqrt(x); }); }
+inline F4 Abs(F4 a) { return Lanes(a, a, [](float x, float) { return std::fabs(x); }); }
+inline F4 CopySignOf(F4 a, F4 sign) { return Lanes(a, sign, [](float x, float s) { return std::signbit(s) ? -x : x; }); }
+
+#endif
+
+inline F4 Clamp01(F4 a) { return Min(Max(a, 0.0f), 1.0f); }
+
+// Points per precomputed bounding box of a stroke, so a tile only walks the
+// segments near it.
+constexpr int StrokeChunkPoints = 64;
+
+constexpr float FarAway = 1e30f;
+
+// Pixel box [x0, x1) x [y0, y1) in tile coordinates.
+struct PixelBox
+{
+    int x0, y0, x1, y1;
+
+    bool Empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+// Per thread scratch: the signed distance of every pixel of the tile to the
+// shape being drawn, in pixels, and the premultiplied RGBA of a layer that
+// can't be drawn straight onto the tile.
+struct TileScratch
+{
+    float distance[RasterTileSize*RasterTileSize];
+    float coverage[RasterTileSize];
+    float layer[RasterTileSize*RasterTileSize*4];
+    std::vector<uint32_t> visible;
+};
+
+struct TileContext
+{
+    const ShapeStore& shapes;
+    Rectangle view;
+    float scale;
+    Vector2 offset;
+    const std::unordered_map<uint32_t, uint32_t>& strokeChunks;
+    const std::vector<Rectangle>& chunkBounds;
+
+    int originX, originY;
+    int width, height;
+    unsigned char* pixels;
+    int stride;
+    TileScratch& scratch;
+
+    // Pixels whose distance was written for the current shape.
+    PixelBox touched;
+
+    // Where shapes are blended, the tile itself when null.
+    float* layerPixels = nullptr;
+
+    Vector2 ToPixels(Vector2 point) const
+    {
+        return { (point.x - view.x)*scale + offset.x - originX, (point.y - view.y)*scale + offset.y - originY };
+    }
+
+    PixelBox BoxOf(float minX, float minY, float maxX, float maxY) const
+    {
+        return {
+            std::max(0, (int)std::floor(minX)),
+            std::max(0, (int)std::floor(minY)),
+            std::min(width, (int)std::ceil(maxX) + 1),
+            std::min(height, (int)std::ceil(maxY) + 1),
+        };
+    }
+};
+
+// Calls fn(x, y) with the centers of four pixels at a time over box and keeps
+// the smallest distance per pixel. Lanes past the edges of box get their real
+// distance too, box is only widened to whole groups of four.
+template<typename F>
+static void AccumulateDistance(TileContext& tile, PixelBox box, F&& fn)
+{
+    if(box.Empty()) return;
+
+    int firstX = box.x0 & ~3;
+    int lastX = std::min(RasterTileSize, (box.x1 + 3) & ~3);
+    tile.touched = {
+        std::min(tile.touched.x0, firstX),
+        std::min(tile.touched.y0, box.y0),
+        std::max(tile.touched.x1, lastX),
+        std::max(tile.touched.y1, box.y1),
+    };
+
+    for(int y = box.y0; y < box.y1; y++)
+    {
+        float* row = tile.scratch.distance + y*RasterTileSize;
+        F4 py = (float)y + 0.5f;
+        for(int x = firstX; x < box.x1; x += 4)
+        {
+            F4 distance = fn(F4::Ramp((float)x + 0.5f), py);
+            Min(F4::Load(row + x), distance).Store(row + x);
+        }
+    }
+}
+
+static void Capsule(TileContext& tile, Vector2 a, Vector2 b, float radius)
+{
+    PixelBox box = tile.BoxOf(
+        std::min(a.x, b.x) - radius - 1, std::min(a.y, b.y) - radius - 1,
+        std::max(a.x, b.x) + radius + 1, std::max(a.y, b.y) + radius + 1
+    );
+
+    float baX = b.x - a.x, baY = b.y - a.y;
+    float lengthSquared = baX*baX + baY*baY;
+    float inverse = lengthSquared > 0 ? 1.0f/lengthSquared : 0.0f;
+
+    AccumulateDistance(tile, box, [&](F4 x, F4 y)
+    {
+        F4 paX = x - a.x, paY = y - a.y;
+        F4 h = Clamp01((paX*baX + paY*baY)*inverse);
+        F4 dx = paX - h*baX, dy = paY - h*baY;
+        return Sqrt(dx*dx + dy*dy) - radius;
+    });
+}
+
+// Box of half extents (halfLength, halfWidth) around center, its long side
+// along the unit vector axis. A band > 0 only keeps that much of the inside
+// along the border.
+static void OrientedBox(TileContext& tile, Vector2 center, Vector2 axis, float halfLength, float halfWidth, float band)
+{
+    float reach = std::fabs(axis.x)*halfLength + std::fabs(axis.y)*halfWidth + 1;
+    float reachY = std::fabs(axis.y)*halfLength + std::fabs(axis.x)*halfWidth + 1;
+    PixelBox box = tile.BoxOf(center.x - reach, center.y - reachY, center.x + reach, center.y + reachY);
+
+    AccumulateDistance(tile, box, [&](F4 x, F4 y)
+    {
+        F4 px = x - center.x, py = y - center.y;
+        F4 qx = Abs(px*axis.x + py*axis.y) - halfLength;
+        F4 qy = Abs(py*axis.x - px*axis.y) - halfWidth;
+        F4 ox = Max(qx, 0.0f), oy = Max(qy, 0.0f);
+        F4 distance = Sqrt(ox*ox + oy*oy) + Min(Max(qx, qy), 0.0f);
+        if(band > 0)
+            distance = Max(distance, F4(0.0f) - distance - band);
+        return distance;
+    });
+}
+
+static void Ring(TileContext& tile, Vector2 center, float inner, float outer)
+{
+    PixelBox box = tile.BoxOf(center.x - outer - 1, center.y - outer - 1, center.x + outer + 1, center.y + outer + 1);
+
+    AccumulateDistance(tile, box, [&](F4 x, F4 y)
+    {
+        F4 dx = x - center.x, dy = y - center.y;
+        F4 length = Sqrt(dx*dx + dy*dy);
+        return Max(length - outer, F4(inner) - length);
+    });
+}
+
+// Distance to an ellipse from the first order approximation f/|grad f|, good
+// to a fraction of a pixel near the edge, which is all coverage needs.
+static void EllipseShape(TileContext& tile, Vector2 center, float radiusX, float radiusY, float rotation, float halfLine)
+{
+    radiusX = std::max(radiusX, 1e-3f);
+    radiusY = std::max(radiusY, 1e-3f);
+    float c = std::cos(rotation), s = std::sin(rotation);
+    float extentX = std::hypot(radiusX*c, radiusY*s) + halfLine + 1;
+    float extentY = std::hypot(radiusX*s, radiusY*c) + halfLine + 1;
+    PixelBox box = tile.BoxOf(center.x - extentX, center.y - extentY, center.x + extentX, center.y + extentY);
+
+    float inverseX = 1.0f/radiusX, inverseY = 1.0f/radiusY;
+    AccumulateDistance(tile, box, [&](F4 x, F4 y)
+    {
+        F4 px = x - center.x, py = y - center.y;
+        F4 nx = (px*c + py*s)*inverseX, ny = (py*c - px*s)*inverseY;
+        F4 k0 = Sqrt(nx*nx + ny*ny);
+        F4 gx = nx*inverseX, gy = ny*inverseY;
+        F4 k1 = Max(Sqrt(gx*gx + gy*gy), 1e-6f);
+        F4 distance = k0*(k0 - 1.0f)/k1;
+        if(halfLine > 0)
+            distance = Abs(distance) - halfLine;
+        return distance;
+    });
+}
+
+static void TriangleShape(TileContext& tile, Vector2 p0, Vector2 p1, Vector2 p2)
+{
+    float orientation = (p1.x - p0.x)*(p0.y - p2.y) - (p1.y - p0.y)*(p0.x - p2.x);
+    if(orientation == 0) return;
+    float sign = orientation > 0 ? 1.0f : -1.0f;
+
+    PixelBox box = tile.BoxOf(
+        std::min({p0.x, p1.x, p2.x}) - 1, std::min({p0.y, p1.y, p2.y}) - 1,
+        std::max({p0.x, p1.x, p2.x}) + 1, std::max({p0.y, p1.y, p2.y}) + 1
+    );
+
+    const Vector2 vertices[3] = { p0, p1, p2 };
+    AccumulateDistance(tile, box, [&](F4 x, F4 y)
+    {
+        F4 nearest = FarAway;
+        F4 inside = FarAway;
+        for(int i = 0; i < 3; i++)
+        {
+            Vector2 a = vertices[i], b = vertices[(i + 1)%3];
+            float ex = b.x - a.x, ey = b.y - a.y;
+            float inverse = 1.0f/(ex*ex + ey*ey);
+
+            F4 vx = x - a.x, vy = y - a.y;
+            F4 h = Clamp01((vx*ex + vy*ey)*inverse);
+            F4 dx = vx - h*ex, dy = vy - h*ey;
+            nearest = Min(nearest, dx*dx + dy*dy);
+            inside = Min(inside, (vx*ey - vy*ex)*sign);
+        }
+
+        // inside stays positive only when the pixel is on the inner side of all edges.
+        return CopySignOf(Sqrt(nearest), F4(0.0f) - inside);
+    });
+}
+
+// Lines drawn by the GPU path with GL lines are one canvas pixel wide.
+static float HairlineRadius(const TileContext& tile) { return 0.5f*tile.scale; }
+
+static void ShapeDistance(TileContext& tile, uint32_t position, ShapeHandle handle)
+{
+    const ShapeStore& shapes = tile.shapes;
+    float scale = tile.scale;
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = shapes.Get<Rect>(handle);
+            Vector2 center = tile.ToPixels(rect.Center());
+            float band = rect.filled ? 0.0f : std::max(rect.thickness*scale, 0.0f);
+            Vector2 axis = { std::cos(rect.rotation), std::sin(rect.rotation) };
+            OrientedBox(tile, center, axis, std::fabs(rect.width)*scale/2, std::fabs(rect.height)*scale/2, band);
+        } break;
+
+        case Shape::Circle:
+        {
+            const Circle& circle = shapes.Get<Circle>(handle);
+            Vector2 center = tile.ToPixels(circle.center);
+            float radius = circle.radius*scale;
+            if(circle.filled)
+                Ring(tile, center, -FarAway, radius);
+            else
+                Ring(tile, center, radius, radius + circle.thickness*scale);
+        } break;
+
+        case Shape::Line:
+        {
+            const Line& line = shapes.Get<Line>(handle);
+            Vector2 a = tile.ToPixels(line.start);
+            Vector2 b = tile.ToPixels(line.end);
+            float dx = b.x - a.x, dy = b.y - a.y;
+            float length = std::sqrt(dx*dx + dy*dy);
+            if(length == 0) break;
+
+            Vector2 center = { (a.x + b.x)/2, (a.y + b.y)/2 };
+            OrientedBox(tile, center, { dx/length, dy/length }, length/2, line.thickness*scale/2, 0);
+        } break;
+
+        case Shape::Ellipse:
+        {
+            const Ellipse& ellipse = shapes.Get<Ellipse>(handle);
+            EllipseShape(tile, tile.ToPixels(ellipse.center), ellipse.radiusH*scale, ellipse.radiusV*scale, ellipse.rotation, ellipse.filled ? 0.0f : HairlineRadius(tile));
+        } break;
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = shapes.Get<Triangle>(handle);
+            Vector2 v1 = tile.ToPixels(triangle.v1);
+            Vector2 v2 = tile.ToPixels(triangle.v2);
+            Vector2 v3 = tile.ToPixels(triangle.v3);
+            if(triangle.filled)
+            {
+                TriangleShape(tile, v1, v2, v3);
+            }
+            else
+            {
+                float radius = HairlineRadius(tile);
+                Capsule(tile, v1, v2, radius);
+                Capsule(tile, v2, v3, radius);
+                Capsule(tile, v3, v1, radius);
+            }
+        } break;
+
+        case Shape::FreeHand:
+        {
+            const Stroke& stroke = shapes.Get<Stroke>(handle);
+            const Vector2* points = shapes.StrokePoints(stroke);
+            float radius = stroke.thickness*scale;
+            if(radius <= 0) break;
+
+            auto chunks = tile.strokeChunks.find(position);
+            if(chunks == tile.strokeChunks.end()) break;
+
+            Rectangle tileArea = { 0, 0, (float)tile.width, (float)tile.height };
+            uint32_t firstChunk = chunks->second;
+            for(uint32_t first = 0; first < stroke.pointCount; first += StrokeChunkPoints)
+            {
+                Rectangle bounds = tile.chunkBounds[firstChunk + first/StrokeChunkPoints];
+                bounds.x -= tile.originX;
+                bounds.y -= tile.originY;
+                if(!CheckCollisionRecs(bounds, tileArea)) continue;
+
+                // Chunks overlap by one point so no segment is lost at the seams.
+                uint32_t last = std::min(stroke.pointCount, first + StrokeChunkPoints + 1);
+                for(uint32_t i = first; i < last; i++)
+                {
+                    if(IsStrokeBreak(points[i])) continue;
+
+                    bool joined = i + 1 < last && !IsStrokeBreak(points[i + 1]);
+                    bool alone = (i == 0 || IsStrokeBreak(points[i - 1])) && !joined;
+                    if(joined)
+                        Capsule(tile, tile.ToPixels(points[i]), tile.ToPixels(points[i + 1]), radius);
+                    else if(alone)
+                        Capsule(tile, tile.ToPixels(points[i]), tile.ToPixels(points[i]), radius);
+                }
+            }
+        } break;
+
+        case Shape::Fill:
+        {
+            // Spans outside the tile end up with an empty pixel box.
+            const Fill& fill = shapes.Get<Fill>(handle);
+            const FillSpan* spans = shapes.FillSpans(fill);
+            float cell = fill.cellSize*scale;
+            for(uint32_t i = 0; i < fill.spanCount; i++)
+            {
+                Vector2 corner = tile.ToPixels({ fill.origin.x + spans[i].x*fill.cellSize, fill.origin.y + spans[i].y*fill.cellSize });
+                float halfWidth = spans[i].width*cell/2, halfHeight = spans[i].height*cell/2;
+                OrientedBox(tile, { corner.x + halfWidth, corner.y + halfHeight }, { 1, 0 }, halfWidth, halfHeight, 0);
+            }
+        } break;
+
+        default: {}
+    }
+}
+
+static Color ShapeColor(const ShapeStore& shapes, ShapeHandle handle)
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: return shapes.Get<Rect>(handle).color;
+        case Shape::Circle: return shapes.Get<Circle>(handle).color;
+        case Shape::Line: return shapes.Get<Line>(handle).color;
+        case Shape::Ellipse: return shapes.Get<Ellipse>(handle).color;
+        case Shape::Triangle: return shapes.Get<Triangle>(handle).color;
+        case Shape::FreeHand: return shapes.Get<Stroke>(handle).color;
+        case Shape::Fill: return shapes.Get<Fill>(handle).color;
+        default: return BLANK;
+    }
+}
+
+// Blends the shape over the tile where its distance is under half a pixel,
+// then resets the distances it used for the next shape.
+static void Composite(TileContext& tile, Color color)
+{
+    PixelBox box = tile.touched;
+    box.x1 = std::min(box.x1, tile.width);
+    float alpha = color.a/255.0f;
+
+    for(int y = box.y0; y < box.y1; y++)
+    {
+        float* distance = tile.scratch.distance + y*RasterTileSize;
+        float* coverage = tile.scratch.coverage;
+        for(int x = box.x0; x < tile.touched.x1; x += 4)
+        {
+            (Clamp01(F4(0.5f) - F4::Load(distance + x))*alpha).Store(coverage + x);
+            F4(FarAway).Store(distance + x);
+        }
+
+        if(tile.layerPixels != nullptr)
+        {
+            float* pixel = tile.layerPixels + ((size_t)y*RasterTileSize + box.x0)*4;
+            for(int x = box.x0; x < box.x1; x++, pixel += 4)
+            {
+                float a = coverage[x];
+                if(a <= 0) continue;
+
+                pixel[0] += (color.r/255.0f - pixel[0])*a;
+                pixel[1] += (color.g/255.0f - pixel[1])*a;
+                pixel[2] += (color.b/255.0f - pixel[2])*a;
+                pixel[3] += (1 - pixel[3])*a;
+            }
+            continue;
+        }
+
+        unsigned char* pixel = tile.pixels + (size_t)y*tile.stride + (size_t)box.x0*4;
+        for(int x = box.x0; x < box.x1; x++, pixel += 4)
+        {
+            float a = coverage[x];
+            if(a <= 0) continue;
+
+            pixel[0] = (unsigned char)(pixel[0] + (color.r - pixel[0])*a + 0.5f);
+            pixel[1] = (unsigned char)(pixel[1] + (color.g - pixel[1])*a + 0.5f);
+            pixel[2] = (unsigned char)(pixel[2] + (color.b - pixel[2])*a + 0.5f);
+        }
+    }
+}
+
+// Same formulas as the blend factors of BeginLayerBlend, over an opaque tile.
+static void BlendLayer(TileContext& tile, const Layer& layer)
+{
+    for(int y = 0; y < tile.height; y++)
+    {
+        const float* source = tile.scratch.layer + (size_t)y*RasterTileSize*4;
+        unsigned char* pixel = tile.pixels + (size_t)y*tile.stride;
+        for(int x = 0; x < tile.width; x++, source += 4, pixel += 4)
+        {
+            float alpha = source[3]*layer.opacity;
+            if(alpha <= 0) continue;
+
+            for(int channel = 0; channel < 3; channel++)
+            {
+                float s = source[channel]*layer.opacity;
+                float d = pixel[channel]/255.0f;
+                switch(layer.blend)
+                {
+                    case LayerBlend::Multiply: d = s*d + d*(1 - alpha); break;
+                    case LayerBlend::Add: d = std::min(1.0f, s + d); break;
+                    case LayerBlend::Screen: d = s + d*(1 - s); break;
+                    default: d = s + d*(1 - alpha); break;
+                }
+                pixel[channel] = (unsigned char)(d*255 + 0.5f);
+            }
+        }
+    }
+}
+
+static void RasterizeTile(TileContext& tile)
+{
+    std::fill_n(tile.scratch.distance, RasterTileSize*RasterTileSize, FarAway);
+
+    // The tile in document units, one pixel wider for anti-aliasing.
+    float inverse = 1.0f/tile.scale;
+    Rectangle area = {
+        tile.view.x + (tile.originX - tile.offset.x - 1)*inverse,
+        tile.view.y + (tile.originY - tile.offset.y - 1)*inverse,
+        (tile.width + 2)*inverse,
+        (tile.height + 2)*inverse,
+    };
+
+    std::vector<uint32_t>& visible = tile.scratch.visible;
+    for(const Layer& layer: tile.shapes.Layers())
+    {
+        if(!layer.visible) continue;
+
+        visible.clear();
+        tile.shapes.Query(area, layer.id, visible);
+        if(visible.empty()) continue;
+
+        // Plain layers go straight onto the tile, the others are drawn apart
+        // and blended as a whole like the GPU does.
+        bool direct = layer.blend == LayerBlend::Normal && layer.opacity >= 1;
+        tile.layerPixels = direct ? nullptr : tile.scratch.layer;
+        if(!direct)
+            std::fill_n(tile.scratch.layer, RasterTileSize*RasterTileSize*4, 0.0f);
+
+        for(uint32_t position: visible)
+        {
+            ShapeHandle handle = tile.shapes[position];
+            tile.touched = { RasterTileSize, RasterTileSize, 0, 0 };
+            ShapeDistance(tile, position, handle);
+            if(!tile.touched.Empty())
+                Composite(tile, ShapeColor(tile.shapes, handle));
+        }
+
+        if(!direct)
+            BlendLayer(tile, layer);
+    }
+}
+
+Image RasterizeShapes(const ShapeStore& shapes, Rectangle view, int width, int height, Color background, ThreadPool& pool)
+{
+    Image image = {};
+    if(width <= 0 || height <= 0 || view.width <= 0 || view.height <= 0) return image;
+
+    // MemAlloc takes an unsigned int and raylib sizes images in int, so
+    // anything bigger than that can't be an Image at all.
+    if((size_t)width*height*4 > INT_MAX) return image;
+
+    image.data = MemAlloc((unsigned int)((size_t)width*height*4));
+    if(image.data == nullptr) return image;
+
+    image.width = width;
+    image.height = height;
+    image.mipmaps = 1;
+    image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+    float scale = std::min(width/view.width, height/view.height);
+    Vector2 offset = { (width - view.width*scale)/2, (height - view.height*scale)/2 };
+
+    // Bounding boxes of every StrokeChunkPoints points of the strokes the
+    // tiles can find, in output pixels and padded by the brush radius. The
+    // tiles cover the letterbox margins too, and query one pixel wider.
+    float inverse = 1.0f/scale;
+    Rectangle output = {
+        view.x - (offset.x + 1)*inverse,
+        view.y - (offset.y + 1)*inverse,
+        (width + 2)*inverse,
+        (height + 2)*inverse,
+    };
+
+    std::unordered_map<uint32_t, uint32_t> strokeChunks;
+    std::vector<Rectangle> chunkBounds;
+    std::vector<uint32_t> inView;
+    shapes.Query(output, inView);
+    for(uint32_t position: inView)
+    {
+        ShapeHandle handle = shapes[position];
+        if(handle.Kind() != Shape::FreeHand) continue;
+
+        const Stroke& stroke = shapes.Get<Stroke>(handle);
+        const Vector2* points = shapes.StrokePoints(stroke);
+        float padding = stroke.thickness*scale + 2;
+        strokeChunks[position] = (uint32_t)chunkBounds.size();
+
+        for(uint32_t first = 0; first < stroke.pointCount; first += StrokeChunkPoints)
+        {
+            uint32_t last = std::min(stroke.pointCount, first + StrokeChunkPoints + 1);
+            float minX = FarAway, minY = FarAway, maxX = -FarAway, maxY = -FarAway;
+            for(uint32_t i = first; i < last; i++)
+            {
+                if(IsStrokeBreak(points[i])) continue;
+
+                float x = (points[i].x - view.x)*scale + offset.x;
+                float y = (points[i].y - view.y)*scale + offset.y;
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+            }
+            chunkBounds.push_back({ minX - padding, minY - padding, maxX - minX + 2*padding, maxY - minY + 2*padding });
+        }
+    }
+
+    const int stride = width*4;
+    const int columns = (width + RasterTileSize - 1)/RasterTileSize;
+    const int rows = (height + RasterTileSize - 1)/RasterTileSize;
+    unsigned char* pixels = (unsigned char*)image.data;
+
+    pool.ParallelFor((size_t)columns*rows, [&](size_t index)
+    {
+        thread_local std::unique_ptr<TileScratch> scratch;
+        if(!scratch) scratch = std::make_unique<TileScratch>();
+
+        int originX = (int)(index%columns)*RasterTileSize;
+        int originY = (int)(index/columns)*RasterTileSize;
+        int tileWidth = std::min(RasterTileSize, width - originX);
+        int tileHeight = std::min(RasterTileSize, height - originY);
+
+        unsigned char* tilePixels = pixels + (size_t)originY*stride + (size_t)originX*4;
+        for(int y = 0; y < tileHeight; y++)
+        {
+            unsigned char* pixel = tilePixels + (size_t)y*stride;
+            for(int x = 0; x < tileWidth; x++, pixel += 4)
+                std::memcpy(pixel, &background, 4);
+        }
+
+        TileContext tile {
+            shapes, view, scale, offset, strokeChunks, chunkBounds,
+            originX, originY, tileWidth, tileHeight, tilePixels, stride, *scratch, {},
+        };
+        RasterizeTile(tile);
+    });
+
+    return image;
+}
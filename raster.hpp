@@ -0,0 +1,14 @@
+#pragma once
+#include <raylib.h>
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+
+// Output pixels per side of the tiles the CPU rasterizer hands to the pool.
+constexpr int RasterTileSize = 64;
+
+// Draws the visible shapes inside view onto a new width x height RGBA8 image
+// without a window or GL context. view is scaled uniformly to fit and
+// centered. Coverage is computed from signed distances, so edges come out
+// anti-aliased at any resolution. The image has no data when it is too big
+// to allocate.
+Image RasterizeShapes(const ShapeStore& shapes, Rectangle view, int width, int height, Color background, ThreadPool& pool);
@@ -0,0 +1,601 @@
+#include "reference_image.hpp"
+#include "canvas.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <vector>
+#include "external/qoi.h"
+
+// raylib's stb_image is built without JPEG. This copy is private to the file
+// and has it.
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "external/stb_image.h"
+#if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+#endif
+
+struct TileEntry
+{
+    uint64_t offset;
+    uint32_t size;
+};
+
+struct ReferenceLevel
+{
+    int width, height;
+    int columns, rows;
+    std::vector<TileEntry> tiles;
+};
+
+// The tiled image, shared with the jobs decoding its tiles so replacing it
+// doesn't pull the file from under them.
+struct ReferenceImage::Source
+{
+    std::string tilePath;
+    MappedFile file;
+    std::vector<ReferenceLevel> levels;
+
+    ~Source()
+    {
+        file.Close();
+        std::error_code error;
+        std::filesystem::remove(tilePath, error);
+    }
+};
+
+struct ReferenceImage::Job
+{
+    std::string path;
+    std::atomic<float> progress = 0.0f;
+    std::atomic<bool> cancelled = false;
+    std::atomic<bool> finished = false;
+    std::shared_ptr<Source> source;
+};
+
+// Tiles decoded on the pool, waiting for the main thread to upload them.
+struct ReferenceImage::Decoded
+{
+    struct Entry
+    {
+        uint64_t key;
+        Image image;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    bool closed = false;
+};
+
+// Sides past this are refused, so a band of rows always fits in memory.
+constexpr uint32_t MaxReferenceSide = 1u << 20;
+
+// RGBA8 pixels from stb_image, allocated with malloc.
+struct Pixels
+{
+    unsigned char* data = nullptr;
+    int width = 0, height = 0;
+};
+
+static bool DecodeFile(const char* path, Pixels& pixels)
+{
+    int channels;
+    pixels.data = stbi_load(path, &pixels.width, &pixels.height, &channels, 4);
+    return pixels.data != nullptr;
+}
+
+// A QOI file decoded one row at a time from a mapping, so a big one is never
+// in memory whole. qoi.h only decodes into one buffer, this follows it op
+// for op.
+class QoiRows
+{
+public:
+    static constexpr size_t HeaderBytes = 14;
+    static constexpr size_t PaddingBytes = 8;
+
+    bool Open(const char* path)
+    {
+        if(!file.Open(path) || file.Size() < HeaderBytes + PaddingBytes) return false;
+
+        const unsigned char* data = file.Data();
+        width = ReadU32(data + 4);
+        height = ReadU32(data + 8);
+        cursor = HeaderBytes;
+        end = file.Size() - PaddingBytes;
+        return std::memcmp(data, "qoif", 4) == 0 && data[12] >= 3 && data[12] <= 4 && data[13] <= 1 &&
+            width > 0 && height > 0 && width <= MaxReferenceSide && height <= MaxReferenceSide;
+    }
+
+    void Next(unsigned char* row)
+    {
+        const unsigned char* data = file.Data();
+        for(uint32_t x = 0; x < width; x++, row += 4)
+        {
+            if(run > 0)
+            {
+                run--;
+            }
+            else if(cursor < end)
+            {
+                int op = data[cursor++];
+                if(op == 0xfe)
+                {
+                    std::memcpy(pixel, data + cursor, 3);
+                    cursor += 3;
+                }
+                else if(op == 0xff)
+                {
+                    std::memcpy(pixel, data + cursor, 4);
+                    cursor += 4;
+                }
+                else if((op & 0xc0) == 0x00)
+                {
+                    std::memcpy(pixel, index[op], 4);
+                }
+                else if((op & 0xc0) == 0x40)
+                {
+                    pixel[0] += ((op >> 4) & 0x03) - 2;
+                    pixel[1] += ((op >> 2) & 0x03) - 2;
+                    pixel[2] += (op & 0x03) - 2;
+                }
+                else if((op & 0xc0) == 0x80)
+                {
+                    int next = data[cursor++];
+                    int green = (op & 0x3f) - 32;
+                    pixel[0] += green - 8 + ((next >> 4) & 0x0f);
+                    pixel[1] += green;
+                    pixel[2] += green - 8 + (next & 0x0f);
+                }
+                else
+                {
+                    run = op & 0x3f;
+                }
+
+                std::memcpy(index[(pixel[0]*3 + pixel[1]*5 + pixel[2]*7 + pixel[3]*11) % 64], pixel, 4);
+            }
+
+            std::memcpy(row, pixel, 4);
+        }
+    }
+
+    uint32_t width = 0, height = 0;
+
+private:
+    static uint32_t ReadU32(const unsigned char* bytes)
+    {
+        return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+    }
+
+    MappedFile file;
+    size_t cursor = 0, end = 0;
+    unsigned char pixel[4] = { 0, 0, 0, 255 };
+    unsigned char index[64][4] = {};
+    int run = 0;
+};
+
+// Cuts an image into tiles for every level of its mip chain while its rows
+// arrive, top to bottom. Each level holds one band of ReferenceTileSize rows
+// and halves row pairs into the next, so no level is ever whole in memory.
+class TileCutter
+{
+public:
+    TileCutter(std::vector<ReferenceLevel>& levels, std::FILE* file) : levels(levels), file(file) {}
+
+    void Begin(int width, int height)
+    {
+        while(true)
+        {
+            ReferenceLevel& level = levels.emplace_back();
+            level.width = width;
+            level.height = height;
+            level.columns = (width + ReferenceTileSize - 1)/ReferenceTileSize;
+            level.rows = (height + ReferenceTileSize - 1)/ReferenceTileSize;
+            level.tiles.resize((size_t)level.columns*level.rows);
+            total += (double)width*height;
+
+            Band& band = bands.emplace_back();
+            band.pixels.resize((size_t)std::min(height, ReferenceTileSize)*width*4);
+            if(level.tiles.size() == 1) break;
+
+            band.half.resize((size_t)((width + 1)/2)*4);
+            width = (width + 1)/2;
+            height = (height + 1)/2;
+        }
+    }
+
+    bool AddRow(const unsigned char* row) { return AddRow(0, row); }
+
+    float Progress() const { return (float)std::min(done/total, 1.0); }
+    uint64_t Bytes() const { return offset; }
+
+private:
+    struct Band
+    {
+        std::vector<unsigned char> pixels;
+        std::vector<unsigned char> pending;     // even row waiting for its pair
+        std::vector<unsigned char> half;
+        int rows = 0;
+    };
+
+    bool AddRow(size_t index, const unsigned char* row)
+    {
+        const ReferenceLevel& level = levels[index];
+        Band& band = bands[index];
+        size_t rowBytes = (size_t)level.width*4;
+        int bandRow = band.rows % ReferenceTileSize;
+        std::memcpy(band.pixels.data() + bandRow*rowBytes, row, rowBytes);
+        band.rows++;
+        done += level.width;
+
+        bool last = band.rows == level.height;
+        if((bandRow + 1 == ReferenceTileSize || last) && !WriteBand(index, bandRow + 1)) return false;
+        if(index + 1 == levels.size()) return true;
+
+        // Box filter to half the size, the last row of an odd height pairs
+        // with itself so it isn't lost.
+        if(band.pending.empty() && !last)
+        {
+            band.pending.assign(row, row + rowBytes);
+            return true;
+        }
+
+        const unsigned char* row0 = band.pending.empty() ? row : band.pending.data();
+        int halfWidth = levels[index + 1].width;
+        for(int x = 0; x < halfWidth; x++)
+        {
+            int x0 = 2*x*4;
+            int x1 = std::min(2*x + 1, level.width - 1)*4;
+            for(int c = 0; c < 4; c++)
+                band.half[x*4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row[x0 + c] + row[x1 + c] + 2)/4);
+        }
+        band.pending.clear();
+        return AddRow(index + 1, band.half.data());
+    }
+
+    // Appends the tiles of a full band, or the last one, to the file as QOI.
+    bool WriteBand(size_t index, int height)
+    {
+        ReferenceLevel& level = levels[index];
+        const Band& band = bands[index];
+        int y = (band.rows - 1)/ReferenceTileSize;
+
+        for(int x = 0; x < level.columns; x++)
+        {
+            int left = x*ReferenceTileSize;
+            int width = std::min(ReferenceTileSize, level.width - left);
+
+            tile.resize((size_t)width*height*4);
+            for(int row = 0; row < height; row++)
+                std::memcpy(tile.data() + (size_t)row*width*4, band.pixels.data() + ((size_t)row*level.width + left)*4, (size_t)width*4);
+
+            qoi_desc desc;
+            desc.width = (unsigned int)width;
+            desc.height = (unsigned int)height;
+            desc.channels = 4;
+            desc.colorspace = QOI_SRGB;
+
+            int size = 0;
+            void* encoded = qoi_encode(tile.data(), &desc, &size);
+            if(encoded == nullptr) return false;
+
+            bool written = std::fwrite(encoded, 1, (size_t)size, file) == (size_t)size;
+            MemFree(encoded);
+            if(!written) return false;
+
+            level.tiles[(size_t)y*level.columns + x] = { offset, (uint32_t)size };
+            offset += (uint64_t)size;
+        }
+
+        return true;
+    }
+
+    std::vector<ReferenceLevel>& levels;
+    std::vector<Band> bands;
+    std::FILE* file;
+    std::vector<unsigned char> tile;
+    uint64_t offset = 0;
+    double done = 0, total = 0;
+};
+
+// Decodes and tiles every level in one pass over the rows. QOI streams from
+// the file a row at a time. stb_image can only decode PNG and JPG whole, so
+// that image is the one big allocation, and only until it is cut.
+std::shared_ptr<ReferenceImage::Source> ReferenceImage::TileImage(Job& job)
+{
+    const char* path = job.path.c_str();
+    bool streamed = IsFileExtension(path, ".qoi");
+    QoiRows qoi;
+    Pixels pixels;
+    if(streamed ? !qoi.Open(path) : !DecodeFile(path, pixels))
+    {
+        TraceLog(LOG_WARNING, "REFERENCE: Failed to decode %s", path);
+        return nullptr;
+    }
+
+    int width = streamed ? (int)qoi.width : pixels.width;
+    int height = streamed ? (int)qoi.height : pixels.height;
+
+    static std::atomic<uint32_t> counter = 0;
+    auto source = std::make_shared<Source>();
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+    source->tilePath = (directory / ("mypaint-reference-" +
+        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "-" +
+        std::to_string(counter++) + ".tiles")).string();
+
+    std::FILE* file = std::fopen(source->tilePath.c_str(), "wb");
+    bool ok = file != nullptr;
+
+    TileCutter cutter(source->levels, file);
+    cutter.Begin(width, height);
+    std::vector<unsigned char> row(streamed ? (size_t)width*4 : 0);
+    for(int y = 0; ok && y < height && !job.cancelled; y++)
+    {
+        if(streamed)
+            qoi.Next(row.data());
+        ok = cutter.AddRow(streamed ? row.data() : pixels.data + (size_t)y*width*4);
+        job.progress = cutter.Progress();
+    }
+
+    std::free(pixels.data);
+    if(file != nullptr)
+        ok = std::fclose(file) == 0 && ok;
+
+    if(!ok || job.cancelled || !source->file.Open(source->tilePath.c_str()))
+    {
+        if(!job.cancelled)
+            TraceLog(LOG_WARNING, "REFERENCE: Failed to tile %s", path);
+        return nullptr;
+    }
+
+    TraceLog(LOG_INFO, "REFERENCE: Loaded %s (%dx%d, %zu levels, %.1f MB of tiles)", path,
+        width, height, source->levels.size(), cutter.Bytes()/(1024.0*1024.0));
+    return source;
+}
+
+ReferenceImage::~ReferenceImage()
+{
+    Unload();
+}
+
+bool ReferenceImage::IsSupported(const char* path)
+{
+    return IsFileExtension(path, ".png;.jpg;.jpeg;.qoi");
+}
+
+void ReferenceImage::Load(ThreadPool& pool, std::string path, Vector2 at)
+{
+    Unload();
+
+    job = std::make_shared<Job>();
+    job->path = std::move(path);
+    position = at;
+
+    std::shared_ptr<Job> running = job;
+    pool.Submit([running]()
+    {
+        running->source = TileImage(*running);
+        running->finished = true;
+    });
+}
+
+void ReferenceImage::Unload()
+{
+    if(job != nullptr)
+    {
+        job->cancelled = true;
+        job.reset();
+    }
+
+    if(decoded != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(decoded->mutex);
+        for(Decoded::Entry& entry: decoded->entries)
+            UnloadImage(entry.image);
+        decoded->entries.clear();
+        decoded->closed = true;
+    }
+    decoded.reset();
+
+    for(auto& [key, tile]: tiles)
+        UnloadTexture(tile.texture);
+    tiles.clear();
+    requested.clear();
+    source.reset();
+    missingTiles = 0;
+}
+
+float ReferenceImage::Progress() const
+{
+    return job != nullptr ? job->progress.load() : 1.0f;
+}
+
+uint64_t ReferenceImage::TileKey(int level, int x, int y)
+{
+    return (uint64_t)level << 48 | (uint64_t)(uint32_t)y << 24 | (uint64_t)(uint32_t)x;
+}
+
+bool ReferenceImage::TileRange(int tileLevel, int& firstX, int& firstY, int& lastX, int& lastY) const
+{
+    const ReferenceLevel& info = source->levels[tileLevel];
+    float size = (float)(ReferenceTileSize << tileLevel);
+
+    firstX = std::max((int)std::floor((view.x - position.x)/size), 0);
+    firstY = std::max((int)std::floor((view.y - position.y)/size), 0);
+    lastX = std::min((int)std::floor((view.x + view.width - position.x)/size), info.columns - 1);
+    lastY = std::min((int)std::floor((view.y + view.height - position.y)/size), info.rows - 1);
+    return firstX <= lastX && firstY <= lastY;
+}
+
+void ReferenceImage::Request(ThreadPool& pool, int tileLevel, int x, int y)
+{
+    uint64_t key = TileKey(tileLevel, x, y);
+    if(tiles.count(key)) return;
+
+    // Tiles past what the cache holds are left to the coarser levels.
+    bool inFlight = requested.count(key) != 0;
+    if(!inFlight && tilesInUse + requested.size() >= MaxReferenceTiles) return;
+
+    missingTiles++;
+    if(inFlight || requested.size() >= (size_t)ReferenceDecodesInFlight) return;
+
+    requested.insert(key);
+    const ReferenceLevel& info = source->levels[tileLevel];
+    TileEntry entry = info.tiles[(size_t)y*info.columns + x];
+
+    std::shared_ptr<Source> tileSource = source;
+    std::shared_ptr<Decoded> results = decoded;
+    pool.Submit([tileSource, results, entry, key]()
+    {
+        qoi_desc desc;
+        void* pixels = qoi_decode(tileSource->file.Data() + entry.offset, (int)entry.size, &desc, 4);
+
+        Image image = {};
+        image.data = pixels;
+        image.width = (int)desc.width;
+        image.height = (int)desc.height;
+        image.mipmaps = 1;
+        image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+        std::lock_guard<std::mutex> lock(results->mutex);
+        if(results->closed)
+            UnloadImage(image);
+        else
+            results->entries.push_back({ key, image });
+    });
+}
+
+void ReferenceImage::Evict()
+{
+    while(tiles.size() > MaxReferenceTiles)
+    {
+        auto oldest = tiles.end();
+        for(auto it = tiles.begin(); it != tiles.end(); ++it)
+        {
+            if(it->second.lastUsed != frame && (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+                oldest = it;
+        }
+        if(oldest == tiles.end()) return;
+
+        UnloadTexture(oldest->second.texture);
+        tiles.erase(oldest);
+    }
+}
+
+void ReferenceImage::Update(ThreadPool& pool, Camera2D camera, int screenWidth, int screenHeight)
+{
+    if(job != nullptr && job->finished)
+    {
+        source = job->source;
+        job.reset();
+        if(source != nullptr)
+            decoded = std::make_shared<Decoded>();
+    }
+    if(source == nullptr) return;
+
+    frame++;
+    missingTiles = 0;
+    tilesInUse = 0;
+    auto use = [&](Tile& tile)
+    {
+        if(tile.lastUsed != frame)
+            tilesInUse++;
+        tile.lastUsed = frame;
+    };
+
+    // A few uploads per frame, the rest waits in the queue.
+    {
+        std::lock_guard<std::mutex> lock(decoded->mutex);
+        size_t count = std::min(decoded->entries.size(), (size_t)ReferenceUploadsPerFrame);
+        for(size_t i = 0; i < count; i++)
+        {
+            Decoded::Entry& entry = decoded->entries[i];
+            requested.erase(entry.key);
+            if(entry.image.data == nullptr) continue;
+
+            Texture2D texture = LoadTextureFromImage(entry.image);
+            SetTextureFilter(texture, TEXTURE_FILTER_BILINEAR);
+            UnloadImage(entry.image);
+            tiles[entry.key] = { texture, frame };
+            tilesInUse++;
+        }
+        decoded->entries.erase(decoded->entries.begin(), decoded->entries.begin() + count);
+    }
+
+    // The level whose pixels are closest to, and at least as big as, the
+    // screen's.
+    int top = (int)source->levels.size() - 1;
+    level = std::clamp((int)std::floor(std::log2(1.0f/camera.zoom)), 0, top);
+    view = TiledCanvas::VisibleArea(camera, screenWidth, screenHeight);
+
+    // The single tile of the top level is always there to fall back on.
+    Request(pool, top, 0, 0);
+    auto topTile = tiles.find(TileKey(top, 0, 0));
+    if(topTile != tiles.end())
+        use(topTile->second);
+
+    int firstX, firstY, lastX, lastY;
+    if(TileRange(level, firstX, firstY, lastX, lastY))
+    {
+        for(int y = firstY; y <= lastY; y++)
+        {
+            for(int x = firstX; x <= lastX; x++)
+            {
+                auto tile = tiles.find(TileKey(level, x, y));
+                if(tile != tiles.end())
+                    use(tile->second);
+                else
+                    Request(pool, level, x, y);
+            }
+        }
+    }
+
+    Evict();
+}
+
+void ReferenceImage::Render() const
+{
+    if(source == nullptr || !visible) return;
+
+    // Coarse to fine, finer tiles cover the coarser ones as they arrive.
+    Color tint = Fade(WHITE, opacity);
+    for(int tileLevel = (int)source->levels.size() - 1; tileLevel >= level; tileLevel--)
+    {
+        int firstX, firstY, lastX, lastY;
+        if(!TileRange(tileLevel, firstX, firstY, lastX, lastY)) continue;
+
+        float scale = (float)(1 << tileLevel);
+        for(int y = firstY; y <= lastY; y++)
+        {
+            for(int x = firstX; x <= lastX; x++)
+            {
+                auto tile = tiles.find(TileKey(tileLevel, x, y));
+                if(tile == tiles.end()) continue;
+
+                const Texture2D& texture = tile->second.texture;
+                Rectangle dest =
+                {
+                    position.x + x*ReferenceTileSize*scale,
+                    position.y + y*ReferenceTileSize*scale,
+                    texture.width*scale,
+                    texture.height*scale,
+                };
+                DrawTexturePro(texture, { 0, 0, (float)texture.width, (float)texture.height }, dest, { 0, 0 }, 0, tint);
+            }
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <raylib.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "thread_pool.hpp"
+
+constexpr int ReferenceTileSize = 256;
+
+// Tile textures kept on the GPU, 256KB each. Enough for a screen at any zoom
+// plus the tiles around it. A bigger screen gets coarser tiles where the
+// cache runs out, never more textures.
+constexpr size_t MaxReferenceTiles = 128;
+
+// Tiles being decoded on the pool at once, and uploaded per frame. Keeps a
+// fast zoom from flooding the pool or stalling a frame on uploads.
+constexpr int ReferenceDecodesInFlight = 8;
+constexpr int ReferenceUploadsPerFrame = 4;
+
+// A big image to trace over, drawn under the layers. A pool thread decodes
+// it row by row (PNG and JPG through stb_image, which decodes them whole
+// first), cuts it and every halving of it down to a single tile into
+// ReferenceTileSize tiles as the rows arrive, and stores those QOI
+// compressed in a temporary file that is then mapped. Only tiles of the mip level
+// that suits the zoom and are in view are decoded (on the pool again) and
+// uploaded. The least recently seen ones are dropped once MaxReferenceTiles
+// are on the GPU. Coarser levels that are still loaded fill in while finer
+// tiles stream.
+class ReferenceImage
+{
+public:
+    ReferenceImage() = default;
+    ReferenceImage(const ReferenceImage&) = delete;
+    ReferenceImage& operator=(const ReferenceImage&) = delete;
+    ~ReferenceImage();
+
+    // Starts decoding the image at path, replacing the current one. Its top
+    // left corner goes at position in world space, one unit per pixel.
+    void Load(ThreadPool& pool, std::string path, Vector2 position);
+    void Unload();
+
+    bool Loading() const { return job != nullptr; }
+    float Progress() const;
+    bool Loaded() const { return source != nullptr; }
+
+    // Whether tiles in view are still on their way to the GPU.
+    bool Streaming() const { return missingTiles > 0; }
+
+    bool Visible() const { return visible; }
+    void SetVisible(bool value) { visible = value; }
+    float Opacity() const { return opacity; }
+    void SetOpacity(float value) { opacity = value; }
+
+    // Picks the level and tiles for the camera, asks for the missing ones
+    // and uploads what got decoded since the last frame.
+    void Update(ThreadPool& pool, Camera2D camera, int screenWidth, int screenHeight);
+
+    // Inside BeginMode2D with the camera Update got.
+    void Render() const;
+
+    static bool IsSupported(const char* path);
+
+private:
+    struct Job;
+    struct Source;
+    struct Decoded;
+
+    struct Tile
+    {
+        Texture2D texture;
+        uint64_t lastUsed;
+    };
+
+    static std::shared_ptr<Source> TileImage(Job& job);
+    static uint64_t TileKey(int level, int x, int y);
+    bool TileRange(int level, int& firstX, int& firstY, int& lastX, int& lastY) const;
+    void Request(ThreadPool& pool, int level, int x, int y);
+    void Evict();
+
+    std::shared_ptr<Job> job;
+    std::shared_ptr<Source> source;
+    std::shared_ptr<Decoded> decoded;
+    Vector2 position = { 0, 0 };
+
+    std::unordered_map<uint64_t, Tile> tiles;
+    std::unordered_set<uint64_t> requested;
+    uint64_t frame = 0;
+    int level = 0;
+    Rectangle view = { 0, 0, 0, 0 };
+    int missingTiles = 0;
+    size_t tilesInUse = 0;
+
+    bool visible = true;
+    float opacity = 1.0f;
+};
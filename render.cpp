@@ -0,0 +1,140 @@
+#include "render.hpp"
+#include "raymath.h"
+#include "rlgl.h"
+#include <algorithm>
+#include <cmath>
+
+// Largest distance a tessellated curve may be off from the real one, in pixels.
+constexpr float CurveTolerance = 0.25f;
+
+void BeginLayerContents()
+{
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+}
+
+void EndLayerContents()
+{
+    EndBlendMode();
+}
+
+// Factors for a premultiplied source. Multiply is src*dst plus what the
+// source doesn't cover, screen is src + dst*(1 - src).
+void BeginLayerBlend(LayerBlend mode)
+{
+    switch(mode)
+    {
+        case LayerBlend::Multiply: rlSetBlendFactors(RL_DST_COLOR, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD); break;
+        case LayerBlend::Add: rlSetBlendFactors(RL_ONE, RL_ONE, RL_FUNC_ADD); break;
+        case LayerBlend::Screen: rlSetBlendFactors(RL_ONE, RL_ONE_MINUS_SRC_COLOR, RL_FUNC_ADD); break;
+        default: rlSetBlendFactors(RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD); break;
+    }
+    BeginBlendMode(BLEND_CUSTOM);
+}
+
+void DrawLayerTexture(Texture2D texture, Rectangle dest, float opacity)
+{
+    // Every channel is scaled, the texture is premultiplied.
+    unsigned char level = (unsigned char)std::lround(std::clamp(opacity, 0.0f, 1.0f)*255);
+    DrawTexturePro(
+        texture,
+        {0, 0, (float)texture.width, -(float)texture.height},
+        dest,
+        {0, 0},
+        0,
+        { level, level, level, level }
+    );
+}
+
+void EndLayerBlend()
+{
+    EndBlendMode();
+}
+
+int CurveSegments(float radius, float scale)
+{
+    float pixels = radius*scale;
+    if(pixels <= CurveTolerance*2) return 6;
+
+    float step = 2*acosf(1 - CurveTolerance/pixels);
+    return std::clamp((int)ceilf(2*PI/step), 6, 128);
+}
+
+static void DrawDisc(Vector2 center, float radius, float scale, Color color)
+{
+    DrawCircleSector(center, radius, 0, 360, CurveSegments(radius, scale), color);
+}
+
+void TessellateStroke(const Vector2* points, size_t count, float radius, float scale, std::vector<Vector2>& strip, std::vector<Vector2>& joins)
+{
+    // Tessellation runs on the thread pool when a document is loaded.
+    thread_local std::vector<Vector2> decimated;
+
+    strip.clear();
+    joins.clear();
+    if(count == 0 || radius <= 0) return;
+
+    if(scale < 1 && count > 2)
+    {
+        float spacing = 1/scale;
+        decimated.clear();
+        decimated.push_back(points[0]);
+        for(size_t i = 1; i + 1 < count; i++)
+        {
+            if(Vector2DistanceSqr(points[i], decimated.back()) >= spacing*spacing)
+                decimated.push_back(points[i]);
+        }
+        decimated.push_back(points[count - 1]);
+
+        points = decimated.data();
+        count = decimated.size();
+    }
+
+    joins.push_back(points[0]);
+    if(count == 1) return;
+    joins.push_back(points[count - 1]);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        Vector2 in = Vector2Normalize(Vector2Subtract(points[i], points[i == 0 ? 0 : i - 1]));
+        Vector2 out = Vector2Normalize(Vector2Subtract(points[i + 1 == count ? i : i + 1], points[i]));
+        if(i == 0) in = out;
+        if(i + 1 == count) out = in;
+
+        Vector2 normalIn { -in.y, in.x };
+        Vector2 normalOut { -out.y, out.x };
+        Vector2 miter = Vector2Add(normalIn, normalOut);
+        float miterLength = Vector2Length(miter);
+
+        Vector2 offset;
+        if(miterLength < 1e-3f)
+        {
+            offset = Vector2Scale(normalOut, radius);
+        }
+        else
+        {
+            miter = Vector2Scale(miter, 1.0f/miterLength);
+            offset = Vector2Scale(miter, radius/fmaxf(Vector2DotProduct(miter, normalOut), 0.5f));
+        }
+
+        if(Vector2DotProduct(in, out) < 0)
+            joins.push_back(points[i]);
+
+        strip.push_back(Vector2Subtract(points[i], offset));
+        strip.push_back(Vector2Add(points[i], offset));
+    }
+}
+
+void DrawStroke(const Vector2* points, size_t count, Color color, int thickness, float scale)
+{
+    static std::vector<Vector2> strip;
+    static std::vector<Vector2> joins;
+
+    float radius = (float)thickness;
+    TessellateStroke(points, count, radius, scale, strip, joins);
+
+    for(Vector2 join: joins)
+        DrawDisc(join, radius, scale, color);
+    if(strip.size() >= 4)
+        DrawTriangleStrip(strip.data(), (int)strip.size(), color);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <raylib.h>
+#include <vector>
+#include "layers.hpp"
+
+// Behind the bottom layer, on screen and in everything exported.
+constexpr Color BackgroundColor = {34, 34, 27, 255};
+
+// Shapes drawn between these onto a transparent target leave premultiplied
+// color and their coverage in alpha, what a layer texture holds.
+void BeginLayerContents();
+void EndLayerContents();
+
+// Blends layer textures over the current target with the layer's mode. The
+// texture is flipped like any render texture. Calls between BeginLayerBlend
+// and EndLayerBlend share one blend mode switch.
+void BeginLayerBlend(LayerBlend mode);
+void DrawLayerTexture(Texture2D texture, Rectangle dest, float opacity);
+void EndLayerBlend();
+
+// Segments a circle of this radius needs to look round at scale pixels per
+// world unit.
+int CurveSegments(float radius, float scale);
+
+// A stroke of the given radius as triangle strip vertex pairs, plus the points
+// that need a disc for round caps and round joins on sharp turns. scale is how
+// many pixels one world unit covers, below 1 points closer than a pixel apart
+// are skipped.
+void TessellateStroke(const Vector2* points, size_t count, float radius, float scale, std::vector<Vector2>& strip, std::vector<Vector2>& joins);
+
+// Draws a stroke right away through rlgl, for the preview while drawing. Its
+// width is 2*thickness, the radius the old per-point dabs used.
+void DrawStroke(const Vector2* points, size_t count, Color color, int thickness, float scale = 1.0f);
@@ -0,0 +1,326 @@
+#include "selection.hpp"
+#include "raymath.h"
+#include "render.hpp"
+#include "rlgl.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+void Selection::Unload()
+{
+    if(preview.id != 0)
+        UnloadRenderTexture(preview);
+    preview = {};
+    batch.Unload();
+}
+
+void Selection::Clear(TiledCanvas& canvas)
+{
+    if(Dragging())
+        Restore(canvas);
+
+    positions.clear();
+    bounds = { 0, 0, 0, 0 };
+}
+
+void Selection::Pick(const ShapeStore& shapes, uint8_t layer, Vector2 point, float tolerance)
+{
+    positions.clear();
+    this->layer = layer;
+
+    candidates.clear();
+    shapes.Query({ point.x - tolerance, point.y - tolerance, 2*tolerance, 2*tolerance }, layer, candidates);
+
+    // Later in the draw order is on top.
+    for(size_t i = candidates.size(); i-- > 0;)
+    {
+        if(shapes.Distance(shapes[candidates[i]], point) <= tolerance)
+        {
+            positions.push_back(candidates[i]);
+            break;
+        }
+    }
+
+    UpdateBounds(shapes);
+}
+
+void Selection::SelectArea(const ShapeStore& shapes, uint8_t layer, Rectangle area)
+{
+    positions.clear();
+    this->layer = layer;
+
+    candidates.clear();
+    shapes.Query(area, layer, candidates);
+    for(uint32_t position: candidates)
+    {
+        Rectangle shape = shapes.Bounds(shapes[position]);
+        bool inside = shape.x >= area.x && shape.y >= area.y &&
+            shape.x + shape.width <= area.x + area.width &&
+            shape.y + shape.height <= area.y + area.height;
+        if(inside)
+            positions.push_back(position);
+    }
+
+    UpdateBounds(shapes);
+}
+
+void Selection::UpdateBounds(const ShapeStore& shapes)
+{
+    if(positions.empty())
+    {
+        bounds = { 0, 0, 0, 0 };
+        return;
+    }
+
+    float minX = INFINITY, minY = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    for(uint32_t position: positions)
+    {
+        Rectangle shape = shapes.Bounds(shapes[position]);
+        minX = std::min(minX, shape.x);
+        minY = std::min(minY, shape.y);
+        maxX = std::max(maxX, shape.x + shape.width);
+        maxY = std::max(maxY, shape.y + shape.height);
+    }
+
+    bounds = { minX, minY, maxX - minX, maxY - minY };
+}
+
+Vector2 Selection::GripPosition(SelectionGrip grip, float zoom) const
+{
+    float right = bounds.x + bounds.width, bottom = bounds.y + bounds.height;
+    switch(grip)
+    {
+        case SelectionGrip::TopLeft: return { bounds.x, bounds.y };
+        case SelectionGrip::TopRight: return { right, bounds.y };
+        case SelectionGrip::BottomRight: return { right, bottom };
+        case SelectionGrip::BottomLeft: return { bounds.x, bottom };
+        case SelectionGrip::Rotate: return { bounds.x + bounds.width/2, bounds.y - RotationGripPixels/zoom };
+        default: return { bounds.x + bounds.width/2, bounds.y + bounds.height/2 };
+    }
+}
+
+SelectionGrip Selection::GripAt(Vector2 point, float zoom) const
+{
+    if(positions.empty()) return SelectionGrip::None;
+
+    float reach = SelectionGripPixels/zoom;
+    for(SelectionGrip candidate: { SelectionGrip::Rotate, SelectionGrip::TopLeft, SelectionGrip::TopRight, SelectionGrip::BottomRight, SelectionGrip::BottomLeft })
+    {
+        Vector2 position = GripPosition(candidate, zoom);
+        if(std::fabs(point.x - position.x) <= reach && std::fabs(point.y - position.y) <= reach)
+            return candidate;
+    }
+
+    return CheckCollisionPointRec(point, bounds) ? SelectionGrip::Move : SelectionGrip::None;
+}
+
+void Selection::BeginDrag(ShapeStore& shapes, TiledCanvas& canvas, SelectionGrip grip, Vector2 point)
+{
+    if(positions.empty() || grip == SelectionGrip::None) return;
+
+    this->grip = grip;
+    dragStart = point;
+    transform = {};
+
+    // Corners scale from the opposite one.
+    switch(grip)
+    {
+        case SelectionGrip::TopLeft: transform.pivot = GripPosition(SelectionGrip::BottomRight, 1); break;
+        case SelectionGrip::TopRight: transform.pivot = GripPosition(SelectionGrip::BottomLeft, 1); break;
+        case SelectionGrip::BottomRight: transform.pivot = GripPosition(SelectionGrip::TopLeft, 1); break;
+        case SelectionGrip::BottomLeft: transform.pivot = GripPosition(SelectionGrip::TopRight, 1); break;
+        default: transform.pivot = GripPosition(SelectionGrip::Move, 1); break;
+    }
+
+    originals.clear();
+    for(uint32_t position: positions)
+        originals.push_back(shapes[position]);
+
+    canvas.SetExcluded(positions);
+    canvas.MarkDirty(bounds, layer);
+    previewPending = true;
+}
+
+void Selection::Drag(Vector2 point)
+{
+    Vector2 from = Vector2Subtract(dragStart, transform.pivot);
+    Vector2 to = Vector2Subtract(point, transform.pivot);
+
+    switch(grip)
+    {
+        case SelectionGrip::Move:
+            transform.offset = Vector2Subtract(point, dragStart);
+            break;
+
+        case SelectionGrip::Rotate:
+            transform.rotation = std::atan2(to.y, to.x) - std::atan2(from.y, from.x);
+            break;
+
+        case SelectionGrip::None: break;
+
+        default:
+            // A selection as thin as a line keeps its size across it.
+            transform.scale.x = std::fabs(from.x) > 1e-3f ? to.x/from.x : 1.0f;
+            transform.scale.y = std::fabs(from.y) > 1e-3f ? to.y/from.y : 1.0f;
+            break;
+    }
+}
+
+void Selection::Restore(TiledCanvas& canvas)
+{
+    canvas.SetExcluded({});
+    canvas.MarkDirty(bounds, layer);
+    FinishDrag();
+}
+
+void Selection::FinishDrag()
+{
+    originals.clear();
+    grip = SelectionGrip::None;
+    transform = {};
+    previewPending = false;
+    if(preview.id != 0)
+        UnloadRenderTexture(preview);
+    preview = {};
+}
+
+bool Selection::EndDrag(ShapeStore& shapes, TiledCanvas& canvas, Edit& edit)
+{
+    if(!Dragging()) return false;
+
+    if(transform.IsIdentity())
+    {
+        Restore(canvas);
+        return false;
+    }
+
+    // The old area was redrawn without the shapes when the drag started.
+    canvas.SetExcluded({});
+
+    for(size_t i = 0; i < positions.size(); i++)
+    {
+        // A shape there is no slot for a copy of stays where it was.
+        ShapeHandle after = shapes.TransformShape(originals[i], transform);
+        if(after.hidden) continue;
+
+        shapes.Replace(positions[i], after);
+        edit.changed.push_back({ positions[i], originals[i], after });
+    }
+
+    UpdateBounds(shapes);
+    canvas.MarkDirty(bounds, layer);
+    FinishDrag();
+    return true;
+}
+
+bool Selection::Recolor(ShapeStore& shapes, TiledCanvas& canvas, Color color, Edit& edit)
+{
+    if(positions.empty() || Dragging()) return false;
+
+    for(uint32_t position: positions)
+    {
+        ShapeHandle before = shapes[position];
+        ShapeHandle after = shapes.RecolorShape(before, color);
+        if(after.hidden) continue;
+
+        shapes.Replace(position, after);
+        edit.changed.push_back({ position, before, after });
+    }
+
+    canvas.MarkDirty(bounds, layer);
+    return true;
+}
+
+void Selection::Update(const ShapeStore& shapes, float zoom)
+{
+    if(!previewPending) return;
+    previewPending = false;
+
+    // Same resolution as the screen unless that would be too big a texture.
+    float scale = std::min(zoom, MaxSelectionPreview/std::max({ bounds.width, bounds.height, 1.0f }));
+    int width = std::max(1, (int)std::ceil(bounds.width*scale));
+    int height = std::max(1, (int)std::ceil(bounds.height*scale));
+    previewArea = { bounds.x, bounds.y, width/scale, height/scale };
+
+    if(preview.id != 0)
+        UnloadRenderTexture(preview);
+    preview = LoadRenderTexture(width, height);
+
+    Camera2D camera {};
+    camera.target = { bounds.x, bounds.y };
+    camera.zoom = scale;
+
+    batch.Load();
+    BeginTextureMode(preview);
+    ClearBackground(BLANK);
+    BeginMode2D(camera);
+    BeginLayerContents();
+    batch.Begin(scale);
+    for(ShapeHandle handle: originals)
+        batch.Add(shapes, handle);
+    batch.Flush();
+    EndLayerContents();
+    EndMode2D();
+    EndTextureMode();
+}
+
+void Selection::Render(const ShapeStore& shapes, float zoom) const
+{
+    if(positions.empty()) return;
+
+    const ::Layer* owner = shapes.FindLayer(layer);
+    if(Dragging() && preview.id != 0 && owner && owner->visible)
+    {
+        // Texture corners go where the transform takes them, the render
+        // texture being upside down. A mirrored quad is wound the other way,
+        // which culling would drop.
+        float right = previewArea.x + previewArea.width, bottom = previewArea.y + previewArea.height;
+        struct { Vector2 position; float u, v; } corners[4] = {
+            { transform.Apply({ previewArea.x, previewArea.y }), 0, 1 },
+            { transform.Apply({ previewArea.x, bottom }), 0, 0 },
+            { transform.Apply({ right, bottom }), 1, 0 },
+            { transform.Apply({ right, previewArea.y }), 1, 1 },
+        };
+        if(transform.scale.x*transform.scale.y < 0)
+            std::reverse(std::begin(corners), std::end(corners));
+
+        unsigned char level = (unsigned char)std::lround(std::clamp(owner->opacity, 0.0f, 1.0f)*255);
+        BeginLayerBlend(owner->blend);
+        rlSetTexture(preview.texture.id);
+        rlBegin(RL_QUADS);
+        rlColor4ub(level, level, level, level);
+        for(const auto& corner: corners)
+        {
+            rlTexCoord2f(corner.u, corner.v);
+            rlVertex2f(corner.position.x, corner.position.y);
+        }
+        rlEnd();
+        rlSetTexture(0);
+        EndLayerBlend();
+    }
+
+    float line = 1/zoom;
+    float right = bounds.x + bounds.width, bottom = bounds.y + bounds.height;
+    Vector2 corners[4] = {
+        transform.Apply({ bounds.x, bounds.y }),
+        transform.Apply({ right, bounds.y }),
+        transform.Apply({ right, bottom }),
+        transform.Apply({ bounds.x, bottom }),
+    };
+    for(int i = 0; i < 4; i++)
+        DrawLineEx(corners[i], corners[(i + 1)%4], line, SelectionColor);
+
+    if(Dragging()) return;
+
+    float size = SelectionGripPixels/zoom;
+    for(SelectionGrip corner: { SelectionGrip::TopLeft, SelectionGrip::TopRight, SelectionGrip::BottomRight, SelectionGrip::BottomLeft })
+    {
+        Vector2 position = GripPosition(corner, zoom);
+        DrawRectangleV({ position.x - size/2, position.y - size/2 }, { size, size }, SelectionColor);
+    }
+
+    Vector2 rotate = GripPosition(SelectionGrip::Rotate, zoom);
+    DrawLineEx({ rotate.x, bounds.y }, rotate, line, SelectionColor);
+    DrawCircleV(rotate, size/2, SelectionColor);
+}
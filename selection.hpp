@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <raylib.h>
+#include <vector>
+#include "canvas.hpp"
+#include "history.hpp"
+#include "shape_batch.hpp"
+#include "shape_store.hpp"
+#include "shapes.hpp"
+
+// Grips are this many screen pixels across, the rotation grip sits this far
+// above the top edge.
+constexpr float SelectionGripPixels = 8.0f;
+constexpr float RotationGripPixels = 24.0f;
+
+constexpr Color SelectionColor = { 90, 170, 255, 255 };
+
+// Longest side of the texture a drag previews the selection with. Zoomed in
+// on a big selection the preview is a bit blurry until the drag ends.
+constexpr int MaxSelectionPreview = 4096;
+
+// What a drag that starts at a point does to the selection. Corners scale
+// from the opposite corner, rotation is about the center.
+enum class SelectionGrip
+{
+    None = 0,
+    Move,
+    TopLeft,
+    TopRight,
+    BottomRight,
+    BottomLeft,
+    Rotate,
+};
+
+// Shapes of one layer picked with the select tool, by draw order position. A
+// drag has the canvas redraw the tiles they were on once without them, leaving
+// the store and so the journal and mirror alone, and draws them from a single
+// texture rendered when the drag started. Each frame of the drag then costs the
+// composited tiles plus one textured quad however many shapes are selected, and
+// the shapes are only transformed, re-indexed and rasterized into tiles again
+// when the drag ends.
+class Selection
+{
+public:
+    void Unload();
+
+    bool Empty() const { return positions.empty(); }
+    const std::vector<uint32_t>& Positions() const { return positions; }
+    uint8_t SelectedLayer() const { return layer; }
+    Rectangle Bounds() const { return bounds; }
+
+    // Drops the selection, putting back whatever a drag in progress hid.
+    void Clear(TiledCanvas& canvas);
+
+    // The topmost shape of the layer within tolerance of point, or nothing.
+    void Pick(const ShapeStore& shapes, uint8_t layer, Vector2 point, float tolerance);
+
+    // Every shape of the layer whose bounds lie within area.
+    void SelectArea(const ShapeStore& shapes, uint8_t layer, Rectangle area);
+
+    SelectionGrip GripAt(Vector2 point, float zoom) const;
+
+    void BeginDrag(ShapeStore& shapes, TiledCanvas& canvas, SelectionGrip grip, Vector2 point);
+    void Drag(Vector2 point);
+    bool Dragging() const { return grip != SelectionGrip::None; }
+
+    // Swaps the selected shapes for transformed copies and records that in
+    // edit. False when the drag didn't change anything.
+    bool EndDrag(ShapeStore& shapes, TiledCanvas& canvas, Edit& edit);
+
+    bool Recolor(ShapeStore& shapes, TiledCanvas& canvas, Color color, Edit& edit);
+
+    // Renders the preview a drag just started, outside BeginMode2D.
+    void Update(const ShapeStore& shapes, float zoom);
+
+    // Inside BeginMode2D: the dragged shapes, the box and its grips.
+    void Render(const ShapeStore& shapes, float zoom) const;
+
+private:
+    void UpdateBounds(const ShapeStore& shapes);
+    void Restore(TiledCanvas& canvas);
+    void FinishDrag();
+    Vector2 GripPosition(SelectionGrip grip, float zoom) const;
+
+    std::vector<uint32_t> positions;
+    uint8_t layer = 0;
+    Rectangle bounds = { 0, 0, 0, 0 };
+
+    SelectionGrip grip = SelectionGrip::None;
+    Vector2 dragStart = { 0, 0 };
+    ShapeTransform transform;
+    std::vector<ShapeHandle> originals;
+
+    ShapeBatch batch;
+    RenderTexture2D preview = {};
+    Rectangle previewArea = { 0, 0, 0, 0 };
+    bool previewPending = false;
+
+    // Scratch for Pick and SelectArea.
+    std::vector<uint32_t> candidates;
+};
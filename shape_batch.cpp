@@ -0,0 +1,488 @@
+#include "shape_batch.hpp"
+#include "raymath.h"
+#include "render.hpp"
+#include "rlgl.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+static const char* BatchVertexShader = R"(
+ATTRIBUTE vec2 vertexPosition;
+ATTRIBUTE vec4 vertexColor;
+ATTRIBUTE vec3 vertexMask;
+uniform mat4 mvp;
+VARYING vec4 fragColor;
+VARYING vec3 fragMask;
+
+void main()
+{
+    fragColor = vertexColor;
+    fragMask = vertexMask;
+    gl_Position = mvp*vec4(vertexPosition, 0.0, 1.0);
+}
+)";
+
+static const char* BatchFragmentShader = R"(
+VARYING vec4 fragColor;
+VARYING vec3 fragMask;
+
+void main()
+{
+    float distance = length(fragMask.xy);
+    if(distance > 1.0 || distance < fragMask.z) discard;
+    FRAG_COLOR = fragColor;
+}
+)";
+
+// Same shader source for every GL raylib can run on, only the keywords differ.
+static void ShaderHeaders(std::string& vertex, std::string& fragment)
+{
+    switch(rlGetVersion())
+    {
+        case RL_OPENGL_ES_20:
+        case RL_OPENGL_ES_30:
+            vertex = "#version 100\n#define ATTRIBUTE attribute\n#define VARYING varying\n";
+            fragment = "#version 100\nprecision mediump float;\n#define VARYING varying\n#define FRAG_COLOR gl_FragColor\n";
+            break;
+
+        case RL_OPENGL_21:
+            vertex = "#version 120\n#define ATTRIBUTE attribute\n#define VARYING varying\n";
+            fragment = "#version 120\n#define VARYING varying\n#define FRAG_COLOR gl_FragColor\n";
+            break;
+
+        default:
+            vertex = "#version 330\n#define ATTRIBUTE in\n#define VARYING out\n";
+            fragment = "#version 330\n#define VARYING in\nout vec4 finalColor;\n#define FRAG_COLOR finalColor\n";
+            break;
+    }
+}
+
+static Color ShapeColor(const ShapeStore& shapes, ShapeHandle handle)
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: return shapes.Get<Rect>(handle).color;
+        case Shape::Circle: return shapes.Get<Circle>(handle).color;
+        case Shape::Line: return shapes.Get<Line>(handle).color;
+        case Shape::Ellipse: return shapes.Get<Ellipse>(handle).color;
+        case Shape::Triangle: return shapes.Get<Triangle>(handle).color;
+        case Shape::FreeHand: return shapes.Get<Stroke>(handle).color;
+        case Shape::Fill: return shapes.Get<Fill>(handle).color;
+        default: return BLANK;
+    }
+}
+
+void ShapeBatch::Load()
+{
+    if(IsLoaded()) return;
+
+    std::string vertex, fragment;
+    ShaderHeaders(vertex, fragment);
+    vertex += BatchVertexShader;
+    fragment += BatchFragmentShader;
+
+    shader = LoadShaderFromMemory(vertex.c_str(), fragment.c_str());
+    mvpLocation = GetShaderLocation(shader, "mvp");
+    positionLocation = GetShaderLocationAttrib(shader, "vertexPosition");
+    colorLocation = GetShaderLocationAttrib(shader, "vertexColor");
+    maskLocation = GetShaderLocationAttrib(shader, "vertexMask");
+
+    vao = rlLoadVertexArray();
+    vertices.reserve(4096);
+}
+
+void ShapeBatch::Unload()
+{
+    if(!IsLoaded()) return;
+
+    rlUnloadVertexBuffer(vbo);
+    rlUnloadVertexArray(vao);
+    UnloadShader(shader);
+
+    shader = {};
+    vao = vbo = 0;
+    capacity = 0;
+}
+
+void ShapeBatch::SetAttributes() const
+{
+    rlSetVertexAttribute(positionLocation, 2, RL_FLOAT, false, sizeof(BatchVertex), offsetof(BatchVertex, x));
+    rlEnableVertexAttribute(positionLocation);
+    rlSetVertexAttribute(colorLocation, 4, RL_UNSIGNED_BYTE, true, sizeof(BatchVertex), offsetof(BatchVertex, r));
+    rlEnableVertexAttribute(colorLocation);
+    rlSetVertexAttribute(maskLocation, 3, RL_FLOAT, false, sizeof(BatchVertex), offsetof(BatchVertex, u));
+    rlEnableVertexAttribute(maskLocation);
+}
+
+void ShapeBatch::Begin(float scale, TessellationCache* cache)
+{
+    this->scale = scale;
+    this->cache = cache;
+    vertices.clear();
+}
+
+void ShapeBatch::Flush()
+{
+    if(vertices.empty()) return;
+
+    // Whatever rlgl has queued was meant to be under the shapes.
+    rlDrawRenderBatchActive();
+
+    int bytes = (int)(vertices.size()*sizeof(BatchVertex));
+    bool hasArray = rlEnableVertexArray(vao);
+    if(vertices.size() > capacity)
+    {
+        // Grows to the largest batch seen, later batches reuse the buffer.
+        if(vbo != 0) rlUnloadVertexBuffer(vbo);
+        vbo = rlLoadVertexBuffer(vertices.data(), bytes, true);
+        capacity = vertices.size();
+        SetAttributes();
+    }
+    else
+    {
+        rlUpdateVertexBuffer(vbo, vertices.data(), bytes, 0);
+        if(!hasArray)
+        {
+            rlEnableVertexBuffer(vbo);
+            SetAttributes();
+        }
+    }
+
+    rlEnableShader(shader.id);
+    rlSetUniformMatrix(mvpLocation, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+
+    // Shapes come in either winding.
+    rlDisableBackfaceCulling();
+    rlDrawVertexArray(0, (int)vertices.size());
+    rlEnableBackfaceCulling();
+
+    rlDisableShader();
+    if(hasArray)
+        rlDisableVertexArray();
+    else
+        rlDisableVertexBuffer();
+
+    vertices.clear();
+    drawCalls++;
+}
+
+void ShapeTessellator::PushVertex(Vector2 position, Color color, float u, float v, float inner)
+{
+    vertices->push_back({ position.x, position.y, color.r, color.g, color.b, color.a, u, v, inner });
+}
+
+void ShapeTessellator::PushTriangle(Vector2 a, Vector2 b, Vector2 c, Color color)
+{
+    PushVertex(a, color);
+    PushVertex(b, color);
+    PushVertex(c, color);
+}
+
+void ShapeTessellator::PushQuad(Vector2 a, Vector2 b, Vector2 c, Vector2 d, Color color)
+{
+    PushTriangle(a, b, c, color);
+    PushTriangle(a, c, d, color);
+}
+
+void ShapeTessellator::PushSegment(Vector2 a, Vector2 b, float halfWidth, Color color)
+{
+    Vector2 direction = Vector2Subtract(b, a);
+    float length = Vector2Length(direction);
+    if(length == 0 || halfWidth <= 0) return;
+
+    Vector2 normal = Vector2Scale({ -direction.y, direction.x }, halfWidth/length);
+    PushQuad(Vector2Add(a, normal), Vector2Add(b, normal), Vector2Subtract(b, normal), Vector2Subtract(a, normal), color);
+}
+
+void ShapeTessellator::PushDisc(Vector2 center, float outer, float inner, Color color)
+{
+    if(outer <= 0) return;
+
+    float ratio = inner > 0 ? inner/outer : -1.0f;
+    Vector2 topLeft { center.x - outer, center.y - outer };
+    Vector2 topRight { center.x + outer, center.y - outer };
+    Vector2 bottomRight { center.x + outer, center.y + outer };
+    Vector2 bottomLeft { center.x - outer, center.y + outer };
+
+    PushVertex(topLeft, color, -1, -1, ratio);
+    PushVertex(topRight, color, 1, -1, ratio);
+    PushVertex(bottomRight, color, 1, 1, ratio);
+    PushVertex(topLeft, color, -1, -1, ratio);
+    PushVertex(bottomRight, color, 1, 1, ratio);
+    PushVertex(bottomLeft, color, -1, 1, ratio);
+}
+
+void ShapeTessellator::PushStroke(const Vector2* points, size_t count, float radius, Color color)
+{
+    TessellateStroke(points, count, radius, scale, strip, joins);
+
+    for(Vector2 join: joins)
+        PushDisc(join, radius, 0, color);
+    for(size_t i = 0; i + 3 < strip.size(); i += 2)
+        PushQuad(strip[i], strip[i + 1], strip[i + 3], strip[i + 2], color);
+}
+
+void ShapeBatch::Add(const ShapeStore& shapes, ShapeHandle handle)
+{
+    if(vertices.size() >= MaxBatchVertices)
+        Flush();
+
+    if(cache == nullptr || !TessellationCache::Caches(handle.Kind()))
+    {
+        tessellator.Add(shapes, handle, scale, vertices);
+        return;
+    }
+
+    uint32_t count = 0;
+    if(const BatchVertex* cached = cache->Find(shapes, handle, scale, count))
+    {
+        vertices.insert(vertices.end(), cached, cached + count);
+        return;
+    }
+
+    size_t first = vertices.size();
+    tessellator.Add(shapes, handle, scale, vertices);
+    cache->Store(shapes, handle, scale, vertices.data() + first, (uint32_t)(vertices.size() - first));
+}
+
+void ShapeTessellator::Add(const ShapeStore& shapes, ShapeHandle handle, float scale, std::vector<BatchVertex>& out)
+{
+    vertices = &out;
+    this->scale = scale;
+
+    // Lines rlgl would draw as GL lines are one pixel of the target wide.
+    float hairline = 0.5f/scale;
+
+    // Less than a pixel across, a pixel sized dot looks the same.
+    if(scale < 1)
+    {
+        Rectangle bounds = shapes.Bounds(handle);
+        if(bounds.width*scale < 1 && bounds.height*scale < 1)
+        {
+            float size = 1/scale;
+            float x = bounds.x + bounds.width/2 - size/2;
+            float y = bounds.y + bounds.height/2 - size/2;
+            PushQuad({ x, y }, { x + size, y }, { x + size, y + size }, { x, y + size }, ShapeColor(shapes, handle));
+            return;
+        }
+    }
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = shapes.Get<Rect>(handle);
+            float left = rect.x, top = rect.y;
+            float right = rect.x + rect.width, bottom = rect.y + rect.height;
+
+            // Corners are laid out unrotated and turned about the center.
+            Vector2 center = rect.Center();
+            float c = cosf(rect.rotation), s = sinf(rect.rotation);
+            auto quad = [&](float x0, float y0, float x1, float y1)
+            {
+                auto turn = [&](float x, float y) -> Vector2
+                {
+                    float dx = x - center.x, dy = y - center.y;
+                    return { center.x + dx*c - dy*s, center.y + dx*s + dy*c };
+                };
+                PushQuad(turn(x0, y0), turn(x1, y0), turn(x1, y1), turn(x0, y1), rect.color);
+            };
+
+            if(rect.filled)
+            {
+                quad(left, top, right, bottom);
+                break;
+            }
+
+            // Inside the rectangle like DrawRectangleLinesEx, sides between the
+            // top and bottom bands.
+            float band = std::min((float)rect.thickness, std::min(rect.width, rect.height)/2);
+            if(band <= 0) break;
+            quad(left, top, right, top + band);
+            quad(left, bottom - band, right, bottom);
+            quad(left, top + band, left + band, bottom - band);
+            quad(right - band, top + band, right, bottom - band);
+        } break;
+
+        case Shape::Circle:
+        {
+            const Circle& circle = shapes.Get<Circle>(handle);
+            if(circle.filled)
+                PushDisc(circle.center, circle.radius, 0, circle.color);
+            else
+                PushDisc(circle.center, circle.radius + circle.thickness, circle.radius, circle.color);
+        } break;
+
+        case Shape::Line:
+        {
+            const Line& line = shapes.Get<Line>(handle);
+            PushSegment(line.start, line.end, line.thickness/2.0f, line.color);
+        } break;
+
+        case Shape::Ellipse:
+        {
+            const Ellipse& ellipse = shapes.Get<Ellipse>(handle);
+            int segments = CurveSegments(std::max(ellipse.radiusH, ellipse.radiusV), scale);
+            float step = 2*PI/segments;
+            float c = cosf(ellipse.rotation), s = sinf(ellipse.rotation);
+            Vector2 axisH { c*ellipse.radiusH, s*ellipse.radiusH };
+            Vector2 axisV { -s*ellipse.radiusV, c*ellipse.radiusV };
+
+            Vector2 previous = Vector2Add(ellipse.center, axisH);
+            for(int i = 1; i <= segments; i++)
+            {
+                float x = cosf(step*i), y = sinf(step*i);
+                Vector2 point { ellipse.center.x + x*axisH.x + y*axisV.x, ellipse.center.y + x*axisH.y + y*axisV.y };
+                if(ellipse.filled)
+                    PushTriangle(ellipse.center, previous, point, ellipse.color);
+                else
+                    PushSegment(previous, point, hairline, ellipse.color);
+                previous = point;
+            }
+        } break;
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = shapes.Get<Triangle>(handle);
+            if(triangle.filled)
+            {
+                PushTriangle(triangle.v1, triangle.v2, triangle.v3, triangle.color);
+            }
+            else
+            {
+                PushSegment(triangle.v1, triangle.v2, hairline, triangle.color);
+                PushSegment(triangle.v2, triangle.v3, hairline, triangle.color);
+                PushSegment(triangle.v3, triangle.v1, hairline, triangle.color);
+            }
+        } break;
+
+        case Shape::FreeHand:
+        {
+            const Stroke& stroke = shapes.Get<Stroke>(handle);
+            ForEachStrokeRun(shapes.StrokePoints(stroke), stroke.pointCount, [&](const Vector2* run, size_t count)
+            {
+                PushStroke(run, count, (float)stroke.thickness, stroke.color);
+            });
+        } break;
+
+        case Shape::Fill:
+        {
+            const Fill& fill = shapes.Get<Fill>(handle);
+            const FillSpan* spans = shapes.FillSpans(fill);
+            for(uint32_t i = 0; i < fill.spanCount; i++)
+            {
+                float left = fill.origin.x + spans[i].x*fill.cellSize;
+                float top = fill.origin.y + spans[i].y*fill.cellSize;
+                float right = left + spans[i].width*fill.cellSize;
+                float bottom = top + spans[i].height*fill.cellSize;
+                PushQuad({ left, top }, { right, top }, { right, bottom }, { left, bottom }, fill.color);
+            }
+        } break;
+
+        default: {}
+    }
+}
+
+uint64_t TessellationCache::Key(ShapeHandle handle, float scale)
+{
+    return ((uint64_t)handle.kind << 59) | ((uint64_t)handle.index << 32) | std::bit_cast<uint32_t>(scale);
+}
+
+const BatchVertex* TessellationCache::Find(const ShapeStore& shapes, ShapeHandle handle, float scale, uint32_t& count)
+{
+    if(storeId != shapes.Id())
+    {
+        Clear();
+        storeId = shapes.Id();
+        return nullptr;
+    }
+
+    auto entry = entries.find(Key(handle, scale));
+    if(entry == entries.end() || entry->second.generation != shapes.Generation(handle)) return nullptr;
+
+    count = entry->second.count;
+    return vertices.data() + entry->second.first;
+}
+
+void TessellationCache::Store(const ShapeStore& shapes, ShapeHandle handle, float scale, const BatchVertex* first, uint32_t count)
+{
+    // A shape taking up a good part of the cache would have it start over
+    // all the time.
+    if(count > MaxCachedVertices/16) return;
+
+    if(storeId != shapes.Id() || vertices.size() + count > MaxCachedVertices)
+    {
+        Clear();
+        storeId = shapes.Id();
+    }
+
+    // A stale entry's vertices stay behind until the cache starts over.
+    entries[Key(handle, scale)] = { (uint32_t)vertices.size(), count, shapes.Generation(handle) };
+    vertices.insert(vertices.end(), first, first + count);
+}
+
+void TessellationCache::Prefill(const ShapeStore& shapes, float scale, ThreadPool& pool)
+{
+    constexpr size_t ChunkShapes = 256;
+
+    std::vector<ShapeHandle> pending;
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        ShapeHandle handle = shapes[position];
+        if(!handle.hidden && Caches(handle.Kind()))
+            pending.push_back(handle);
+    }
+
+    // A round of chunks at a time, so no more than a round's worth of
+    // vertices waits to be stored.
+    size_t chunksPerRound = 4*(pool.Size() + 1);
+    struct Chunk
+    {
+        std::vector<BatchVertex> vertices;
+        std::vector<uint32_t> counts;
+    };
+    std::vector<Chunk> chunks(chunksPerRound);
+
+    for(size_t roundStart = 0; roundStart < pending.size(); roundStart += chunksPerRound*ChunkShapes)
+    {
+        size_t roundEnd = std::min(pending.size(), roundStart + chunksPerRound*ChunkShapes);
+        size_t chunkCount = (roundEnd - roundStart + ChunkShapes - 1)/ChunkShapes;
+
+        pool.ParallelFor(chunkCount, [&](size_t index)
+        {
+            Chunk& chunk = chunks[index];
+            chunk.vertices.clear();
+            chunk.counts.clear();
+
+            ShapeTessellator tessellator;
+            size_t first = roundStart + index*ChunkShapes;
+            for(size_t i = first; i < std::min(roundEnd, first + ChunkShapes); i++)
+            {
+                size_t before = chunk.vertices.size();
+                tessellator.Add(shapes, pending[i], scale, chunk.vertices);
+                chunk.counts.push_back((uint32_t)(chunk.vertices.size() - before));
+            }
+        });
+
+        for(size_t index = 0; index < chunkCount; index++)
+        {
+            const Chunk& chunk = chunks[index];
+            const BatchVertex* cursor = chunk.vertices.data();
+            for(size_t i = 0; i < chunk.counts.size(); i++)
+            {
+                if(vertices.size() + chunk.counts[i] > MaxCachedVertices) return;
+
+                Store(shapes, pending[roundStart + index*ChunkShapes + i], scale, cursor, chunk.counts[i]);
+                cursor += chunk.counts[i];
+            }
+        }
+    }
+}
+
+void TessellationCache::Clear()
+{
+    entries.clear();
+    vertices.clear();
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <unordered_map>
+#include <vector>
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+
+// Vertices a batch holds before it is drawn, 24MB worth.
+constexpr size_t MaxBatchVertices = 1 << 20;
+
+// Vertices the tessellation cache holds before it starts over, 48MB worth.
+constexpr size_t MaxCachedVertices = 2 << 20;
+
+// Flat triangles carry mask (0, 0, -1). Disc quads carry their corner's offset
+// from the center in units of the outer radius, and the inner radius in those
+// units; the shader drops what falls outside the ring.
+struct BatchVertex
+{
+    float x, y;
+    unsigned char r, g, b, a;
+    float u, v, inner;
+};
+
+// Turns shapes into triangles in world space. Holds nothing but scratch
+// space, so one per thread can run at a time.
+class ShapeTessellator
+{
+public:
+    // scale is how many pixels one world unit covers on the target, it sets the
+    // tessellation of ellipses, the width of hairlines and stroke decimation.
+    void Add(const ShapeStore& shapes, ShapeHandle handle, float scale, std::vector<BatchVertex>& out);
+
+private:
+    void PushVertex(Vector2 position, Color color, float u = 0, float v = 0, float inner = -1);
+    void PushTriangle(Vector2 a, Vector2 b, Vector2 c, Color color);
+    void PushQuad(Vector2 a, Vector2 b, Vector2 c, Vector2 d, Color color);
+    void PushSegment(Vector2 a, Vector2 b, float halfWidth, Color color);
+    void PushDisc(Vector2 center, float outer, float inner, Color color);
+    void PushStroke(const Vector2* points, size_t count, float radius, Color color);
+
+    std::vector<BatchVertex>* vertices = nullptr;
+    float scale = 1;
+    std::vector<Vector2> strip;
+    std::vector<Vector2> joins;
+};
+
+// Tessellated ellipses, strokes and fills by shape and scale, the kinds that
+// take real work to turn into triangles (a sine and cosine per ellipse
+// segment, a miter per stroke point). The other kinds are a quad or three
+// and faster to redo than to look up. An entry is stale once its slot was
+// released and reused or the store was cleared or replaced. The cache starts
+// over when full rather than tracking what was used last.
+class TessellationCache
+{
+public:
+    static bool Caches(Shape kind) { return kind == Shape::Ellipse || kind == Shape::FreeHand || kind == Shape::Fill; }
+
+    // The shape's vertices at scale, null when they aren't cached.
+    const BatchVertex* Find(const ShapeStore& shapes, ShapeHandle handle, float scale, uint32_t& count);
+    void Store(const ShapeStore& shapes, ShapeHandle handle, float scale, const BatchVertex* first, uint32_t count);
+
+    // Tessellates the visible shapes the cache takes at scale on the pool,
+    // for a document that was just loaded. Stops once the cache is full.
+    void Prefill(const ShapeStore& shapes, float scale, ThreadPool& pool);
+
+    void Clear();
+    size_t VertexCount() const { return vertices.size(); }
+
+private:
+    struct Entry
+    {
+        uint32_t first;
+        uint32_t count;
+        uint32_t generation;
+    };
+
+    static uint64_t Key(ShapeHandle handle, float scale);
+
+    std::unordered_map<uint64_t, Entry> entries;
+    std::vector<BatchVertex> vertices;
+    uint64_t storeId = 0;
+};
+
+// Draws shapes with a single draw call per MaxBatchVertices vertices instead of
+// one rlgl call per primitive. Every shape kind is turned into triangles in
+// draw order in one persistent vertex buffer; circles, rings and the round
+// caps and joins of strokes are quads cut out by the fragment shader, so they
+// stay round at any size for 6 vertices. Needs a GL context.
+class ShapeBatch
+{
+public:
+    void Load();
+    void Unload();
+    bool IsLoaded() const { return shader.id != 0; }
+
+    // scale is the same as for ShapeTessellator. Shapes the cache has at that
+    // scale are copied from it, the others tessellated and added to it.
+    void Begin(float scale, TessellationCache* cache = nullptr);
+    void Add(const ShapeStore& shapes, ShapeHandle handle);
+
+    // Draws what was added since Begin or the last Flush, with the current
+    // rlgl matrices.
+    void Flush();
+
+    uint32_t DrawCalls() const { return drawCalls; }
+    void ResetDrawCalls() { drawCalls = 0; }
+
+private:
+    void SetAttributes() const;
+
+    Shader shader = {};
+    int mvpLocation = -1;
+    int positionLocation = -1;
+    int colorLocation = -1;
+    int maskLocation = -1;
+    unsigned int vao = 0;
+    unsigned int vbo = 0;
+    size_t capacity = 0;
+
+    float scale = 1;
+    TessellationCache* cache = nullptr;
+    ShapeTessellator tessellator;
+    std::vector<BatchVertex> vertices;
+    uint32_t drawCalls = 0;
+};
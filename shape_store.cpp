@@ -0,0 +1,902 @@
+#include "shape_store.hpp"
+#include "raymath.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// One extra pixel around every box so rasterization rounding stays inside it.
+static Rectangle PaddedBounds(float minX, float minY, float maxX, float maxY, float padding)
+{
+    padding += 1.0f;
+    return { minX - padding, minY - padding, maxX - minX + 2*padding, maxY - minY + 2*padding };
+}
+
+ShapeHandle ShapeStore::CreateStroke(const Vector2* points, size_t count, Color color, int thickness, uint8_t layer)
+{
+    if(strokes.Full()) return InvalidShape;
+
+    float minX = INFINITY, minY = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(IsStrokeBreak(points[i])) continue;
+
+        minX = std::min(minX, points[i].x);
+        minY = std::min(minY, points[i].y);
+        maxX = std::max(maxX, points[i].x);
+        maxY = std::max(maxY, points[i].y);
+    }
+
+    Stroke stroke
+    {
+        (uint32_t)strokePoints.size(),
+        (uint32_t)count,
+        color,
+        thickness,
+        PaddedBounds(minX, minY, maxX, maxY, (float)thickness),
+    };
+    strokePoints.insert(strokePoints.end(), points, points + count);
+
+    return { strokes.Add(stroke), (uint32_t)Shape::FreeHand, 0, layer };
+}
+
+ShapeHandle ShapeStore::AddStroke(const Vector2* points, size_t count, Color color, int thickness, uint8_t layer)
+{
+    ShapeHandle handle = CreateStroke(points, count, color, thickness, layer);
+    if(!handle.hidden)
+        PushBack(handle);
+    return handle;
+}
+
+ShapeHandle ShapeStore::CreateFill(const FillSpan* spans, size_t count, Vector2 origin, float cellSize, Color color, uint8_t layer)
+{
+    if(fills.Full()) return InvalidShape;
+
+    int minX = INT32_MAX, minY = INT32_MAX;
+    int maxX = 0, maxY = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        minX = std::min(minX, (int)spans[i].x);
+        minY = std::min(minY, (int)spans[i].y);
+        maxX = std::max(maxX, spans[i].x + spans[i].width);
+        maxY = std::max(maxY, spans[i].y + spans[i].height);
+    }
+
+    Fill fill
+    {
+        (uint32_t)fillSpans.size(),
+        (uint32_t)count,
+        color,
+        origin,
+        cellSize,
+        PaddedBounds(
+            origin.x + minX*cellSize, origin.y + minY*cellSize,
+            origin.x + maxX*cellSize, origin.y + maxY*cellSize,
+            0
+        ),
+    };
+    fillSpans.insert(fillSpans.end(), spans, spans + count);
+
+    return { fills.Add(fill), (uint32_t)Shape::Fill, 0, layer };
+}
+
+ShapeHandle ShapeStore::AddFill(const FillSpan* spans, size_t count, Vector2 origin, float cellSize, Color color, uint8_t layer)
+{
+    ShapeHandle handle = CreateFill(spans, count, origin, cellSize, color, layer);
+    if(!handle.hidden)
+        PushBack(handle);
+    return handle;
+}
+
+Rectangle ShapeStore::Bounds(ShapeHandle handle) const
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = rects.items[handle.index];
+            if(rect.rotation == 0)
+                return PaddedBounds(rect.x, rect.y, rect.x + rect.width, rect.y + rect.height, 0);
+
+            Vector2 center = rect.Center();
+            float c = std::fabs(std::cos(rect.rotation)), s = std::fabs(std::sin(rect.rotation));
+            float extentX = (c*rect.width + s*rect.height)/2;
+            float extentY = (s*rect.width + c*rect.height)/2;
+            return PaddedBounds(center.x - extentX, center.y - extentY, center.x + extentX, center.y + extentY, 0);
+        }
+
+        case Shape::Circle:
+        {
+            const Circle& circle = circles.items[handle.index];
+            float radius = circle.radius + (circle.filled ? 0 : circle.thickness);
+            return PaddedBounds(
+                circle.center.x - radius, circle.center.y - radius,
+                circle.center.x + radius, circle.center.y + radius,
+                0
+            );
+        }
+
+        case Shape::Ellipse:
+        {
+            const Ellipse& ellipse = ellipses.items[handle.index];
+            float c = std::cos(ellipse.rotation), s = std::sin(ellipse.rotation);
+            float extentX = std::hypot(ellipse.radiusH*c, ellipse.radiusV*s);
+            float extentY = std::hypot(ellipse.radiusH*s, ellipse.radiusV*c);
+            return PaddedBounds(
+                ellipse.center.x - extentX, ellipse.center.y - extentY,
+                ellipse.center.x + extentX, ellipse.center.y + extentY,
+                0
+            );
+        }
+
+        case Shape::Line:
+        {
+            const Line& line = lines.items[handle.index];
+            return PaddedBounds(
+                std::min(line.start.x, line.end.x), std::min(line.start.y, line.end.y),
+                std::max(line.start.x, line.end.x), std::max(line.start.y, line.end.y),
+                line.thickness/2.0f
+            );
+        }
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = triangles.items[handle.index];
+            return PaddedBounds(
+                std::min({triangle.v1.x, triangle.v2.x, triangle.v3.x}),
+                std::min({triangle.v1.y, triangle.v2.y, triangle.v3.y}),
+                std::max({triangle.v1.x, triangle.v2.x, triangle.v3.x}),
+                std::max({triangle.v1.y, triangle.v2.y, triangle.v3.y}),
+                0
+            );
+        }
+
+        case Shape::FreeHand: return strokes.items[handle.index].bounds;
+        case Shape::Fill: return fills.items[handle.index].bounds;
+
+        default: return {};
+    }
+}
+
+static float DistanceToSegment(Vector2 point, Vector2 a, Vector2 b)
+{
+    Vector2 ab = Vector2Subtract(b, a);
+    float lengthSquared = Vector2LengthSqr(ab);
+    float t = 0;
+    if(lengthSquared > 0)
+        t = Clamp(Vector2DotProduct(Vector2Subtract(point, a), ab)/lengthSquared, 0, 1);
+
+    return Vector2Distance(point, Vector2Add(a, Vector2Scale(ab, t)));
+}
+
+static float Cross(Vector2 a, Vector2 b, Vector2 point)
+{
+    return (b.x - a.x)*(point.y - a.y) - (b.y - a.y)*(point.x - a.x);
+}
+
+float ShapeStore::Distance(ShapeHandle handle, Vector2 point) const
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = rects.items[handle.index];
+            if(rect.rotation != 0)
+                point = Vector2Add(RotateVector(Vector2Subtract(point, rect.Center()), -rect.rotation), rect.Center());
+
+            float dx = std::max({rect.x - point.x, 0.0f, point.x - (rect.x + rect.width)});
+            float dy = std::max({rect.y - point.y, 0.0f, point.y - (rect.y + rect.height)});
+            float outside = std::hypot(dx, dy);
+            if(rect.filled || outside > 0) return outside;
+
+            // Outlines are drawn inwards, inside the rectangle only the border band counts.
+            float inside = std::min({
+                point.x - rect.x, rect.x + rect.width - point.x,
+                point.y - rect.y, rect.y + rect.height - point.y,
+            });
+            return std::max(0.0f, inside - rect.thickness);
+        }
+
+        case Shape::Circle:
+        {
+            const Circle& circle = circles.items[handle.index];
+            float distance = Vector2Distance(point, circle.center);
+            if(circle.filled) return std::max(0.0f, distance - circle.radius);
+            if(distance < circle.radius) return circle.radius - distance;
+
+            return std::max(0.0f, distance - circle.radius - circle.thickness);
+        }
+
+        case Shape::Ellipse:
+        {
+            // Approximation, exact point to ellipse distance has no closed form.
+            const Ellipse& ellipse = ellipses.items[handle.index];
+            float radiusH = std::max(ellipse.radiusH, 1e-3f);
+            float radiusV = std::max(ellipse.radiusV, 1e-3f);
+            Vector2 local = RotateVector(Vector2Subtract(point, ellipse.center), -ellipse.rotation);
+            float k = std::hypot(local.x/radiusH, local.y/radiusV);
+            if(ellipse.filled && k <= 1) return 0;
+
+            return std::fabs(k - 1)*std::min(radiusH, radiusV);
+        }
+
+        case Shape::Line:
+        {
+            const Line& line = lines.items[handle.index];
+            return std::max(0.0f, DistanceToSegment(point, line.start, line.end) - line.thickness/2.0f);
+        }
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = triangles.items[handle.index];
+            if(triangle.filled)
+            {
+                float d1 = Cross(triangle.v1, triangle.v2, point);
+                float d2 = Cross(triangle.v2, triangle.v3, point);
+                float d3 = Cross(triangle.v3, triangle.v1, point);
+                bool negative = d1 < 0 || d2 < 0 || d3 < 0;
+                bool positive = d1 > 0 || d2 > 0 || d3 > 0;
+                if(!(negative && positive)) return 0;
+            }
+
+            return std::min({
+                DistanceToSegment(point, triangle.v1, triangle.v2),
+                DistanceToSegment(point, triangle.v2, triangle.v3),
+                DistanceToSegment(point, triangle.v3, triangle.v1),
+            });
+        }
+
+        case Shape::FreeHand:
+        {
+            const Stroke& stroke = strokes.items[handle.index];
+            float distance = INFINITY;
+            ForEachStrokeRun(StrokePoints(stroke), stroke.pointCount, [&](const Vector2* run, size_t count)
+            {
+                distance = std::min(distance, Vector2Distance(point, run[0]));
+                for(size_t i = 1; i < count; i++)
+                    distance = std::min(distance, DistanceToSegment(point, run[i - 1], run[i]));
+            });
+
+            return std::max(0.0f, distance - stroke.thickness);
+        }
+
+        case Shape::Fill:
+        {
+            const Fill& fill = fills.items[handle.index];
+            const FillSpan* spans = FillSpans(fill);
+            float x = (point.x - fill.origin.x)/fill.cellSize;
+            float y = (point.y - fill.origin.y)/fill.cellSize;
+            float distance = INFINITY;
+            for(uint32_t i = 0; i < fill.spanCount && distance > 0; i++)
+            {
+                const FillSpan& span = spans[i];
+                float dx = std::max({span.x - x, 0.0f, x - (span.x + span.width)});
+                float dy = std::max({span.y - y, 0.0f, y - (span.y + span.height)});
+                distance = std::min(distance, std::hypot(dx, dy));
+            }
+
+            return distance*fill.cellSize;
+        }
+
+        default: return INFINITY;
+    }
+}
+
+bool ShapeStore::Intersects(ShapeHandle handle, Vector2 a, Vector2 b, float radius) const
+{
+    Rectangle bounds = Bounds(handle);
+    Rectangle swept
+    {
+        std::min(a.x, b.x) - radius,
+        std::min(a.y, b.y) - radius,
+        std::fabs(b.x - a.x) + 2*radius,
+        std::fabs(b.y - a.y) + 2*radius,
+    };
+    if(!CheckCollisionRecs(bounds, swept)) return false;
+
+    // Sample the drag densely enough that consecutive brush circles overlap.
+    float step = std::max(radius, 1.0f);
+    int samples = std::max(1, (int)std::ceil(Vector2Distance(a, b)/step));
+    for(int i = 0; i <= samples; i++)
+    {
+        if(Distance(handle, Vector2Lerp(a, b, i/(float)samples)) <= radius)
+            return true;
+    }
+
+    return false;
+}
+
+ShapeHandle ShapeStore::EraseFromStroke(ShapeHandle handle, Vector2 a, Vector2 b, float radius)
+{
+    const Stroke stroke = strokes.items[handle.index];
+    float limit = radius + stroke.thickness;
+    float step = std::max(radius/2, 1.0f);
+    bool erasedAny = false;
+
+    erasedPoints.clear();
+    ForEachStrokeRun(StrokePoints(stroke), stroke.pointCount, [&](const Vector2* run, size_t count)
+    {
+        bool open = false;
+        auto emit = [&](Vector2 point)
+        {
+            if(!open && !erasedPoints.empty())
+                erasedPoints.push_back(StrokeBreak);
+            erasedPoints.push_back(point);
+            open = true;
+        };
+
+        // Segments are walked in brush sized steps so a cut lands close to
+        // the brush edge even when the stroke points are far apart.
+        Vector2 previous = run[0];
+        bool previousKept = DistanceToSegment(previous, a, b) > limit;
+        bool previousEmitted = previousKept;
+        if(previousKept)
+            emit(previous);
+        else
+            erasedAny = true;
+
+        for(size_t i = 1; i < count; i++)
+        {
+            int steps = std::max(1, (int)std::ceil(Vector2Distance(run[i - 1], run[i])/step));
+            for(int k = 1; k <= steps; k++)
+            {
+                Vector2 sample = Vector2Lerp(run[i - 1], run[i], k/(float)steps);
+                bool kept = DistanceToSegment(sample, a, b) > limit;
+                bool emitted = false;
+
+                if(kept && (!previousKept || k == steps))
+                {
+                    emit(sample);
+                    emitted = true;
+                }
+                else if(!kept)
+                {
+                    if(previousKept && !previousEmitted)
+                        emit(previous);
+                    open = false;
+                    erasedAny = true;
+                }
+
+                previous = sample;
+                previousKept = kept;
+                previousEmitted = emitted;
+            }
+        }
+    });
+
+    if(!erasedAny) return handle;
+
+    if(erasedPoints.empty())
+    {
+        ShapeHandle hidden = handle;
+        hidden.hidden = 1;
+        return hidden;
+    }
+
+    // Without a slot for what is left the stroke stays whole.
+    ShapeHandle erased = CreateStroke(erasedPoints.data(), erasedPoints.size(), stroke.color, stroke.thickness, (uint8_t)handle.layer);
+    return erased.hidden ? handle : erased;
+}
+
+// Rectangles and ellipses keep their own axes, a scale that would skew them
+// (along the world axes while they are turned) stretches those axes instead.
+ShapeHandle ShapeStore::TransformShape(ShapeHandle handle, const ShapeTransform& transform)
+{
+    uint8_t layer = (uint8_t)handle.layer;
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            Rect rect = rects.items[handle.index];
+            Vector2 center = transform.Apply(rect.Center());
+            Vector2 across = transform.ApplyVector(RotateVector({ rect.width, 0 }, rect.rotation));
+            Vector2 down = transform.ApplyVector(RotateVector({ 0, rect.height }, rect.rotation));
+            rect.width = Vector2Length(across);
+            rect.height = Vector2Length(down);
+            rect.rotation = std::atan2(across.y, across.x);
+            rect.x = center.x - rect.width/2;
+            rect.y = center.y - rect.height/2;
+            return Create(rect, layer);
+        }
+
+        case Shape::Circle:
+        {
+            Circle circle = circles.items[handle.index];
+            circle.center = transform.Apply(circle.center);
+            float scaleX = std::fabs(transform.scale.x), scaleY = std::fabs(transform.scale.y);
+            if(std::fabs(scaleX - scaleY) <= 1e-4f*std::max(scaleX, scaleY))
+            {
+                circle.radius *= scaleX;
+                return Create(circle, layer);
+            }
+
+            // Stretched one way more than the other it is no circle anymore.
+            Ellipse ellipse(circle.center, circle.radius*scaleX, circle.radius*scaleY, circle.color, circle.thickness, circle.filled, transform.rotation);
+            return Create(ellipse, layer);
+        }
+
+        case Shape::Ellipse:
+        {
+            Ellipse ellipse = ellipses.items[handle.index];
+            ellipse.center = transform.Apply(ellipse.center);
+            Vector2 across = transform.ApplyVector(RotateVector({ ellipse.radiusH, 0 }, ellipse.rotation));
+            Vector2 down = transform.ApplyVector(RotateVector({ 0, ellipse.radiusV }, ellipse.rotation));
+            ellipse.radiusH = Vector2Length(across);
+            ellipse.radiusV = Vector2Length(down);
+            ellipse.rotation = std::atan2(across.y, across.x);
+            return Create(ellipse, layer);
+        }
+
+        case Shape::Line:
+        {
+            Line line = lines.items[handle.index];
+            line.start = transform.Apply(line.start);
+            line.end = transform.Apply(line.end);
+            return Create(line, layer);
+        }
+
+        case Shape::Triangle:
+        {
+            Triangle triangle = triangles.items[handle.index];
+            triangle.v1 = transform.Apply(triangle.v1);
+            triangle.v2 = transform.Apply(triangle.v2);
+            triangle.v3 = transform.Apply(triangle.v3);
+            return Create(triangle, layer);
+        }
+
+        case Shape::FreeHand:
+        {
+            const Stroke stroke = strokes.items[handle.index];
+            const Vector2* points = StrokePoints(stroke);
+            erasedPoints.resize(stroke.pointCount);
+            for(uint32_t i = 0; i < stroke.pointCount; i++)
+                erasedPoints[i] = IsStrokeBreak(points[i]) ? points[i] : transform.Apply(points[i]);
+
+            return CreateStroke(erasedPoints.data(), erasedPoints.size(), stroke.color, stroke.thickness, layer);
+        }
+
+        case Shape::Fill:
+        {
+            // Spans stay on a square grid, fills only move and scale uniformly
+            // about their center.
+            const Fill fill = fills.items[handle.index];
+            float scale = std::sqrt(std::fabs(transform.scale.x*transform.scale.y));
+            Vector2 center = { fill.bounds.x + fill.bounds.width/2, fill.bounds.y + fill.bounds.height/2 };
+            Vector2 moved = transform.Apply(center);
+            Vector2 origin = Vector2Add(moved, Vector2Scale(Vector2Subtract(fill.origin, center), scale));
+
+            const FillSpan* spans = FillSpans(fill);
+            copiedSpans.assign(spans, spans + fill.spanCount);
+            return CreateFill(copiedSpans.data(), copiedSpans.size(), origin, fill.cellSize*scale, fill.color, layer);
+        }
+
+        default: return handle;
+    }
+}
+
+ShapeHandle ShapeStore::RecolorShape(ShapeHandle handle, Color color)
+{
+    uint8_t layer = (uint8_t)handle.layer;
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: { Rect rect = rects.items[handle.index]; rect.color = color; return Create(rect, layer); }
+        case Shape::Circle: { Circle circle = circles.items[handle.index]; circle.color = color; return Create(circle, layer); }
+        case Shape::Ellipse: { Ellipse ellipse = ellipses.items[handle.index]; ellipse.color = color; return Create(ellipse, layer); }
+        case Shape::Line: { Line line = lines.items[handle.index]; line.color = color; return Create(line, layer); }
+        case Shape::Triangle: { Triangle triangle = triangles.items[handle.index]; triangle.color = color; return Create(triangle, layer); }
+
+        case Shape::FreeHand:
+        {
+            const Stroke stroke = strokes.items[handle.index];
+            const Vector2* points = StrokePoints(stroke);
+            erasedPoints.assign(points, points + stroke.pointCount);
+            return CreateStroke(erasedPoints.data(), erasedPoints.size(), color, stroke.thickness, layer);
+        }
+
+        case Shape::Fill:
+        {
+            const Fill fill = fills.items[handle.index];
+            const FillSpan* spans = FillSpans(fill);
+            copiedSpans.assign(spans, spans + fill.spanCount);
+            return CreateFill(copiedSpans.data(), copiedSpans.size(), fill.origin, fill.cellSize, color, layer);
+        }
+
+        default: return handle;
+    }
+}
+
+ShapeHandle ShapeStore::PopBack()
+{
+    ShapeHandle handle = order.back();
+    if(!handle.hidden)
+        grids[handle.layer].Remove((uint32_t)(order.size() - 1), Bounds(handle));
+
+    order.pop_back();
+    unchangedCount = std::min(unchangedCount, order.size());
+    return handle;
+}
+
+void ShapeStore::PushBack(ShapeHandle handle)
+{
+    order.push_back(handle);
+    if(!handle.hidden)
+        grids[handle.layer].Insert((uint32_t)(order.size() - 1), Bounds(handle));
+}
+
+void ShapeStore::Replace(size_t position, ShapeHandle handle)
+{
+    ShapeHandle previous = order[position];
+    if(!previous.hidden)
+        grids[previous.layer].Remove((uint32_t)position, Bounds(previous));
+
+    order[position] = handle;
+    if(!handle.hidden)
+        grids[handle.layer].Insert((uint32_t)position, Bounds(handle));
+
+    if(position < unchangedCount)
+        replacedPositions.push_back((uint32_t)position);
+}
+
+void ShapeStore::TakeChanges(ShapeChanges& changes)
+{
+    changes.stableCount = unchangedCount;
+    changes.replaced.clear();
+    std::swap(changes.replaced, replacedPositions);
+    unchangedCount = order.size();
+
+    // Erasing replaces the same positions over and over.
+    std::sort(changes.replaced.begin(), changes.replaced.end());
+    changes.replaced.erase(std::unique(changes.replaced.begin(), changes.replaced.end()), changes.replaced.end());
+}
+
+void ShapeChanges::Merge(const ShapeChanges& later)
+{
+    // Positions at or past either stable count are pushed again anyway.
+    stableCount = std::min(stableCount, later.stableCount);
+    replaced.insert(replaced.end(), later.replaced.begin(), later.replaced.end());
+    std::sort(replaced.begin(), replaced.end());
+    replaced.erase(std::unique(replaced.begin(), replaced.end()), replaced.end());
+    replaced.erase(std::lower_bound(replaced.begin(), replaced.end(), (uint32_t)stableCount), replaced.end());
+}
+
+void ShapeStore::Query(Rectangle area, std::vector<uint32_t>& out) const
+{
+    for(const Layer& layer: layers)
+        Query(area, layer.id, out);
+}
+
+void ShapeStore::Query(Rectangle area, uint8_t layer, std::vector<uint32_t>& out) const
+{
+    size_t first = out.size();
+    grids[layer].Query(area, out);
+
+    out.erase(
+        std::remove_if(out.begin() + first, out.end(), [&](uint32_t position)
+        {
+            return !CheckCollisionRecs(area, Bounds(order[position]));
+        }),
+        out.end()
+    );
+}
+
+bool ShapeStore::Any(Rectangle area, uint8_t layer) const
+{
+    return grids[layer].Any(area, [&](uint32_t position)
+    {
+        return CheckCollisionRecs(area, Bounds(order[position]));
+    });
+}
+
+const Layer* ShapeStore::FindLayer(uint8_t id) const
+{
+    for(const Layer& layer: layers)
+    {
+        if(layer.id == id) return &layer;
+    }
+
+    return nullptr;
+}
+
+Layer* ShapeStore::FindLayer(uint8_t id)
+{
+    return const_cast<Layer*>(static_cast<const ShapeStore*>(this)->FindLayer(id));
+}
+
+int ShapeStore::AddLayer(std::string name)
+{
+    for(int id = 0; id < MaxLayers; id++)
+    {
+        if(FindLayer((uint8_t)id) != nullptr) continue;
+
+        Layer layer;
+        layer.id = (uint8_t)id;
+        layer.name = std::move(name);
+        layers.push_back(std::move(layer));
+        return id;
+    }
+
+    return -1;
+}
+
+void ShapeStore::MoveLayer(uint8_t id, bool up)
+{
+    for(size_t i = 0; i < layers.size(); i++)
+    {
+        if(layers[i].id != id) continue;
+
+        if(up && i + 1 < layers.size())
+            std::swap(layers[i], layers[i + 1]);
+        else if(!up && i > 0)
+            std::swap(layers[i], layers[i - 1]);
+        return;
+    }
+}
+
+template<typename T>
+static void Append(std::vector<unsigned char>& out, const T& value)
+{
+    const unsigned char* bytes = (const unsigned char*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static T Take(const unsigned char*& cursor)
+{
+    T value;
+    std::memcpy((void*)&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return value;
+}
+
+void ShapeStore::Serialize(ShapeHandle handle, std::vector<unsigned char>& out) const
+{
+    out.push_back((unsigned char)(handle.kind | handle.layer << 4));
+
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: Append(out, rects.items[handle.index]); break;
+        case Shape::Circle: Append(out, circles.items[handle.index]); break;
+        case Shape::Ellipse: Append(out, ellipses.items[handle.index]); break;
+        case Shape::Line: Append(out, lines.items[handle.index]); break;
+        case Shape::Triangle: Append(out, triangles.items[handle.index]); break;
+
+        case Shape::FreeHand:
+        {
+            const Stroke& stroke = strokes.items[handle.index];
+            Append(out, stroke);
+
+            const unsigned char* points = (const unsigned char*)StrokePoints(stroke);
+            out.insert(out.end(), points, points + stroke.pointCount*sizeof(Vector2));
+        } break;
+
+        case Shape::Fill:
+        {
+            const Fill& fill = fills.items[handle.index];
+            Append(out, fill);
+
+            const unsigned char* spans = (const unsigned char*)FillSpans(fill);
+            out.insert(out.end(), spans, spans + fill.spanCount*sizeof(FillSpan));
+        } break;
+
+        default: {}
+    }
+}
+
+ShapeHandle ShapeStore::Deserialize(const unsigned char*& cursor)
+{
+    Shape kind = (Shape)(*cursor & 0x0F);
+    uint8_t layer = *cursor++ >> 4;
+
+    switch(kind)
+    {
+        case Shape::Rectangle: return Create(Take<Rect>(cursor), layer);
+        case Shape::Circle: return Create(Take<Circle>(cursor), layer);
+        case Shape::Ellipse: return Create(Take<Ellipse>(cursor), layer);
+        case Shape::Line: return Create(Take<Line>(cursor), layer);
+        case Shape::Triangle: return Create(Take<Triangle>(cursor), layer);
+
+        case Shape::FreeHand:
+        {
+            // The blob has no alignment guarantees, copy the points out first.
+            Stroke stroke = Take<Stroke>(cursor);
+            erasedPoints.resize(stroke.pointCount);
+            std::memcpy(erasedPoints.data(), cursor, stroke.pointCount*sizeof(Vector2));
+            cursor += stroke.pointCount*sizeof(Vector2);
+            return CreateStroke(erasedPoints.data(), stroke.pointCount, stroke.color, stroke.thickness, layer);
+        }
+
+        case Shape::Fill:
+        {
+            Fill fill = Take<Fill>(cursor);
+            copiedSpans.resize(fill.spanCount);
+            std::memcpy(copiedSpans.data(), cursor, fill.spanCount*sizeof(FillSpan));
+            cursor += fill.spanCount*sizeof(FillSpan);
+            return CreateFill(copiedSpans.data(), fill.spanCount, fill.origin, fill.cellSize, fill.color, layer);
+        }
+
+        default: return {};
+    }
+}
+
+size_t ShapeStore::ShapeBytes(ShapeHandle handle) const
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: return sizeof(Rect);
+        case Shape::Circle: return sizeof(Circle);
+        case Shape::Ellipse: return sizeof(Ellipse);
+        case Shape::Line: return sizeof(Line);
+        case Shape::Triangle: return sizeof(Triangle);
+        case Shape::FreeHand: return sizeof(Stroke) + strokes.items[handle.index].pointCount*sizeof(Vector2);
+        case Shape::Fill: return sizeof(Fill) + fills.items[handle.index].spanCount*sizeof(FillSpan);
+        default: return 0;
+    }
+}
+
+void ShapeStore::Release(ShapeHandle handle)
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: rects.Release(handle.index); break;
+        case Shape::Circle: circles.Release(handle.index); break;
+        case Shape::Ellipse: ellipses.Release(handle.index); break;
+        case Shape::Line: lines.Release(handle.index); break;
+        case Shape::Triangle: triangles.Release(handle.index); break;
+
+        case Shape::FreeHand:
+        {
+            Stroke& stroke = strokes.items[handle.index];
+            deadStrokePoints += stroke.pointCount;
+            stroke.pointCount = 0;
+            strokes.Release(handle.index);
+
+            if(deadStrokePoints > strokePoints.size()/2)
+                CompactStrokePoints();
+        } break;
+
+        case Shape::Fill:
+        {
+            Fill& fill = fills.items[handle.index];
+            deadFillSpans += fill.spanCount;
+            fill.spanCount = 0;
+            fills.Release(handle.index);
+
+            if(deadFillSpans > fillSpans.size()/2)
+                CompactFillSpans();
+        } break;
+
+        default: {}
+    }
+}
+
+uint64_t ShapeStore::NextId()
+{
+    static std::atomic<uint64_t> next = 1;
+    return next++;
+}
+
+uint32_t ShapeStore::Generation(ShapeHandle handle) const
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle: return rects.generations[handle.index];
+        case Shape::Circle: return circles.generations[handle.index];
+        case Shape::Ellipse: return ellipses.generations[handle.index];
+        case Shape::Line: return lines.generations[handle.index];
+        case Shape::Triangle: return triangles.generations[handle.index];
+        case Shape::FreeHand: return strokes.generations[handle.index];
+        case Shape::Fill: return fills.generations[handle.index];
+        default: return 0;
+    }
+}
+
+void ShapeStore::Clear()
+{
+    id = NextId();
+    order.clear();
+    unchangedCount = 0;
+    replacedPositions.clear();
+    for(SpatialGrid& grid: grids)
+        grid.Clear();
+    layers = DefaultLayers();
+    rects.Clear();
+    circles.Clear();
+    ellipses.Clear();
+    lines.Clear();
+    triangles.Clear();
+    strokes.Clear();
+    fills.Clear();
+    strokePoints.clear();
+    deadStrokePoints = 0;
+    fillSpans.clear();
+    deadFillSpans = 0;
+}
+
+void ShapeStore::Reserve(const uint32_t* kindCounts, size_t pointCount)
+{
+    strokes.Reserve(kindCounts[(int)Shape::FreeHand]);
+    rects.Reserve(kindCounts[(int)Shape::Rectangle]);
+    circles.Reserve(kindCounts[(int)Shape::Circle]);
+    lines.Reserve(kindCounts[(int)Shape::Line]);
+    ellipses.Reserve(kindCounts[(int)Shape::Ellipse]);
+    triangles.Reserve(kindCounts[(int)Shape::Triangle]);
+    fills.Reserve(kindCounts[(int)Shape::Fill]);
+
+    size_t shapeCount = 0;
+    for(int kind = (int)Shape::FreeHand; kind <= (int)Shape::Fill; kind++)
+        shapeCount += kindCounts[kind];
+
+    order.reserve(order.size() + shapeCount);
+    strokePoints.reserve(strokePoints.size() + pointCount);
+}
+
+// Released strokes leave holes in strokePoints. Once they make up more than
+// half of it, the live ranges are slid down over them.
+void ShapeStore::CompactStrokePoints()
+{
+    std::vector<Vector2> compacted;
+    compacted.reserve(strokePoints.size() - deadStrokePoints);
+
+    for(Stroke& stroke: strokes.items)
+    {
+        if(stroke.pointCount == 0) continue;
+
+        uint32_t first = (uint32_t)compacted.size();
+        compacted.insert(
+            compacted.end(),
+            strokePoints.begin() + stroke.firstPoint,
+            strokePoints.begin() + stroke.firstPoint + stroke.pointCount
+        );
+        stroke.firstPoint = first;
+    }
+
+    strokePoints = std::move(compacted);
+    deadStrokePoints = 0;
+}
+
+void ShapeStore::CompactFillSpans()
+{
+    std::vector<FillSpan> compacted;
+    compacted.reserve(fillSpans.size() - deadFillSpans);
+
+    for(Fill& fill: fills.items)
+    {
+        if(fill.spanCount == 0) continue;
+
+        uint32_t first = (uint32_t)compacted.size();
+        compacted.insert(
+            compacted.end(),
+            fillSpans.begin() + fill.firstSpan,
+            fillSpans.begin() + fill.firstSpan + fill.spanCount
+        );
+        fill.firstSpan = first;
+    }
+
+    fillSpans = std::move(compacted);
+    deadFillSpans = 0;
+}
+
+size_t ShapeStore::BytesUsed() const
+{
+    size_t gridBytes = 0;
+    for(const SpatialGrid& grid: grids)
+        gridBytes += grid.BytesUsed();
+
+    return order.capacity()*sizeof(ShapeHandle)
+        + gridBytes
+        + rects.BytesUsed()
+        + circles.BytesUsed()
+        + ellipses.BytesUsed()
+        + lines.BytesUsed()
+        + triangles.BytesUsed()
+        + strokes.BytesUsed()
+        + fills.BytesUsed()
+        + strokePoints.capacity()*sizeof(Vector2)
+        + fillSpans.capacity()*sizeof(FillSpan)
+        + erasedPoints.capacity()*sizeof(Vector2)
+        + copiedSpans.capacity()*sizeof(FillSpan);
+}
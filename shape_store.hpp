@@ -0,0 +1,279 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "layers.hpp"
+#include "shapes.hpp"
+#include "spatial_index.hpp"
+
+// 4 byte reference to a shape: which pool it lives in, its slot there and the
+// layer it is on. The hidden bit belongs to the draw order entry, erased
+// shapes keep their place so undo can show them again.
+struct ShapeHandle
+{
+    uint32_t index : 23;
+    uint32_t kind : 4;
+    uint32_t hidden : 1;
+    uint32_t layer : 4;
+
+    Shape Kind() const { return (Shape)kind; }
+    bool SameShape(ShapeHandle other) const { return index == other.index && kind == other.kind; }
+};
+
+// Slots the index field can address in one pool.
+constexpr uint32_t MaxShapesPerKind = 1u << 23;
+
+// What Create* return once the pool of that kind is full: hidden, so it is
+// never drawn, and never to be pushed or released.
+constexpr ShapeHandle InvalidShape = { 0, 0, 1, 0 };
+
+// Contiguous array of one shape kind. Released slots are reused by later adds,
+// each release bumps the slot's generation.
+template<typename T>
+struct ShapePool
+{
+    std::vector<T> items;
+    std::vector<uint32_t> generations;
+    std::vector<uint32_t> freeSlots;
+
+    bool Full() const { return freeSlots.empty() && items.size() >= MaxShapesPerKind; }
+
+    // Check Full first, a full pool has no index left to hand out.
+    uint32_t Add(const T& item)
+    {
+        if(!freeSlots.empty())
+        {
+            uint32_t index = freeSlots.back();
+            freeSlots.pop_back();
+            items[index] = item;
+            return index;
+        }
+
+        items.push_back(item);
+        generations.push_back(0);
+        return (uint32_t)(items.size() - 1);
+    }
+
+    void Release(uint32_t index)
+    {
+        generations[index]++;
+        freeSlots.push_back(index);
+    }
+
+    void Reserve(size_t count)
+    {
+        items.reserve(items.size() + count);
+        generations.reserve(generations.size() + count);
+    }
+
+    void Clear()
+    {
+        items.clear();
+        generations.clear();
+        freeSlots.clear();
+    }
+
+    size_t BytesUsed() const
+    {
+        return items.capacity()*sizeof(T) + (generations.capacity() + freeSlots.capacity())*sizeof(uint32_t);
+    }
+};
+
+// Owns every shape of the document in per-kind pools, the z-ordered list of
+// handles that says in which order they are drawn, and the layers. Layers are
+// drawn bottom to top, the shapes of each in draw order. Visible entries are
+// indexed by position in one SpatialGrid per layer.
+// Draw order changes between two TakeChanges calls. Entries from stableCount
+// on were popped or pushed, replaced lists positions that were swapped,
+// sorted and each once.
+struct ShapeChanges
+{
+    size_t stableCount = 0;
+    std::vector<uint32_t> replaced;
+
+    // Folds changes taken later into these, for a follower that skipped a few.
+    void Merge(const ShapeChanges& later);
+};
+
+class ShapeStore
+{
+public:
+    // Create* only allocate the shape, Add* also put it on top of the draw order.
+    // Both return InvalidShape when MaxShapesPerKind of the kind exist.
+    template<typename T>
+    ShapeHandle Create(const T& shape, uint8_t layer = 0)
+    {
+        if(Pool<T>().Full()) return InvalidShape;
+        return { Pool<T>().Add(shape), (uint32_t)KindOf<T>(), 0, layer };
+    }
+
+    template<typename T>
+    ShapeHandle Add(const T& shape, uint8_t layer = 0)
+    {
+        ShapeHandle handle = Create(shape, layer);
+        if(!handle.hidden)
+            PushBack(handle);
+        return handle;
+    }
+
+    ShapeHandle CreateStroke(const Vector2* points, size_t count, Color color, int thickness, uint8_t layer = 0);
+    ShapeHandle AddStroke(const Vector2* points, size_t count, Color color, int thickness, uint8_t layer = 0);
+    ShapeHandle CreateFill(const FillSpan* spans, size_t count, Vector2 origin, float cellSize, Color color, uint8_t layer = 0);
+    ShapeHandle AddFill(const FillSpan* spans, size_t count, Vector2 origin, float cellSize, Color color, uint8_t layer = 0);
+
+    template<typename T>
+    const T& Get(ShapeHandle handle) const { return Pool<T>().items[handle.index]; }
+
+    // Shapes never change once created. Together with the id of the store,
+    // which changes when it is cleared, the generation of a shape's slot
+    // tells whether something derived from it still is.
+    uint64_t Id() const { return id; }
+    uint32_t Generation(ShapeHandle handle) const;
+
+    const Vector2* StrokePoints(const Stroke& stroke) const { return strokePoints.data() + stroke.firstPoint; }
+    const FillSpan* FillSpans(const Fill& fill) const { return fillSpans.data() + fill.firstSpan; }
+
+    // Area a shape can touch when drawn, including its outline thickness.
+    Rectangle Bounds(ShapeHandle handle) const;
+
+    // Distance from point to the painted area of a shape, 0 when inside it.
+    float Distance(ShapeHandle handle, Vector2 point) const;
+
+    // Whether a brush of the given radius dragged from a to b touches the shape.
+    bool Intersects(ShapeHandle handle, Vector2 a, Vector2 b, float radius) const;
+
+    size_t Count() const { return order.size(); }
+    ShapeHandle operator[](size_t i) const { return order[i]; }
+    bool IsVisible(size_t position) const { return !order[position].hidden; }
+
+    // Removes the top-most handle from the draw order, the shape itself stays
+    // allocated so it can be pushed back (redo) or released later.
+    ShapeHandle PopBack();
+    void PushBack(ShapeHandle handle);
+
+    // Swaps the entry at position for another handle (or the same one with the
+    // hidden bit flipped). The previous shape stays allocated.
+    void Replace(size_t position, ShapeHandle handle);
+
+    // Draw order changes since the last call. Paint takes them once a frame
+    // for the journal and the mirror.
+    void TakeChanges(ShapeChanges& changes);
+
+    // Positions of the visible shapes whose bounds overlap area, layer by
+    // layer from the bottom and in draw order within a layer. Hidden layers
+    // are included, skipping them is up to whoever draws.
+    void Query(Rectangle area, std::vector<uint32_t>& out) const;
+    void Query(Rectangle area, uint8_t layer, std::vector<uint32_t>& out) const;
+
+    // Whether Query would find anything on the layer, stopping at the first.
+    bool Any(Rectangle area, uint8_t layer) const;
+
+    // Layers bottom to top, there is always at least one.
+    const std::vector<Layer>& Layers() const { return layers; }
+    const Layer* FindLayer(uint8_t id) const;
+    Layer* FindLayer(uint8_t id);
+
+    // Adds a layer on top of the others and returns its id, -1 once there are
+    // MaxLayers of them.
+    int AddLayer(std::string name);
+
+    // Moves a layer one place up (towards the top) or down the stack.
+    void MoveLayer(uint8_t id, bool up);
+
+    // Replaces the layers, for loading. Shapes keep pointing at the ids.
+    void SetLayers(std::vector<Layer> loaded) { layers = std::move(loaded); }
+
+    // Stroke made of what is left of a stroke after a brush of the given radius
+    // was dragged from a to b across it. Returns a hidden handle when nothing
+    // is left and the stroke itself when the brush missed it.
+    ShapeHandle EraseFromStroke(ShapeHandle handle, Vector2 a, Vector2 b, float radius);
+
+    // Copies of a shape moved, scaled and rotated, or in another color. Both
+    // allocate a new shape and leave the original alone, like EraseFromStroke.
+    ShapeHandle TransformShape(ShapeHandle handle, const ShapeTransform& transform);
+    ShapeHandle RecolorShape(ShapeHandle handle, Color color);
+
+    // Raw copy of one shape (stroke points and fill spans included) appended to out, and the
+    // inverse which allocates the shape again and advances cursor past it.
+    void Serialize(ShapeHandle handle, std::vector<unsigned char>& out) const;
+    ShapeHandle Deserialize(const unsigned char*& cursor);
+
+    // Memory one shape takes in its pool, points and spans included.
+    size_t ShapeBytes(ShapeHandle handle) const;
+
+    // Frees the storage of a shape that is no longer part of the draw order.
+    void Release(ShapeHandle handle);
+    void Clear();
+
+    // Grows the pools ahead of a bulk load, kindCounts is indexed by Shape.
+    void Reserve(const uint32_t* kindCounts, size_t pointCount);
+
+    size_t BytesUsed() const;
+
+private:
+    template<typename T>
+    static constexpr Shape KindOf()
+    {
+        if constexpr (std::is_same_v<T, Rect>) return Shape::Rectangle;
+        else if constexpr (std::is_same_v<T, Circle>) return Shape::Circle;
+        else if constexpr (std::is_same_v<T, Ellipse>) return Shape::Ellipse;
+        else if constexpr (std::is_same_v<T, Line>) return Shape::Line;
+        else if constexpr (std::is_same_v<T, Triangle>) return Shape::Triangle;
+        else if constexpr (std::is_same_v<T, Fill>) return Shape::Fill;
+        else return Shape::FreeHand;
+    }
+
+    template<typename T>
+    ShapePool<T>& Pool()
+    {
+        return const_cast<ShapePool<T>&>(static_cast<const ShapeStore*>(this)->Pool<T>());
+    }
+
+    template<typename T>
+    const ShapePool<T>& Pool() const
+    {
+        if constexpr (std::is_same_v<T, Rect>) return rects;
+        else if constexpr (std::is_same_v<T, Circle>) return circles;
+        else if constexpr (std::is_same_v<T, Ellipse>) return ellipses;
+        else if constexpr (std::is_same_v<T, Line>) return lines;
+        else if constexpr (std::is_same_v<T, Triangle>) return triangles;
+        else if constexpr (std::is_same_v<T, Fill>) return fills;
+        else return strokes;
+    }
+
+    void CompactStrokePoints();
+    void CompactFillSpans();
+
+    static std::vector<Layer> DefaultLayers() { return { Layer{ 0, "Layer 1" } }; }
+    static uint64_t NextId();
+
+    uint64_t id = NextId();
+    std::vector<ShapeHandle> order;
+    size_t unchangedCount = 0;
+    std::vector<uint32_t> replacedPositions;
+    SpatialGrid grids[MaxLayers];
+    std::vector<Layer> layers = DefaultLayers();
+
+    ShapePool<Rect> rects;
+    ShapePool<Circle> circles;
+    ShapePool<Ellipse> ellipses;
+    ShapePool<Line> lines;
+    ShapePool<Triangle> triangles;
+    ShapePool<Stroke> strokes;
+    ShapePool<Fill> fills;
+
+    // Points of every stroke back to back, a stroke references its range.
+    std::vector<Vector2> strokePoints;
+    size_t deadStrokePoints = 0;
+
+    // Same for the spans of every fill.
+    std::vector<FillSpan> fillSpans;
+    size_t deadFillSpans = 0;
+
+    // Scratch buffers for EraseFromStroke, TransformShape, RecolorShape and Deserialize.
+    std::vector<Vector2> erasedPoints;
+    std::vector<FillSpan> copiedSpans;
+};
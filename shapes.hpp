@@ -1,16 +1,79 @@
 #pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <raylib.h>
 
-struct FreeHandPoint
+enum class Shape
 {
-    Vector2 pos;
+    FreeHand = 0,
+    Rectangle,
+    Circle,
+    Line,
+    Ellipse,
+    Triangle,
+    Fill,
+    Erase,
+    Select,
+};
+
+// Freehand polyline, its points live in the ShapeStore point pool. A stroke
+// the eraser cut into pieces keeps a single entry, with StrokeBreak points
+// separating the runs.
+struct Stroke
+{
+    uint32_t firstPoint;
+    uint32_t pointCount;
     Color color;
     int thickness;
+    Rectangle bounds;
+};
+
+// Cells a bucket fill covered, identical runs on consecutive rows merged into
+// one rectangle.
+struct FillSpan
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
 
-    FreeHandPoint(Vector2 pos, Color color, int thickness)
-        : pos(pos), color(color), thickness(thickness) {}
+// Bucket fill, made on the grid of screen pixels it was clicked on: cell (0, 0)
+// starts at origin and cells are cellSize world units wide. Its spans live in
+// the ShapeStore span pool.
+struct Fill
+{
+    uint32_t firstSpan;
+    uint32_t spanCount;
+    Color color;
+    Vector2 origin;
+    float cellSize;
+    Rectangle bounds;
 };
 
+constexpr Vector2 StrokeBreak = { std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::quiet_NaN() };
+
+inline bool IsStrokeBreak(Vector2 point) { return std::isnan(point.x); }
+
+// Calls fn(first, count) for every unbroken run of points.
+template<typename F>
+void ForEachStrokeRun(const Vector2* points, size_t count, F&& fn)
+{
+    size_t runStart = 0;
+    for(size_t i = 0; i <= count; i++)
+    {
+        if(i < count && !IsStrokeBreak(points[i])) continue;
+
+        if(i > runStart)
+            fn(points + runStart, i - runStart);
+        runStart = i + 1;
+    }
+}
+
+// Rotated by rotation radians about its center, x and y are the top left
+// corner before that.
 struct Rect
 {
     float x;
@@ -20,9 +83,13 @@ struct Rect
     Color color;
     int thickness;
     bool filled;
+    float rotation;
+
+    Rect() = default;
+    Rect(float x, float y, float width, float height, Color color, int thickness, bool filled, float rotation = 0)
+        : x(x), y(y), width(width), height(height), color(color), thickness(thickness), filled(filled), rotation(rotation) {}
 
-    Rect(float x, float y, float width, float height, Color color, int thickness, bool filled)
-        : x(x), y(y), width(width), height(height), color(color), thickness(thickness), filled(filled) {}
+    Vector2 Center() const { return { x + width/2, y + height/2 }; }
 };
 
 struct Circle
@@ -33,6 +100,7 @@ struct Circle
     int thickness;
     bool filled;
 
+    Circle() = default;
     Circle(Vector2 center, float radius, Color color, int thickness, bool filled)
         : center(center), radius(radius), color(color), thickness(thickness), filled(filled) {}
 };
@@ -50,6 +118,7 @@ struct Triangle
         : v1(v1), v2(v2), v3(v3), color(color), filled(filled) {}
 };
 
+// radiusH runs along the x axis turned by rotation radians.
 struct Ellipse
 {
     Vector2 center;
@@ -58,9 +127,11 @@ struct Ellipse
     Color color;
     int thickness;
     bool filled;
+    float rotation;
 
-    Ellipse(Vector2 center, float radiusH, float radiusV, Color color, int thickness, bool filled)
-        : center(center), radiusH(radiusH), radiusV(radiusV), color(color), thickness(thickness), filled(filled) {}
+    Ellipse() = default;
+    Ellipse(Vector2 center, float radiusH, float radiusV, Color color, int thickness, bool filled, float rotation = 0)
+        : center(center), radiusH(radiusH), radiusV(radiusV), color(color), thickness(thickness), filled(filled), rotation(rotation) {}
 };
 
 struct Line
@@ -70,6 +141,38 @@ struct Line
     Color color;
     int thickness;
 
+    Line() = default;
     Line(Vector2 start, Vector2 end, Color color, int thickness)
         : start(start), end(end), color(color), thickness(thickness) {}
 };
+
+// Turns v by angle radians, clockwise on screen since y points down.
+inline Vector2 RotateVector(Vector2 v, float angle)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    return { v.x*c - v.y*s, v.x*s + v.y*c };
+}
+
+// What the selection tool does to shapes: scale about pivot along the world
+// axes, rotate about it, then move by offset.
+struct ShapeTransform
+{
+    Vector2 pivot = { 0, 0 };
+    Vector2 scale = { 1, 1 };
+    float rotation = 0;
+    Vector2 offset = { 0, 0 };
+
+    // For directions and sizes, leaves out pivot and offset.
+    Vector2 ApplyVector(Vector2 v) const { return RotateVector({ v.x*scale.x, v.y*scale.y }, rotation); }
+
+    Vector2 Apply(Vector2 point) const
+    {
+        Vector2 v = ApplyVector({ point.x - pivot.x, point.y - pivot.y });
+        return { pivot.x + v.x + offset.x, pivot.y + v.y + offset.y };
+    }
+
+    bool IsIdentity() const
+    {
+        return scale.x == 1 && scale.y == 1 && rotation == 0 && offset.x == 0 && offset.y == 0;
+    }
+};
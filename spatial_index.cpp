@@ -0,0 +1,109 @@
+#include "spatial_index.hpp"
+#include <algorithm>
+#include <cmath>
+
+static void RemoveId(std::vector<uint32_t>& ids, uint32_t id)
+{
+    auto it = std::find(ids.begin(), ids.end(), id);
+    if(it == ids.end()) return;
+
+    *it = ids.back();
+    ids.pop_back();
+}
+
+SpatialGrid::CellRange SpatialGrid::CellsOf(Rectangle area)
+{
+    return {
+        (int)std::floor(area.x/GridCellSize),
+        (int)std::floor(area.y/GridCellSize),
+        (int)std::floor((area.x + area.width)/GridCellSize),
+        (int)std::floor((area.y + area.height)/GridCellSize),
+    };
+}
+
+void SpatialGrid::Insert(uint32_t id, Rectangle bounds)
+{
+    CellRange range = CellsOf(bounds);
+    if(range.Count() > MaxCellsPerEntry)
+    {
+        oversized.push_back(id);
+        return;
+    }
+
+    for(int y = range.firstY; y <= range.lastY; y++)
+        for(int x = range.firstX; x <= range.lastX; x++)
+            cells[CellKey(x, y)].push_back(id);
+}
+
+void SpatialGrid::Remove(uint32_t id, Rectangle bounds)
+{
+    CellRange range = CellsOf(bounds);
+    if(range.Count() > MaxCellsPerEntry)
+    {
+        RemoveId(oversized, id);
+        return;
+    }
+
+    for(int y = range.firstY; y <= range.lastY; y++)
+    {
+        for(int x = range.firstX; x <= range.lastX; x++)
+        {
+            auto cell = cells.find(CellKey(x, y));
+            if(cell == cells.end()) continue;
+
+            RemoveId(cell->second, id);
+            if(cell->second.empty())
+                cells.erase(cell);
+        }
+    }
+}
+
+void SpatialGrid::Query(Rectangle area, std::vector<uint32_t>& out) const
+{
+    size_t first = out.size();
+    CellRange range = CellsOf(area);
+
+    if(range.Count() > (int64_t)cells.size())
+    {
+        // Querying more cells than exist, walk the occupied ones instead.
+        for(const auto& [key, ids]: cells)
+        {
+            int x = (int)(int32_t)(key >> 32);
+            int y = (int)(int32_t)(key & 0xFFFFFFFF);
+            if(x >= range.firstX && x <= range.lastX && y >= range.firstY && y <= range.lastY)
+                out.insert(out.end(), ids.begin(), ids.end());
+        }
+    }
+    else
+    {
+        for(int y = range.firstY; y <= range.lastY; y++)
+        {
+            for(int x = range.firstX; x <= range.lastX; x++)
+            {
+                auto cell = cells.find(CellKey(x, y));
+                if(cell != cells.end())
+                    out.insert(out.end(), cell->second.begin(), cell->second.end());
+            }
+        }
+    }
+
+    out.insert(out.end(), oversized.begin(), oversized.end());
+
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
+
+void SpatialGrid::Clear()
+{
+    cells.clear();
+    oversized.clear();
+}
+
+size_t SpatialGrid::BytesUsed() const
+{
+    size_t bytes = oversized.capacity()*sizeof(uint32_t);
+    for(const auto& [key, ids]: cells)
+        bytes += sizeof(key) + sizeof(ids) + ids.capacity()*sizeof(uint32_t);
+
+    return bytes;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <raylib.h>
+#include <unordered_map>
+#include <vector>
+
+constexpr float GridCellSize = 128.0f;
+
+// Shapes that would cover more cells than this are kept in one flat list
+// instead, so a huge rectangle doesn't cost thousands of cell entries.
+constexpr int MaxCellsPerEntry = 64;
+
+// Sparse uniform grid over bounding boxes. Entries are identified by a caller
+// chosen id, the ShapeStore uses the shape's position in the draw order.
+class SpatialGrid
+{
+public:
+    void Insert(uint32_t id, Rectangle bounds);
+    void Remove(uint32_t id, Rectangle bounds);
+
+    // Appends the ids of every entry whose cells overlap area, sorted and
+    // without duplicates. Cells are coarse, callers still test exact bounds.
+    void Query(Rectangle area, std::vector<uint32_t>& out) const;
+
+    // Whether test accepts any of the ids Query would return, without
+    // collecting them. Ids in several cells may be tested more than once.
+    template<typename Fn>
+    bool Any(Rectangle area, Fn&& test) const;
+
+    void Clear();
+    size_t BytesUsed() const;
+
+private:
+    struct CellRange
+    {
+        int firstX, firstY, lastX, lastY;
+
+        int64_t Count() const { return (int64_t)(lastX - firstX + 1)*(lastY - firstY + 1); }
+    };
+
+    static CellRange CellsOf(Rectangle area);
+    static uint64_t CellKey(int x, int y) { return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y; }
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    std::vector<uint32_t> oversized;
+};
+
+template<typename Fn>
+bool SpatialGrid::Any(Rectangle area, Fn&& test) const
+{
+    for(uint32_t id: oversized)
+    {
+        if(test(id)) return true;
+    }
+
+    auto anyInCell = [&](const std::vector<uint32_t>& ids)
+    {
+        for(uint32_t id: ids)
+        {
+            if(test(id)) return true;
+        }
+        return false;
+    };
+
+    CellRange range = CellsOf(area);
+    if(range.Count() > (int64_t)cells.size())
+    {
+        for(const auto& [key, ids]: cells)
+        {
+            int x = (int)(int32_t)(key >> 32);
+            int y = (int)(int32_t)(key & 0xFFFFFFFF);
+            if(x >= range.firstX && x <= range.lastX && y >= range.firstY && y <= range.lastY && anyInCell(ids))
+                return true;
+        }
+        return false;
+    }
+
+    for(int y = range.firstY; y <= range.lastY; y++)
+    {
+        for(int x = range.firstX; x <= range.lastX; x++)
+        {
+            auto cell = cells.find(CellKey(x, y));
+            if(cell != cells.end() && anyInCell(cell->second))
+                return true;
+        }
+    }
+    return false;
+}
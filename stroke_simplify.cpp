@@ -0,0 +1,124 @@
+#include "stroke_simplify.hpp"
+#include "raymath.h"
+#include <algorithm>
+#include <cmath>
+
+// Caps the cost of an add on long straight runs, where nothing gets kept.
+constexpr size_t MaxWindow = 256;
+
+float StrokeTolerance(int thickness)
+{
+    return std::clamp(0.1f*(float)thickness, 0.25f, 1.5f);
+}
+
+static float DistanceToSegmentSquared(Vector2 point, Vector2 a, Vector2 b)
+{
+    Vector2 ab = Vector2Subtract(b, a);
+    float length = Vector2DotProduct(ab, ab);
+    float t = length > 0 ? std::clamp(Vector2DotProduct(Vector2Subtract(point, a), ab)/length, 0.0f, 1.0f) : 0.0f;
+    return Vector2DistanceSqr(point, Vector2Add(a, Vector2Scale(ab, t)));
+}
+
+void StrokeSimplifier::Begin(Vector2 point, float tolerance)
+{
+    toleranceSquared = tolerance*tolerance;
+    points.clear();
+    points.push_back(point);
+    keptCount = 1;
+    window.clear();
+}
+
+void StrokeSimplifier::Add(Vector2 point)
+{
+    if(points.empty())
+    {
+        points.push_back(point);
+        keptCount = 1;
+        return;
+    }
+
+    window.push_back(point);
+    Vector2 anchor = points[keptCount - 1];
+
+    bool fits = window.size() <= MaxWindow;
+    for(size_t i = 0; i + 1 < window.size() && fits; i++)
+        fits = DistanceToSegmentSquared(window[i], anchor, point) <= toleranceSquared;
+
+    if(fits)
+    {
+        points.resize(keptCount);
+    }
+    else
+    {
+        // The previous input point is the last one the segment could reach.
+        keptCount++;
+        window.erase(window.begin(), window.end() - 1);
+    }
+
+    points.push_back(point);
+}
+
+void StrokeSimplifier::Clear()
+{
+    points.clear();
+    keptCount = 0;
+    window.clear();
+}
+
+void SmoothStroke(const Vector2* points, size_t count, float tolerance, std::vector<Vector2>& out)
+{
+    out.clear();
+    if(count == 0) return;
+    out.push_back(points[0]);
+
+    for(size_t i = 0; i + 1 < count; i++)
+    {
+        Vector2 p0 = points[i == 0 ? 0 : i - 1];
+        Vector2 p1 = points[i];
+        Vector2 p2 = points[i + 1];
+        Vector2 p3 = points[i + 2 < count ? i + 2 : i + 1];
+
+        // Centripetal parameterization (alpha 0.5) as Bezier control points,
+        // it never loops or cusps within a segment.
+        float d1 = std::sqrt(Vector2Distance(p0, p1));
+        float d2 = std::sqrt(Vector2Distance(p1, p2));
+        float d3 = std::sqrt(Vector2Distance(p2, p3));
+        if(d2 < 1e-4f) continue;
+
+        Vector2 b1 = p1;
+        if(d1 > 1e-4f)
+        {
+            b1 = Vector2Scale(
+                Vector2Add(Vector2Subtract(Vector2Scale(p2, d1*d1), Vector2Scale(p0, d2*d2)),
+                    Vector2Scale(p1, 2*d1*d1 + 3*d1*d2 + d2*d2)),
+                1.0f/(3*d1*(d1 + d2)));
+        }
+
+        Vector2 b2 = p2;
+        if(d3 > 1e-4f)
+        {
+            b2 = Vector2Scale(
+                Vector2Add(Vector2Subtract(Vector2Scale(p1, d3*d3), Vector2Scale(p3, d2*d2)),
+                    Vector2Scale(p2, 2*d3*d3 + 3*d3*d2 + d2*d2)),
+                1.0f/(3*d3*(d3 + d2)));
+        }
+
+        // Wang's formula: segments needed for a cubic to stay within tolerance
+        // of its flattening.
+        Vector2 dd1 = Vector2Add(Vector2Subtract(p1, Vector2Scale(b1, 2)), b2);
+        Vector2 dd2 = Vector2Add(Vector2Subtract(b1, Vector2Scale(b2, 2)), p2);
+        float bend = std::max(Vector2Length(dd1), Vector2Length(dd2));
+        int segments = std::clamp((int)std::ceil(std::sqrt(0.75f*bend/tolerance)), 1, 64);
+
+        for(int s = 1; s < segments; s++)
+        {
+            float t = (float)s/segments;
+            float u = 1 - t;
+            Vector2 point = Vector2Add(
+                Vector2Add(Vector2Scale(p1, u*u*u), Vector2Scale(b1, 3*u*u*t)),
+                Vector2Add(Vector2Scale(b2, 3*u*t*t), Vector2Scale(p2, t*t*t)));
+            out.push_back(point);
+        }
+        out.push_back(p2);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <raylib.h>
+#include <vector>
+
+// How far a simplified stroke may stray from the input, a fraction of its
+// width so thick strokes shed more points than thin ones.
+float StrokeTolerance(int thickness);
+
+// Douglas-Peucker style simplification done while the stroke is drawn. Input
+// points are dropped as long as every one of them since the last kept point
+// lies within tolerance of the segment from that point to the newest input.
+// The first point that breaks this keeps its predecessor. The newest point
+// is always part of Points() so the preview follows the mouse.
+class StrokeSimplifier
+{
+public:
+    void Begin(Vector2 point, float tolerance);
+    void Add(Vector2 point);
+    void Clear();
+
+    bool Empty() const { return points.empty(); }
+    const Vector2* Points() const { return points.data(); }
+    size_t Count() const { return points.size(); }
+    Vector2 Last() const { return points.back(); }
+
+private:
+    float toleranceSquared = 0;
+
+    // Kept points, then the newest input point when it wasn't kept yet.
+    std::vector<Vector2> points;
+    size_t keptCount = 0;
+
+    // Input points since the last kept one, compared against each new segment.
+    std::vector<Vector2> window;
+};
+
+// Replaces a polyline by the centripetal Catmull-Rom spline through its
+// points, cut into as few segments as keep it within tolerance of the curve.
+void SmoothStroke(const Vector2* points, size_t count, float tolerance, std::vector<Vector2>& out);
@@ -0,0 +1,690 @@
+#include "svg.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+// raylib is built without SVG support, so nanosvg's implementation lives
+// here.
+#define NANOSVG_IMPLEMENTATION
+#if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wunused-function"
+    #pragma GCC diagnostic ignored "-Wsign-compare"
+    #pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+#include "external/nanosvg.h"
+#if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+#endif
+
+// Bytes buffered before SaveSvg writes them out.
+constexpr size_t SvgChunkSize = 256*1024;
+
+// Bezier segments a single cubic is flattened into at most.
+constexpr int MaxCurveSegments = 256;
+
+struct SvgWriter
+{
+    std::FILE* file = nullptr;
+    std::string buffer;
+    bool failed = false;
+
+    void Text(const char* text)
+    {
+        buffer += text;
+        if(buffer.size() >= SvgChunkSize)
+            Flush();
+    }
+
+    // Two decimals without the trailing zeros, a hundredth of a pixel is
+    // below anything the canvas shows.
+    void Number(float value)
+    {
+        char digits[32];
+        int length = std::snprintf(digits, sizeof(digits), "%.2f", value);
+        while(length > 0 && digits[length - 1] == '0') length--;
+        if(length > 0 && digits[length - 1] == '.') length--;
+        digits[length] = '\0';
+        Text(std::strcmp(digits, "-0") == 0 ? "0" : digits);
+    }
+
+    void Attribute(const char* name, float value)
+    {
+        Text(" ");
+        Text(name);
+        Text("=\"");
+        Number(value);
+        Text("\"");
+    }
+
+    void Point(const char* command, Vector2 point)
+    {
+        Text(command);
+        Number(point.x);
+        Text(" ");
+        Number(point.y);
+    }
+
+    // fill="#rrggbb", with fill-opacity when it isn't opaque. Same for stroke.
+    void Paint(const char* name, Color color)
+    {
+        char hex[16];
+        std::snprintf(hex, sizeof(hex), "#%02x%02x%02x", color.r, color.g, color.b);
+        Text(" ");
+        Text(name);
+        Text("=\"");
+        Text(hex);
+        Text("\"");
+
+        if(color.a != 255)
+        {
+            char opacity[32];
+            std::snprintf(opacity, sizeof(opacity), "%s-opacity", name);
+            Attribute(opacity, color.a/255.0f);
+        }
+    }
+
+    void Escaped(const std::string& text)
+    {
+        for(char c: text)
+        {
+            switch(c)
+            {
+                case '&': Text("&amp;"); break;
+                case '<': Text("&lt;"); break;
+                case '>': Text("&gt;"); break;
+                case '"': Text("&quot;"); break;
+                default:
+                {
+                    char single[2] = { c, '\0' };
+                    Text(single);
+                }
+            }
+        }
+    }
+
+    void Flush()
+    {
+        if(!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+            failed = true;
+        buffer.clear();
+    }
+};
+
+static void WriteRotation(SvgWriter& out, float rotation, Vector2 center)
+{
+    if(rotation == 0) return;
+
+    out.Text(" transform=\"rotate(");
+    out.Number(rotation*RAD2DEG);
+    out.Text(" ");
+    out.Number(center.x);
+    out.Text(" ");
+    out.Number(center.y);
+    out.Text(")\"");
+}
+
+// Outlines the canvas draws as hairlines stay one pixel wide however the
+// SVG is scaled.
+static void WriteHairline(SvgWriter& out, Color color)
+{
+    out.Text(" fill=\"none\"");
+    out.Paint("stroke", color);
+    out.Text(" stroke-width=\"1\" vector-effect=\"non-scaling-stroke\"");
+}
+
+// Sizes match what ShapeBatch draws: rectangle outlines lie inside the
+// rectangle, circle outlines outside the circle.
+static void WriteShape(SvgWriter& out, const ShapeStore& shapes, ShapeHandle handle)
+{
+    switch(handle.Kind())
+    {
+        case Shape::Rectangle:
+        {
+            const Rect& rect = shapes.Get<Rect>(handle);
+            float band = rect.filled ? 0 : std::min((float)rect.thickness, std::min(rect.width, rect.height)/2);
+            if(!rect.filled && band <= 0) break;
+
+            out.Text("<rect");
+            out.Attribute("x", rect.x + band/2);
+            out.Attribute("y", rect.y + band/2);
+            out.Attribute("width", rect.width - band);
+            out.Attribute("height", rect.height - band);
+            if(rect.filled)
+            {
+                out.Paint("fill", rect.color);
+            }
+            else
+            {
+                out.Text(" fill=\"none\"");
+                out.Paint("stroke", rect.color);
+                out.Attribute("stroke-width", band);
+            }
+            WriteRotation(out, rect.rotation, rect.Center());
+            out.Text("/>\n");
+        } break;
+
+        case Shape::Circle:
+        {
+            const Circle& circle = shapes.Get<Circle>(handle);
+            out.Text("<circle");
+            out.Attribute("cx", circle.center.x);
+            out.Attribute("cy", circle.center.y);
+            if(circle.filled)
+            {
+                out.Attribute("r", circle.radius);
+                out.Paint("fill", circle.color);
+            }
+            else
+            {
+                out.Attribute("r", circle.radius + circle.thickness/2.0f);
+                out.Text(" fill=\"none\"");
+                out.Paint("stroke", circle.color);
+                out.Attribute("stroke-width", (float)circle.thickness);
+            }
+            out.Text("/>\n");
+        } break;
+
+        case Shape::Ellipse:
+        {
+            const Ellipse& ellipse = shapes.Get<Ellipse>(handle);
+            out.Text("<ellipse");
+            out.Attribute("cx", ellipse.center.x);
+            out.Attribute("cy", ellipse.center.y);
+            out.Attribute("rx", ellipse.radiusH);
+            out.Attribute("ry", ellipse.radiusV);
+            if(ellipse.filled)
+                out.Paint("fill", ellipse.color);
+            else
+                WriteHairline(out, ellipse.color);
+            WriteRotation(out, ellipse.rotation, ellipse.center);
+            out.Text("/>\n");
+        } break;
+
+        case Shape::Line:
+        {
+            const Line& line = shapes.Get<Line>(handle);
+            out.Text("<line");
+            out.Attribute("x1", line.start.x);
+            out.Attribute("y1", line.start.y);
+            out.Attribute("x2", line.end.x);
+            out.Attribute("y2", line.end.y);
+            out.Paint("stroke", line.color);
+            out.Attribute("stroke-width", (float)line.thickness);
+            out.Text("/>\n");
+        } break;
+
+        case Shape::Triangle:
+        {
+            const Triangle& triangle = shapes.Get<Triangle>(handle);
+            out.Text("<polygon points=\"");
+            for(Vector2 vertex: { triangle.v1, triangle.v2, triangle.v3 })
+            {
+                out.Number(vertex.x);
+                out.Text(",");
+                out.Number(vertex.y);
+                out.Text(" ");
+            }
+            out.Text("\"");
+            if(triangle.filled)
+                out.Paint("fill", triangle.color);
+            else
+                WriteHairline(out, triangle.color);
+            out.Text("/>\n");
+        } break;
+
+        case Shape::FreeHand:
+        {
+            // Thickness is the stroke's radius. A run of a single point is a
+            // dot, which round caps draw for a zero length segment.
+            const Stroke& stroke = shapes.Get<Stroke>(handle);
+            out.Text("<path d=\"");
+            ForEachStrokeRun(shapes.StrokePoints(stroke), stroke.pointCount, [&](const Vector2* run, size_t count)
+            {
+                out.Point("M", run[0]);
+                if(count == 1)
+                    out.Text("h0");
+                for(size_t i = 1; i < count; i++)
+                    out.Point("L", run[i]);
+            });
+            out.Text("\" fill=\"none\"");
+            out.Paint("stroke", stroke.color);
+            out.Attribute("stroke-width", 2.0f*stroke.thickness);
+            out.Text(" stroke-linecap=\"round\" stroke-linejoin=\"round\"/>\n");
+        } break;
+
+        case Shape::Fill:
+        {
+            const Fill& fill = shapes.Get<Fill>(handle);
+            const FillSpan* spans = shapes.FillSpans(fill);
+            out.Text("<path d=\"");
+            for(uint32_t i = 0; i < fill.spanCount; i++)
+            {
+                out.Point("M", { fill.origin.x + spans[i].x*fill.cellSize, fill.origin.y + spans[i].y*fill.cellSize });
+                out.Text("h");
+                out.Number(spans[i].width*fill.cellSize);
+                out.Text("v");
+                out.Number(spans[i].height*fill.cellSize);
+                out.Text("h");
+                out.Number(-spans[i].width*fill.cellSize);
+                out.Text("z");
+            }
+            out.Text("\"");
+            out.Paint("fill", fill.color);
+            out.Text(" shape-rendering=\"crispEdges\"/>\n");
+        } break;
+
+        default: {}
+    }
+}
+
+static const char* BlendName(LayerBlend blend)
+{
+    switch(blend)
+    {
+        case LayerBlend::Multiply: return "multiply";
+        case LayerBlend::Add: return "plus-lighter";
+        case LayerBlend::Screen: return "screen";
+        default: return nullptr;
+    }
+}
+
+bool SaveSvg(const ShapeStore& shapes, const char* path)
+{
+    float minX = INFINITY, minY = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    for(size_t position = 0; position < shapes.Count(); position++)
+    {
+        if(!shapes.IsVisible(position)) continue;
+
+        Rectangle bounds = shapes.Bounds(shapes[position]);
+        minX = std::min(minX, bounds.x);
+        minY = std::min(minY, bounds.y);
+        maxX = std::max(maxX, bounds.x + bounds.width);
+        maxY = std::max(maxY, bounds.y + bounds.height);
+    }
+    if(minX > maxX)
+    {
+        minX = minY = 0;
+        maxX = maxY = 1;
+    }
+
+    std::FILE* file = std::fopen(path, "wb");
+    if(file == nullptr)
+    {
+        TraceLog(LOG_WARNING, "SVG: Failed to open %s for writing", path);
+        return false;
+    }
+
+    SvgWriter out;
+    out.file = file;
+    out.buffer.reserve(SvgChunkSize + 4096);
+    out.Text("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\"");
+    out.Text(" viewBox=\"");
+    out.Number(minX);
+    out.Text(" ");
+    out.Number(minY);
+    out.Text(" ");
+    out.Number(maxX - minX);
+    out.Text(" ");
+    out.Number(maxY - minY);
+    out.Text("\"");
+    out.Attribute("width", maxX - minX);
+    out.Attribute("height", maxY - minY);
+    out.Text(">\n");
+
+    // Layers composite bottom to top like the canvas does, so shapes are
+    // grouped by layer rather than in draw order.
+    for(const Layer& layer: shapes.Layers())
+    {
+        out.Text("<g");
+        if(layer.opacity < 1)
+            out.Attribute("opacity", layer.opacity);
+        if(!layer.visible)
+            out.Text(" display=\"none\"");
+        if(const char* blend = BlendName(layer.blend))
+        {
+            out.Text(" style=\"mix-blend-mode:");
+            out.Text(blend);
+            out.Text("\"");
+        }
+        out.Text(">\n<title>");
+        out.Escaped(layer.name);
+        out.Text("</title>\n");
+
+        for(size_t position = 0; position < shapes.Count(); position++)
+        {
+            ShapeHandle handle = shapes[position];
+            if(!handle.hidden && handle.layer == layer.id)
+                WriteShape(out, shapes, handle);
+        }
+
+        out.Text("</g>\n");
+    }
+
+    out.Text("</svg>\n");
+    out.Flush();
+
+    bool closed = std::fclose(file) == 0;
+    bool saved = !out.failed && closed;
+    if(saved)
+        TraceLog(LOG_INFO, "SVG: Saved %s", path);
+    else
+        TraceLog(LOG_WARNING, "SVG: Failed to write %s", path);
+    return saved;
+}
+
+struct SvgImport::Job
+{
+    std::string path;
+    Vector2 position;
+    std::atomic<float> progress = 0.0f;
+    std::atomic<bool> cancelled = false;
+    std::atomic<bool> finished = false;
+
+    // Written by the worker before finished is set.
+    bool imported = false;
+    std::vector<unsigned char> shapes;
+    uint32_t shapeCount = 0;
+    Rectangle area = { 0, 0, 0, 0 };
+};
+
+// Every path of an SVG shape as one polyline, StrokeBreak between paths.
+// Wang's formula picks the segment count that keeps each flattened cubic
+// within SvgCurveTolerance. Closed paths end on their first point again.
+static void FlattenPaths(const NSVGshape& shape, Vector2 offset, std::vector<Vector2>& points)
+{
+    points.clear();
+    for(const NSVGpath* path = shape.paths; path != nullptr; path = path->next)
+    {
+        if(path->npts < 1) continue;
+        if(!points.empty())
+            points.push_back(StrokeBreak);
+
+        Vector2 first = { path->pts[0] + offset.x, path->pts[1] + offset.y };
+        points.push_back(first);
+        for(int i = 0; i + 3 < path->npts; i += 3)
+        {
+            const float* p = &path->pts[i*2];
+            float ax = p[0] - 2*p[2] + p[4], ay = p[1] - 2*p[3] + p[5];
+            float bx = p[2] - 2*p[4] + p[6], by = p[3] - 2*p[5] + p[7];
+            float bend = std::sqrt(std::max(ax*ax + ay*ay, bx*bx + by*by));
+            int segments = std::clamp((int)std::ceil(std::sqrt(0.75f*bend/SvgCurveTolerance)), 1, MaxCurveSegments);
+
+            for(int j = 1; j <= segments; j++)
+            {
+                float t = (float)j/segments, u = 1 - t;
+                float w0 = u*u*u, w1 = 3*u*u*t, w2 = 3*u*t*t, w3 = t*t*t;
+                points.push_back({
+                    w0*p[0] + w1*p[2] + w2*p[4] + w3*p[6] + offset.x,
+                    w0*p[1] + w1*p[3] + w2*p[5] + w3*p[7] + offset.y,
+                });
+            }
+        }
+
+        if(path->closed)
+            points.push_back(first);
+    }
+}
+
+struct ScanEdge
+{
+    float top, bottom;
+    float x, slope;
+    int winding;
+};
+
+// Cells whose centers are inside the polylines (each taken as closed) with
+// the given fill rule, as spans merged across identical rows the way
+// FloodFill merges them. Works down the rows with an active edge list, so
+// each row only looks at the edges crossing it.
+static bool ScanFill(const std::vector<Vector2>& points, bool evenOdd, const std::atomic<bool>& cancelled,
+    Vector2& origin, float& cellSize, std::vector<FillSpan>& spans)
+{
+    spans.clear();
+
+    std::vector<ScanEdge> edges;
+    float minX = INFINITY, minY = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    ForEachStrokeRun(points.data(), points.size(), [&](const Vector2* run, size_t count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            Vector2 a = run[i], b = run[(i + 1)%count];
+            minX = std::min(minX, a.x);
+            minY = std::min(minY, a.y);
+            maxX = std::max(maxX, a.x);
+            maxY = std::max(maxY, a.y);
+            if(a.y == b.y) continue;
+
+            int winding = a.y < b.y ? 1 : -1;
+            if(b.y < a.y) std::swap(a, b);
+            edges.push_back({ a.y, b.y, a.x, (b.x - a.x)/(b.y - a.y), winding });
+        }
+    });
+    if(edges.empty()) return false;
+
+    cellSize = SvgFillCellSize;
+    while((maxX - minX)/cellSize > 65535 || (maxY - minY)/cellSize > 65535)
+        cellSize *= 2;
+
+    origin = { minX, minY };
+    int columns = std::max(1, (int)std::ceil((maxX - minX)/cellSize));
+    int rows = std::max(1, (int)std::ceil((maxY - minY)/cellSize));
+
+    std::sort(edges.begin(), edges.end(), [](const ScanEdge& a, const ScanEdge& b) { return a.top < b.top; });
+
+    std::vector<uint32_t> active;
+    std::vector<std::pair<float, int>> crossings;
+    std::vector<std::pair<int, int>> runs;
+    std::vector<uint32_t> above, current;
+    size_t nextEdge = 0;
+    for(int row = 0; row < rows; row++)
+    {
+        if(row%256 == 0 && cancelled) return false;
+
+        float y = origin.y + (row + 0.5f)*cellSize;
+        while(nextEdge < edges.size() && edges[nextEdge].top <= y)
+            active.push_back((uint32_t)nextEdge++);
+        active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t i) { return edges[i].bottom <= y; }), active.end());
+
+        crossings.clear();
+        for(uint32_t i: active)
+            crossings.push_back({ edges[i].x + (y - edges[i].top)*edges[i].slope, edges[i].winding });
+        std::sort(crossings.begin(), crossings.end());
+
+        // Columns whose centers lie between a crossing and the next, runs
+        // that touch (overlapping subpaths) joined.
+        runs.clear();
+        int winding = 0;
+        for(size_t i = 0; i + 1 < crossings.size(); i++)
+        {
+            winding += crossings[i].second;
+            bool inside = evenOdd ? (winding & 1) != 0 : winding != 0;
+            if(!inside) continue;
+
+            int x = std::clamp((int)std::ceil((crossings[i].first - origin.x)/cellSize - 0.5f), 0, columns);
+            int end = std::clamp((int)std::ceil((crossings[i + 1].first - origin.x)/cellSize - 0.5f), 0, columns);
+            if(end <= x) continue;
+
+            if(!runs.empty() && runs.back().second >= x)
+                runs.back().second = std::max(runs.back().second, end);
+            else
+                runs.push_back({ x, end });
+        }
+
+        current.clear();
+        size_t next = 0;
+        for(auto [x, end]: runs)
+        {
+            while(next < above.size() && spans[above[next]].x < x)
+                next++;
+
+            if(next < above.size() && spans[above[next]].x == x && spans[above[next]].width == end - x)
+            {
+                spans[above[next]].height++;
+                current.push_back(above[next]);
+            }
+            else
+            {
+                current.push_back((uint32_t)spans.size());
+                spans.push_back({ (uint16_t)x, (uint16_t)row, (uint16_t)(end - x), 1 });
+            }
+        }
+
+        std::swap(above, current);
+    }
+
+    return !spans.empty();
+}
+
+// nanosvg colors are 0xAABBGGRR. Gradients become their first stop.
+static Color SvgColor(const NSVGpaint& paint, float opacity)
+{
+    unsigned int color = 0;
+    if(paint.type == NSVG_PAINT_COLOR)
+        color = paint.color;
+    else if(paint.gradient != nullptr && paint.gradient->nstops > 0)
+        color = paint.gradient->stops[0].color;
+
+    return {
+        (unsigned char)(color & 0xFF),
+        (unsigned char)(color >> 8 & 0xFF),
+        (unsigned char)(color >> 16 & 0xFF),
+        (unsigned char)std::lround((color >> 24)*std::clamp(opacity, 0.0f, 1.0f)),
+    };
+}
+
+SvgImport::~SvgImport()
+{
+    Cancel();
+}
+
+void SvgImport::Start(ThreadPool& pool, std::string path, Vector2 position)
+{
+    Cancel();
+
+    job = std::make_shared<Job>();
+    job->path = std::move(path);
+    job->position = position;
+
+    std::shared_ptr<Job> running = job;
+    pool.Submit([running]()
+    {
+        running->imported = Import(*running);
+        running->progress = 1.0f;
+        running->finished = true;
+    });
+}
+
+void SvgImport::Cancel()
+{
+    if(job)
+        job->cancelled = true;
+    job.reset();
+}
+
+float SvgImport::Progress() const
+{
+    return job ? job->progress.load() : 0.0f;
+}
+
+bool SvgImport::Finish(ShapeStore& shapes, uint8_t layer, std::vector<ShapeHandle>& added, Rectangle& area)
+{
+    if(!job || !job->finished) return false;
+
+    std::shared_ptr<Job> done = std::move(job);
+    if(!done->imported) return false;
+
+    const unsigned char* cursor = done->shapes.data();
+    for(uint32_t i = 0; i < done->shapeCount; i++)
+    {
+        ShapeHandle handle = shapes.Deserialize(cursor);
+        if(handle.hidden) continue;
+
+        handle.layer = layer;
+        shapes.PushBack(handle);
+        added.push_back(handle);
+    }
+
+    area = done->area;
+    return true;
+}
+
+bool SvgImport::Import(Job& job)
+{
+    NSVGimage* image = nsvgParseFromFile(job.path.c_str(), "px", 96);
+    if(image == nullptr)
+    {
+        TraceLog(LOG_WARNING, "SVG: Failed to parse %s", job.path.c_str());
+        return false;
+    }
+
+    int total = 0;
+    for(const NSVGshape* shape = image->shapes; shape != nullptr; shape = shape->next)
+        total++;
+    job.progress = 0.1f;
+
+    ShapeStore store;
+    std::vector<ShapeHandle> handles;
+    std::vector<Vector2> points;
+    std::vector<FillSpan> spans;
+    int done = 0;
+    for(const NSVGshape* shape = image->shapes; shape != nullptr && !job.cancelled; shape = shape->next)
+    {
+        job.progress = 0.1f + 0.8f*done++/total;
+        if(!(shape->flags & NSVG_FLAGS_VISIBLE)) continue;
+
+        FlattenPaths(*shape, job.position, points);
+        if(points.empty()) continue;
+
+        // SVG paints the fill under the stroke.
+        Color fillColor = SvgColor(shape->fill, shape->opacity);
+        Vector2 origin;
+        float cellSize;
+        if(shape->fill.type != NSVG_PAINT_NONE && fillColor.a > 0 &&
+            ScanFill(points, shape->fillRule == NSVG_FILLRULE_EVENODD, job.cancelled, origin, cellSize, spans))
+        {
+            handles.push_back(store.CreateFill(spans.data(), spans.size(), origin, cellSize, fillColor));
+        }
+
+        // Dashes are drawn solid, the thickness being a whole radius.
+        Color strokeColor = SvgColor(shape->stroke, shape->opacity);
+        if(shape->stroke.type != NSVG_PAINT_NONE && strokeColor.a > 0 && shape->strokeWidth > 0)
+        {
+            int thickness = std::max(1, (int)std::lround(shape->strokeWidth/2));
+            handles.push_back(store.CreateStroke(points.data(), points.size(), strokeColor, thickness));
+        }
+    }
+    nsvgDelete(image);
+    if(job.cancelled) return false;
+
+    // Past MaxShapesPerKind there are no slots left, the rest is dropped.
+    std::erase_if(handles, [](ShapeHandle handle) { return handle.hidden; });
+
+    float minX = INFINITY, minY = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    for(ShapeHandle handle: handles)
+    {
+        store.Serialize(handle, job.shapes);
+
+        Rectangle bounds = store.Bounds(handle);
+        minX = std::min(minX, bounds.x);
+        minY = std::min(minY, bounds.y);
+        maxX = std::max(maxX, bounds.x + bounds.width);
+        maxY = std::max(maxY, bounds.y + bounds.height);
+    }
+    if(handles.empty())
+    {
+        TraceLog(LOG_WARNING, "SVG: Nothing to import in %s", job.path.c_str());
+        return false;
+    }
+
+    job.shapeCount = (uint32_t)handles.size();
+    job.area = { minX, minY, maxX - minX, maxY - minY };
+    TraceLog(LOG_INFO, "SVG: Imported %u shapes from %s", job.shapeCount, job.path.c_str());
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <raylib.h>
+#include <string>
+#include <vector>
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+
+constexpr const char* SvgExtension = ".svg";
+
+// Most an imported curve is allowed to stray from its flattened polyline, in
+// world units.
+constexpr float SvgCurveTolerance = 0.25f;
+
+// Cell size of the fills filled SVG paths become. Paths too big for 65535
+// cells across get coarser cells.
+constexpr float SvgFillCellSize = 0.5f;
+
+// Writes the visible shapes as one SVG group per layer, each shape as the
+// element it maps to. Like SaveDocument it streams through a small buffer
+// instead of building the whole file in memory.
+bool SaveSvg(const ShapeStore& shapes, const char* path);
+
+// Turns an SVG file into shapes on a pool thread: nanosvg parses it, curves
+// are flattened to polylines, filled paths become fills (scanline filled
+// with the path's fill rule) and stroked paths become strokes. The shapes
+// are built in a store of the job's own and handed over serialized, so the
+// main thread only copies them in once the job is done.
+class SvgImport
+{
+public:
+    SvgImport() = default;
+    SvgImport(const SvgImport&) = delete;
+    SvgImport& operator=(const SvgImport&) = delete;
+    ~SvgImport();
+
+    // Starts importing the file at path, cancelling an import in progress.
+    // The SVG's origin goes at position in world space.
+    void Start(ThreadPool& pool, std::string path, Vector2 position);
+    void Cancel();
+
+    bool Busy() const { return job != nullptr; }
+    float Progress() const;
+
+    // Once the job is done, adds its shapes to the draw order on the given
+    // layer and returns them with the area they cover. False while still
+    // busy, and when the import failed.
+    bool Finish(ShapeStore& shapes, uint8_t layer, std::vector<ShapeHandle>& added, Rectangle& area);
+
+private:
+    struct Job;
+
+    static bool Import(Job& job);
+
+    std::shared_ptr<Job> job;
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued jobs in submission order.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs the jobs still queued, then joins the workers.
+    ~ThreadPool();
+
+    void Submit(std::function<void()> job);
+    size_t Size() const { return workers.size(); }
+
+    // Calls fn(i) for every i in [0, count) on the workers and the calling
+    // thread, returns once all of them finished. Safe to call from a job.
+    template<typename F>
+    void ParallelFor(size_t count, F&& fn)
+    {
+        if(count == 0) return;
+
+        struct Batch
+        {
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> finished = 0;
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+        auto batch = std::make_shared<Batch>();
+
+        auto run = [batch, count, &fn]()
+        {
+            for(size_t i = batch->next++; i < count; i = batch->next++)
+            {
+                fn(i);
+                if(++batch->finished == count)
+                {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    batch->done.notify_all();
+                }
+            }
+        };
+
+        // Helpers that only get to run after the batch is over find nothing
+        // left to do, so fn is never called once ParallelFor returned.
+        size_t helpers = std::min(count - 1, workers.size());
+        for(size_t i = 0; i < helpers; i++)
+            Submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait(lock, [&]() { return batch->finished == count; });
+    }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
@@ -0,0 +1,160 @@
+#include "timelapse.hpp"
+#include "render.hpp"
+#include "rlgl.h"
+#include <algorithm>
+#include <cmath>
+#include "external/msf_gif.h"
+
+// raylib builds msf_gif for its own screen recording, the encoder links
+// against that.
+
+Timelapse::~Timelapse()
+{
+    Join();
+}
+
+bool Timelapse::Start(const char* path, int screenWidth, int screenHeight, float interval)
+{
+    if(Recording() || Busy()) return false;
+    Join();
+
+    float scale = std::min(1.0f, (float)TimelapseMaxSize/std::max({ screenWidth, screenHeight, 1 }));
+    int width = std::max(1, (int)std::lround(screenWidth*scale));
+    int height = std::max(1, (int)std::lround(screenHeight*scale));
+
+    std::FILE* file = std::fopen(path, "wb");
+    if(file == nullptr)
+    {
+        TraceLog(LOG_WARNING, "TIMELAPSE: Failed to open %s", path);
+        return false;
+    }
+
+    target = LoadRenderTexture(width, height);
+    this->interval = std::max(interval, 0.0f);
+    lastSample = -INFINITY;
+    samplePending = false;
+    frames = 0;
+    dropped = 0;
+    stopping = false;
+    finished = false;
+    encoder = std::thread(&Timelapse::EncoderLoop, this, file, width, height);
+
+    TraceLog(LOG_INFO, "TIMELAPSE: Recording %dx%d frames to %s", width, height, path);
+    return true;
+}
+
+void Timelapse::Stop()
+{
+    if(!Recording()) return;
+
+    UnloadRenderTexture(target);
+    target = {};
+    samplePending = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+}
+
+bool Timelapse::Busy() const
+{
+    // Recording alone doesn't keep the loop awake, an idle window isn't sampled.
+    return samplePending || (!Recording() && encoder.joinable() && !finished);
+}
+
+void Timelapse::Join()
+{
+    if(!encoder.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    encoder.join();
+}
+
+void Timelapse::ReadBack()
+{
+    // An encoder that finished after Stop is reaped without blocking.
+    if(!Recording() && finished && encoder.joinable())
+        encoder.join();
+
+    if(!samplePending) return;
+    samplePending = false;
+
+    void* pixels = rlReadTexturePixels(target.texture.id, target.texture.width, target.texture.height, target.texture.format);
+    if(pixels == nullptr) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(pixels);
+    }
+    wake.notify_one();
+    frames++;
+}
+
+void Timelapse::Sample(const TiledCanvas& canvas, const ShapeStore& shapes, int screenWidth, int screenHeight)
+{
+    if(!Recording() || samplePending) return;
+
+    double now = GetTime();
+    if(now - lastSample < interval) return;
+    lastSample = now;
+
+    // A full queue means the encoder is behind, this sample isn't even drawn.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(queue.size() >= TimelapseQueueFrames)
+        {
+            dropped++;
+            return;
+        }
+    }
+
+    // The view fit into the frame, a resized window leaves a border.
+    float scale = std::min((float)target.texture.width/std::max(screenWidth, 1), (float)target.texture.height/std::max(screenHeight, 1));
+    BeginTextureMode(target);
+    ClearBackground(BackgroundColor);
+    canvas.Render(shapes, scale);
+    EndTextureMode();
+    samplePending = true;
+}
+
+void Timelapse::EncoderLoop(std::FILE* file, int width, int height)
+{
+    MsfGifState state = {};
+    bool written = msf_gif_begin_to_file(&state, width, height, (MsfGifFileWriteFunc)std::fwrite, file) != 0;
+
+    // Render textures read back bottom-up, a negative pitch flips them.
+    int pitch = width*4;
+    while(true)
+    {
+        void* pixels;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if(queue.empty()) break;
+
+            pixels = queue.front();
+            queue.pop_front();
+        }
+
+        uint8_t* lastRow = (uint8_t*)pixels + (size_t)(height - 1)*pitch;
+        if(written)
+            written = msf_gif_frame_to_file(&state, lastRow, TimelapseFrameCentiseconds, TimelapseBitDepth, -pitch) != 0;
+        MemFree(pixels);
+    }
+
+    if(written)
+        written = msf_gif_end_to_file(&state) != 0;
+    written = std::fclose(file) == 0 && written;
+
+    if(written)
+        TraceLog(LOG_INFO, "TIMELAPSE: Saved, %d frames dropped", dropped.load());
+    else
+        TraceLog(LOG_WARNING, "TIMELAPSE: Failed to write the GIF");
+    finished = true;
+}
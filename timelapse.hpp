@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <raylib.h>
+#include <thread>
+#include "canvas.hpp"
+#include "shape_store.hpp"
+
+constexpr const char* TimelapseExtension = ".gif";
+
+// Seconds between frames unless the user picks another interval. Frames are
+// only sampled while the loop runs, an idle window has nothing new to show.
+constexpr float DefaultTimelapseInterval = 2.0f;
+
+// Longest side of a frame in pixels, and how long each one shows.
+constexpr int TimelapseMaxSize = 480;
+constexpr int TimelapseFrameCentiseconds = 10;
+
+// Frames read back but not encoded yet. A sample that finds the queue full
+// is dropped and counted instead of waiting for the encoder.
+constexpr size_t TimelapseQueueFrames = 4;
+
+// Colors msf_gif may quantize a frame to, at most 1 << depth.
+constexpr int TimelapseBitDepth = 16;
+
+// Records the canvas into an animated GIF through raylib's msf_gif. Every
+// interval the composited tiles are drawn into a small render texture, one
+// quad per tile, which is read back at the start of the next frame once the
+// GPU is done with it rather than stalling on it straight away. The pixels
+// go through a bounded queue to an encoder thread that writes the GIF frame
+// by frame, so neither the readback size nor the encoding ever grows with
+// the canvas or the session.
+class Timelapse
+{
+public:
+    Timelapse() = default;
+    Timelapse(const Timelapse&) = delete;
+    Timelapse& operator=(const Timelapse&) = delete;
+
+    // Waits for the encoder. Stop has to come first, while the window is
+    // still open.
+    ~Timelapse();
+
+    // Frames are sized after the screen, scaled down to TimelapseMaxSize.
+    bool Start(const char* path, int screenWidth, int screenHeight, float interval);
+
+    // The encoder finishes writing what is queued on its own.
+    void Stop();
+
+    bool Recording() const { return target.id != 0; }
+
+    // A readback is pending, or the encoder is still draining after Stop.
+    bool Busy() const;
+
+    int Frames() const { return frames; }
+    int DroppedFrames() const { return dropped; }
+
+    // At the start of a frame, before anything is drawn: reads back the
+    // sample the last frame rendered.
+    void ReadBack();
+
+    // After the canvas is updated: renders a sample when the interval is up.
+    void Sample(const TiledCanvas& canvas, const ShapeStore& shapes, int screenWidth, int screenHeight);
+
+private:
+    void EncoderLoop(std::FILE* file, int width, int height);
+    void Join();
+
+    RenderTexture2D target = {};
+    float interval = DefaultTimelapseInterval;
+    double lastSample = 0;
+    bool samplePending = false;
+    int frames = 0;
+    std::atomic<int> dropped = 0;
+
+    // Read back pixels, rows bottom-up, waiting for the encoder.
+    std::deque<void*> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::atomic<bool> finished = false;
+    std::thread encoder;
+};